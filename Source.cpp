@@ -2,8 +2,21 @@
 #include <GLFW/glfw3.h>
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
+#include "command_list.h"
+#include "frustum_cull.h"
+#include "geometry_buffer.h"
+#include "gpu_cull.h"
+#include "instance_buffer.h"
+#include "occlusion_cull.h"
+#include "parallel.h"
+#include "render_queue.h"
+#include "ring_buffer.h"
+#include "shader_program.h"
+#include "simulation.h"
+#include "static_batch.h"
+#include "texture_stream.h"
+#include "uniform_buffers.h"
+#include "virtual_texture.h"
 #include <iostream>
 #include <vector>
 #include <locale.h>
@@ -11,26 +24,64 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <chrono>
+#include <climits>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <random>
+#include <string>
 // Shader sources
 const char* vertexShaderSource = R"(
 #version 330 core
+#extension GL_ARB_shader_draw_parameters : enable
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+// Per-instance model matrix (InstanceBuffer), used instead of the draw's
+// own for instanced draws
+layout (location = 3) in mat4 instanceModel;
 out vec2 TexCoords;
 out vec3 FragPos;
 out vec3 Normal;
+flat out int ObjectIndex;
+
+// std140, matching FrameUniforms and ObjectUniforms in uniform_buffers.h
+layout (std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+    vec4 lightColor;
+    vec4 lightPos[6];
+};
+
+struct ObjectUniforms {
+    mat4 model;
+    vec4 objectColor;
+    ivec4 params; // x: layer in textureLayers or -1, y: model from instanceModel
+};
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// One element per draw of a batch (ObjectUniformBuffer::batchObjects)
+layout (std140) uniform ObjectData {
+    ObjectUniforms objects[128];
+};
+
+// The draw's element in objects. gl_DrawIDARB numbers the draws of a
+// glMultiDrawElementsIndirect; single draws set drawBase instead.
+uniform int drawBase;
 
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+#ifdef GL_ARB_shader_draw_parameters
+    ObjectIndex = drawBase + gl_DrawIDARB;
+#else
+    ObjectIndex = drawBase;
+#endif
+    mat4 world = objects[ObjectIndex].params.y != 0 ? instanceModel : objects[ObjectIndex].model;
+    FragPos = vec3(world * vec4(aPos, 1.0));
+    Normal = mat3(transpose(inverse(world))) * aNormal;
     gl_Position = projection * view * vec4(FragPos, 1.0);
     TexCoords = aTexCoords;
 
@@ -44,111 +95,118 @@ out vec4 FragColor;
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
+flat in int ObjectIndex;
+
+// std140, matching FrameUniforms and ObjectUniforms in uniform_buffers.h
+layout (std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+    vec4 lightColor;
+    vec4 lightPos[6];
+};
+
+struct ObjectUniforms {
+    mat4 model;
+    vec4 objectColor;
+    ivec4 params; // x: layer in textureLayers or -1, y: model from instanceModel
+};
+
+// One element per draw of a batch (ObjectUniformBuffer::batchObjects)
+layout (std140) uniform ObjectData {
+    ObjectUniforms objects[128];
+};
 
-uniform vec3 lightPos[6];
-uniform vec3 viewPos;
-uniform vec3 lightColor;
 uniform sampler2D terrainTexture;
-uniform vec4 objectColor;
+uniform sampler2DArray textureLayers; // packed textures, on unit 1, layer from params.x
+uniform bool virtualTexture;          // sample the vt* virtual texture instead (the terrain)
+uniform sampler2D vtPhysical;         // set by VirtualTexture::setUniforms
+uniform usampler2D vtIndirection;
+uniform ivec2 vtPages;
+uniform int vtLevels;
+uniform float vtTileSize;
+uniform float vtBorder;
+uniform vec2 vtPhysicalSize;
+uniform float vtLodBias;
+
+// Picks the page at the wanted level; its indirection texel points at it in
+// the cache, or at its finest resident ancestor while it is still loading
+vec4 sampleVirtual(vec2 uv)
+{
+    vec2 texel = uv * vec2(vtPages) * vtTileSize;
+    float lod = 0.5 * log2(max(dot(dFdx(texel), dFdx(texel)), dot(dFdy(texel), dFdy(texel)))) + vtLodBias;
+    int level = clamp(int(floor(lod + 0.5)), 0, vtLevels - 1);
+    ivec2 pages = max(vtPages >> level, ivec2(1));
+    uvec4 entry = texelFetch(vtIndirection, min(ivec2(fract(uv) * vec2(pages)), pages - 1), level);
+
+    vec2 entryPages = vec2(max(vtPages >> int(entry.z), ivec2(1)));
+    vec2 inPage = fract(fract(uv) * entryPages);
+    vec2 position = vec2(entry.xy) * (vtTileSize + 2.0 * vtBorder) + vtBorder + inPage * vtTileSize;
+    return textureLod(vtPhysical, position / vtPhysicalSize, 0.0);
+}
 
 void main()
 {
     // Ambient lighting
     float ambientStrength = 0.001;
-    vec3 ambient = ambientStrength * lightColor;
+    vec3 ambient = ambientStrength * lightColor.rgb;
 
     vec3 norm = normalize(Normal);
     vec3 result = ambient;
 
     // Add lighting for each light source
     for (int i = 0; i < 6; ++i) {
-        vec3 lightDir = normalize(lightPos[i] - FragPos);
+        vec3 lightDir = normalize(lightPos[i].xyz - FragPos);
 
         // Diffuse lighting
         float diff = max(dot(norm, lightDir), 0.0);
-        vec3 diffuse = diff * lightColor;
+        vec3 diffuse = diff * lightColor.rgb;
 
         // Specular lighting
         float specularStrength = 0.2;
-        vec3 viewDir = normalize(viewPos - FragPos);
+        vec3 viewDir = normalize(viewPos.xyz - FragPos);
         vec3 reflectDir = reflect(-lightDir, norm);
         float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
-        vec3 specular = specularStrength * spec * lightColor;
+        vec3 specular = specularStrength * spec * lightColor.rgb;
 
         result += diffuse + specular;
     }
 
 
-    vec4 textureColor = texture(terrainTexture, TexCoords);
+    int textureLayer = objects[ObjectIndex].params.x;
+    vec4 textureColor = virtualTexture ? sampleVirtual(TexCoords)
+                      : textureLayer < 0 ? texture(terrainTexture, TexCoords)
+                                         : texture(textureLayers, vec3(TexCoords, textureLayer));
 
 
-    FragColor = vec4(result, 1.0) * textureColor * objectColor;
+    FragColor = vec4(result, 1.0) * textureColor * objects[ObjectIndex].objectColor;
 }
 
 )";
 
-//  
-unsigned int loadTexture(const char *path) {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrChannels;
-    unsigned char *data = stbi_load(path, &width, &height, &nrChannels, 0);
-    if (data) {
-        glBindTexture(GL_TEXTURE_2D, textureID);
-
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-
-        GLenum format;
-        if (nrChannels == 1)
-            format = GL_RED;
-        else if (nrChannels == 3)
-            format = GL_RGB;
-        else if (nrChannels == 4)
-            format = GL_RGBA;
+// Virtual texture feedback: the page and level sampleVirtual would pick,
+// written per pixel for VirtualTexture to read back
+const char* feedbackFragmentShaderSource = R"(
+#version 330 core
+out uvec4 Feedback;
 
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    } else {
-        std::cerr << "Failed to load texture" << std::endl;
-    }
-    stbi_image_free(data);
-    return textureID;
-}
+in vec2 TexCoords;
 
+uniform ivec2 vtPages;
+uniform int vtLevels;
+uniform float vtTileSize;
+uniform float vtLodBias;
 
-// Function to compile shaders
-GLuint compileShader(GLenum type, const char* source) {
-    GLuint shader = glCreateShader(type);
-    glShaderSource(shader, 1, &source, nullptr);
-    glCompileShader(shader);
-    int success;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        char infoLog[512];
-        glGetShaderInfoLog(shader, 512, nullptr, infoLog);
-        std::cout << "Shader compilation error: " << infoLog << std::endl;
-    }
-    return shader;
+void main()
+{
+    vec2 texel = TexCoords * vec2(vtPages) * vtTileSize;
+    float lod = 0.5 * log2(max(dot(dFdx(texel), dFdx(texel)), dot(dFdy(texel), dFdy(texel)))) + vtLodBias;
+    int level = clamp(int(floor(lod + 0.5)), 0, vtLevels - 1);
+    ivec2 pages = max(vtPages >> level, ivec2(1));
+    Feedback = uvec4(min(ivec2(fract(TexCoords) * vec2(pages)), pages - 1), level, 1);
 }
+)";
 
-// Initialize shader program
-GLuint initShaderProgram() {
-    GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexShaderSource);
-    GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentShaderSource);
-    GLuint shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-    return shaderProgram;
-}
 
 // Generate terrain (plane)
 void generateTerrain(std::vector<float>& vertices, std::vector<unsigned int>& indices, int size) {
@@ -352,11 +410,17 @@ std::vector<unsigned int> generateCubeIndices() {
 struct Model {
     std::vector<float> vertices;
     std::vector<unsigned int> indices;
-    GLuint VAO, VBO, EBO;
+    MeshRange mesh; // in the scene's GeometryBuffer, empty if never added
+    MeshBounds bounds;
 
-    Model(const std::string& path) {
+    // Loads without uploading, for meshes only drawn as part of a static batch
+    explicit Model(const std::string& path) {
         loadModel(path);
-        setupModel();
+        bounds = computeBounds(vertices, indices);
+    }
+
+    Model(const std::string& path, GeometryBuffer& geometry) : Model(path) {
+        mesh = geometry.add(vertices, indices);
     }
 
     void loadModel(const std::string& path) {
@@ -391,36 +455,22 @@ struct Model {
             }
         }
     }
-
-    void setupModel() {
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
-
-        glBindVertexArray(VAO);
-
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
-
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-        glEnableVertexAttribArray(2);
-
-        glBindVertexArray(0);
-    }
-
-    void draw(GLuint shaderProgram) {
-        glUseProgram(shaderProgram);
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-    }
+};
+// A draw waiting for the frame's culling: it goes into the render queue if
+// its entry in the frame's CullList is in view
+struct PendingDraw {
+    unsigned int pass;
+    unsigned int program;
+    RenderItem item;
+    float distance;
+    int bounds;
+};
+// A run of the sorted render queue that shares all state but the draws'
+// ObjectUniforms, drawn with one glMultiDrawElementsIndirect
+struct DrawBatch {
+    size_t first; // in the queue, and in the frame's indirect commands
+    int count;
+    int objects;  // ObjectUniformBuffer slot
 };
 glm::vec3 rabbitPosition(1.0f, 0.0f, 1.0f); //  
 glm::vec3 rabbitFront(0.0f, 0.0f, -1.0f);   //  
@@ -451,7 +501,44 @@ void processRabbitInput(GLFWwindow* window, const std::vector<float>& terrainVer
     //      
     rabbitPosition.y = getTerrainHeight(terrainVertices, terrainSize, rabbitPosition.x, rabbitPosition.z);
 }
-int main() {
+
+// Length of one simulation step: the rate the rabbits were tuned at
+const double simulationStep = 1.0 / 60.0;
+
+// Runs the crowd's simulation on its own, with no window or GL, as fast as
+// it goes, checking the state after every step. Prints JSON with the speed
+// and a checksum of the end state (the seed is fixed, so equal checksums mean
+// equal runs); returns 1 if the state ever went bad.
+int runHeadless(int steps, int rabbits) {
+    CrowdSimulation crowd(rabbits, 1);
+    int badStep = -1;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps && badStep < 0; ++i) {
+        crowd.step(static_cast<float>(simulationStep));
+        if (!crowd.valid())
+            badStep = i;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("{\n"
+                "  \"steps\": %d,\n"
+                "  \"rabbits\": %d,\n"
+                "  \"seconds\": %.6f,\n"
+                "  \"stepsPerSecond\": %.1f,\n"
+                "  \"simulatedSeconds\": %.3f,\n"
+                "  \"checksum\": %.6f,\n"
+                "  \"badStep\": %d\n"
+                "}\n",
+                steps, rabbits, seconds, seconds > 0.0 ? steps / seconds : 0.0, steps * simulationStep,
+                crowd.checksum(), badStep);
+    return badStep < 0 ? 0 : 1;
+}
+
+// --headless [steps] [rabbits] runs only the simulation (see runHeadless)
+int main(int argc, char** argv) {
+    if (argc > 1 && std::strcmp(argv[1], "--headless") == 0)
+        return runHeadless(argc > 2 ? std::max(std::atoi(argv[2]), 1) : 1000000,
+                           argc > 3 ? std::max(std::atoi(argv[3]), 1) : 31);
+
     glfwInit();
     GLFWwindow* window = glfwCreateWindow(800, 600, "Witches tea party", nullptr, nullptr);
     glfwMakeContextCurrent(window);
@@ -464,26 +551,154 @@ int main() {
 
     // Hide the mouse cursor and capture it
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-    GLuint shaderProgram = initShaderProgram();
-    GLuint texture1 = loadTexture("terrain_texture.png"); //  
-    GLuint texture2 = loadTexture("white.jpg"); //    
-    GLuint texture3 = loadTexture("Round_table_texture_.jpg");
-    GLuint texture4 = loadTexture("Round table texture _NRM.jpg");
-    GLuint texture5 = loadTexture("Round table texture .jpg");
+    ShaderProgram shaderProgram;
+    shaderProgram.link(vertexShaderSource, fragmentShaderSource);
+    // Textures stream in over the first frames; update() below uploads them
+    TextureStreamer textures;
+
+    // With packing on, the scene textures share texture arrays on unit 1 and
+    // draws only switch the layer uniform
+    const bool packTextures = true;
+    // Caps the larger side of every scene texture (0 = full size); JPEGs are
+    // then decoded at reduced scale, so a low setting also loads faster
+    const int maxTextureSize = 0;
+    std::vector<TextureSource> sceneTextures = {
+        {"terrain_texture.png", TEXTURE_COLOR}, //  
+        {"white.jpg", TEXTURE_COLOR}, //    
+        {"Round_table_texture_.jpg", TEXTURE_COLOR},
+        {"Round table texture _NRM.jpg", TEXTURE_NORMAL},
+        {"Round table texture .jpg", TEXTURE_COLOR},
+    };
+    // The terrain image can be far larger than VRAM as a virtual texture:
+    // only the pages in view are resident, picked by a low-resolution
+    // feedback pass each frame (textures on units 2 and 3). When its page
+    // file can't be baked or opened, the terrain streams like the rest.
+    const bool useVirtualTerrain = true;
+    VirtualTexture terrainPages;
+    const bool virtualTerrain = useVirtualTerrain && terrainPages.open(sceneTextures[0].path, 800, 600);
+    ShaderProgram feedbackProgram;
+    if (virtualTerrain)
+        feedbackProgram.link(vertexShaderSource, feedbackFragmentShaderSource);
+
+    // Index 0 stays a placeholder when the terrain is virtual
+    std::vector<TextureSource> streamedTextures(sceneTextures.begin() + (virtualTerrain ? 1 : 0), sceneTextures.end());
+    std::vector<TextureLayer> sceneLayers;
+    std::vector<GLuint> sceneTextureIDs;
+    if (packTextures) {
+        sceneLayers = textures.loadPacked(streamedTextures, maxTextureSize);
+        if (virtualTerrain)
+            sceneLayers.insert(sceneLayers.begin(), TextureLayer());
+    } else {
+        for (const TextureSource& source : streamedTextures)
+            sceneTextureIDs.push_back(textures.load(source.path, source.kind, maxTextureSize));
+        if (virtualTerrain)
+            sceneTextureIDs.insert(sceneTextureIDs.begin(), 0);
+    }
+    // Per-frame and per-object values come from uniform blocks, shared by
+    // both programs
+    shaderProgram.bindBlock("FrameData", UNIFORM_BINDING_FRAME);
+    shaderProgram.bindBlock("ObjectData", UNIFORM_BINDING_OBJECT);
+    feedbackProgram.bindBlock("FrameData", UNIFORM_BINDING_FRAME);
+    feedbackProgram.bindBlock("ObjectData", UNIFORM_BINDING_OBJECT);
+    FrameUniformBuffer frameUniforms;
+    ObjectUniformBuffer objectUniforms;
+    GeometryBuffer geometry;
+    IndirectDrawBuffer indirectDraws;
+    // One glMultiDrawElementsIndirect per batch when the driver has it and
+    // gl_DrawIDARB to go with it, else a draw call per item
+    const bool multiDrawIndirect = (GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect) && GLEW_ARB_shader_draw_parameters;
+    // The orbiting rabbits are culled in a compute pass instead of one by
+    // one on the CPU when there is one to run and an indirect draw for it to
+    // fill in
+    const bool gpuCulling = multiDrawIndirect && GpuInstanceCuller::supported();
+    // Programs by their number in render queue keys
+    ShaderProgram* programs[] = {&shaderProgram, &feedbackProgram};
+    const unsigned int sceneProgram = 0, pageFeedbackProgram = 1;
+    RenderQueue renderQueue;
+    std::vector<ObjectUniforms> sceneObjects;
+    CullList culling;
+    OcclusionBuffer occlusion;
+    std::vector<PendingDraw> pendingDraws;
+    std::vector<DrawBatch> drawBatches;
+    std::vector<DrawElementsIndirectCommand> drawCommands;
+    // The GL texture scene texture i is drawn from, and its layer there (-1
+    // when not packed); the virtual terrain (-1) has neither
+    auto textureBinding = [&](int i) -> GLuint {
+        return i < 0 ? 0 : packTextures ? sceneLayers[i].texture : sceneTextureIDs[i];
+    };
+    auto textureLayer = [&](int i) {
+        return i < 0 || !packTextures ? -1 : sceneLayers[i].layer;
+    };
+    // Keys number textures and VAOs in the order the frame first submits
+    // them, since their GL names don't fit the key's bits
+    std::vector<GLuint> keyTextures, keyVertexArrays;
+    auto keyNumber = [](std::vector<GLuint>& names, GLuint name) {
+        auto found = std::find(names.begin(), names.end(), name);
+        if (found == names.end())
+            found = names.insert(names.end(), name);
+        return static_cast<unsigned int>(found - names.begin());
+    };
+    // Scene draws go in the opaque pass, keyed by their distance from the
+    // camera (the far plane is at 100). Instanced draws take their model
+    // matrices from the mesh's InstanceBuffer and sort on state alone.
+    auto submit = [&](unsigned int pass, unsigned int program, const RenderItem& item, float distance) {
+        renderQueue.submit(RenderQueue::makeKey(pass, program, keyNumber(keyTextures, textureBinding(item.texture)),
+                                                keyNumber(keyVertexArrays, item.vao), distance / 100.0f), item);
+    };
+    auto addObject = [&](const glm::mat4& model, const glm::vec4& color, int texture, bool instanced) {
+        sceneObjects.push_back({model, color, glm::ivec4(textureLayer(texture), instanced ? 1 : 0, 0, 0)});
+        return static_cast<int>(sceneObjects.size() - 1);
+    };
+    // Plain draws wait for culling, against their bounds as placed
+    auto addDraw = [&](const DrawCommand& command) {
+        const MeshRange& mesh = command.mesh;
+        RenderItem item = {geometry.vao(), static_cast<int>(mesh.indexCount), mesh.firstIndex, mesh.baseVertex,
+                           command.texture, addObject(command.model, command.color, command.texture, false), 0};
+        pendingDraws.push_back({RENDER_PASS_OPAQUE, sceneProgram, item, command.distance, culling.add(command.bounds, command.model)});
+        return pendingDraws.back();
+    };
+    auto addInstancedDraw = [&](const MeshRange& mesh, int texture, size_t instances, const glm::vec4& color) {
+        RenderItem item = {geometry.vao(), static_cast<int>(mesh.indexCount), mesh.firstIndex, mesh.baseVertex,
+                           texture, addObject(glm::mat4(1.0f), color, texture, true), static_cast<int>(instances)};
+        submit(RENDER_PASS_OPAQUE, sceneProgram, item, 0.0f);
+        return item.object;
+    };
+
+    shaderProgram.use();
+    shaderProgram.set(UNIFORM_TEXTURE_LAYERS, 1);
+
+    // Binds scene texture i for the next draws; the layer goes with each draw
+    GLuint boundArray = 0;
+    auto useTexture = [&](int i) {
+        if (!packTextures) {
+            textures.touch(sceneTextureIDs[i]);
+            glBindTexture(GL_TEXTURE_2D, sceneTextureIDs[i]);
+            return;
+        }
+        textures.touch(sceneLayers[i].texture);
+        if (sceneLayers[i].texture != boundArray) {
+            boundArray = sceneLayers[i].texture;
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, boundArray);
+            glActiveTexture(GL_TEXTURE0);
+        }
+    };
     //glActiveTexture(GL_TEXTURE0);
 
 
 
     //glUniform1i(glGetUniformLocation(shaderProgram, "terrainTexture"), 0);
 
+    // The table, umbrella, chair, mug and teapot only reach the GPU through
+    // the prop batches below, so their own meshes are not uploaded
     Model objModel("table.obj");
     Model objModel1("13518_Beach_Umbrella_v1_L3.obj");
     Model objModel2("Garden chair.obj");
-    Model objModel3("uploads_files_5014646_Rabbit_Quad.obj");
+    Model objModel3("uploads_files_5014646_Rabbit_Quad.obj", geometry);
     Model objModel4("teamugblend.obj");
     Model objModel5("20900_Brown_Betty_Teapot_v1.obj");
-    Model objModel6("uploads_files_5014646_Rabbit_Quad1.obj");
-    Model objModel7("untitled.obj");
+    Model objModel6("uploads_files_5014646_Rabbit_Quad1.obj", geometry);
+    Model objModel7("untitled.obj", geometry);
     int terrainSize = 300;
     float cubeSize = terrainSize * 0.2f;
     float terrainYOffset = 0.0f;
@@ -498,275 +713,406 @@ int main() {
 
 
 
-    GLuint VBO_Terrain, VAO_Terrain, EBO_Terrain;
-
-    glGenVertexArrays(1, &VAO_Terrain);
-    glGenBuffers(1, &VBO_Terrain);
-    glGenBuffers(1, &EBO_Terrain);
-
-    glBindVertexArray(VAO_Terrain);
-
-    glBindBuffer(GL_ARRAY_BUFFER, VBO_Terrain);
-    glBufferData(GL_ARRAY_BUFFER, terrainVertices.size() * sizeof(float), terrainVertices.data(), GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO_Terrain);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, terrainIndices.size() * sizeof(unsigned int), terrainIndices.data(), GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-glEnableVertexAttribArray(2);
+    // The terrain goes in as square chunks of terrainChunk quads over its
+    // shared vertices, so the ones out of view can be culled
+    const int terrainChunk = 50;
+    int terrainBaseVertex = geometry.add(terrainVertices, std::vector<unsigned int>()).baseVertex;
+    std::vector<MeshRange> terrainChunks;
+    std::vector<MeshBounds> terrainChunkBounds;
+    for (int z0 = 0; z0 < terrainSize - 1; z0 += terrainChunk) {
+        for (int x0 = 0; x0 < terrainSize - 1; x0 += terrainChunk) {
+            std::vector<unsigned int> chunk;
+            for (int z = z0; z < std::min(z0 + terrainChunk, terrainSize - 1); ++z) {
+                // generateTerrain writes 6 indices per quad, row by row
+                size_t first = (static_cast<size_t>(z) * (terrainSize - 1) + x0) * 6;
+                size_t last = (static_cast<size_t>(z) * (terrainSize - 1) + std::min(x0 + terrainChunk, terrainSize - 1)) * 6;
+                chunk.insert(chunk.end(), terrainIndices.begin() + first, terrainIndices.begin() + last);
+            }
+            terrainChunks.push_back(geometry.addIndices(chunk, terrainBaseVertex));
+            terrainChunkBounds.push_back(computeBounds(terrainVertices, chunk));
+        }
+    }
 
+    // Occluders for the occlusion test, each inside what it stands for: the
+    // terrain on a grid of every occluderStep-th vertex (the hill is concave,
+    // so the coarse surface stays under the real one) and the square
+    // inscribed in the round table top
+    const int occluderStep = 13; // splits the 299 quads a side evenly
+    int occluderSide = (terrainSize - 1) / occluderStep + 1;
+    std::vector<glm::vec3> terrainOccluder;
+    std::vector<unsigned int> terrainOccluderIndices;
+    for (int z = 0; z < occluderSide; ++z) {
+        for (int x = 0; x < occluderSide; ++x) {
+            const float* vertex = &terrainVertices[(static_cast<size_t>(z) * terrainSize + x) * occluderStep * 8];
+            terrainOccluder.push_back(glm::vec3(vertex[0], vertex[1], vertex[2]));
+            if (x < occluderSide - 1 && z < occluderSide - 1) {
+                unsigned int topLeft = z * occluderSide + x, bottomLeft = topLeft + occluderSide;
+                terrainOccluderIndices.insert(terrainOccluderIndices.end(), {topLeft, bottomLeft, topLeft + 1, topLeft + 1, bottomLeft, bottomLeft + 1});
+            }
+        }
+    }
+    glm::vec3 tableHalf = (objModel.bounds.max - objModel.bounds.min) * (0.5f / std::sqrt(2.0f));
+    glm::vec3 tableTop(objModel.bounds.center.x, objModel.bounds.max.y, objModel.bounds.center.z);
+    std::vector<glm::vec3> tableOccluder = {tableTop + glm::vec3(-tableHalf.x, 0.0f, -tableHalf.z), tableTop + glm::vec3(tableHalf.x, 0.0f, -tableHalf.z),
+                                            tableTop + glm::vec3(-tableHalf.x, 0.0f, tableHalf.z), tableTop + glm::vec3(tableHalf.x, 0.0f, tableHalf.z)};
+    std::vector<unsigned int> tableOccluderIndices = {0, 2, 1, 1, 2, 3};
 
 std::vector<float> textureCoords;
 std::vector<float> cubeVertices;
 generateCube(cubeVertices, textureCoords, cubeSize, cubeHeight, cubeYOffset);
 std::vector<unsigned int> cubeIndices = generateCubeIndices();
 
-    GLuint VBO_Cube, VAO_Cube, EBO_Cube;
-    glGenVertexArrays(1, &VAO_Cube);
-    glGenBuffers(1, &VBO_Cube);
-    glGenBuffers(1, &EBO_Cube);
-
-    glBindVertexArray(VAO_Cube);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO_Cube);
-    glBufferData(GL_ARRAY_BUFFER, cubeVertices.size() * sizeof(float), cubeVertices.data(), GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO_Cube);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, cubeIndices.size() * sizeof(unsigned int), cubeIndices.data(), GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-
-glm::vec4 objectColor(1.0f, 0.0f, 0.0f, 1.0f);
-
-
-GLuint objectColorLocation = glGetUniformLocation(shaderProgram, "objectColor");
-glUniform4fv(objectColorLocation, 1, glm::value_ptr(objectColor));
-
-float orbitRadius = 17.0f;
-float orbitSpeed = 0.5f;
-float angle = 0.0f;
-glm::vec3 rotationCenter(150.0f * 0.2f, 6.0f, 150.0f * 0.2f);
-float spacing = 0.2f;
-float maxJumpHeight = 2.0f;
-float jumpDuration = 0.5f;
-int numRabbits = 31;
-std::vector<float> jumpTimers(numRabbits, 0.0f);
-std::vector<bool> isJumping(numRabbits, false);
-
-std::random_device rd;
-std::mt19937 gen(rd());
-std::uniform_real_distribution<> dis(0.0, 1.0);
-
-    while (!glfwWindowShouldClose(window)) {
-        processInput(window,terrainVertices, terrainSize);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glUseProgram(shaderProgram);
-        processRabbitInput(window, terrainVertices, terrainSize);
-
-        glm::mat4 model = glm::mat4(1.0f);
-        glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
-        glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
-
-
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-
-
-        glUniform3f(glGetUniformLocation(shaderProgram, "viewPos"), cameraPos.x, cameraPos.y, cameraPos.z);
-        glUniform3f(glGetUniformLocation(shaderProgram, "lightColor"), 0.8f, 0.8f, 0.8f);
-        //glUniform3f(glGetUniformLocation(shaderProgram, "objectColor"), 0.0f, 1.0f, 0.0f);
-        glUniform1f(glGetUniformLocation(shaderProgram, "cutOff"), cutOff);
-
-        // Draw terrain
-        glUniform4fv(objectColorLocation, 1, glm::value_ptr(glm::vec4(1.0f, 1.0f, 1.0f, 1.0f))); //    
-//  
-            glBindTexture(GL_TEXTURE_2D, texture1);
-        glBindVertexArray(VAO_Terrain);
-        glDrawElements(GL_TRIANGLES, terrainIndices.size(), GL_UNSIGNED_INT, 0);
-
-
-//  
-
-        //    5  
-glm::vec3 lightPos[6] = {
-    glm::vec3(-terrainSize * 0.5f, 50.0f, -terrainSize * 0.5f), // Top-left corner
-    glm::vec3( terrainSize * 0.5f, 50.0f, -terrainSize * 0.5f), // Top-right corner
-   glm::vec3(-terrainSize * 0.5f, 50.0f,  terrainSize * 0.5f), // Bottom-left corner
-    glm::vec3( terrainSize * 0.5f, 50.0f,  terrainSize * 0.5f), // Bottom-right corner
-    glm::vec3(0.0f, 50.0f, 0.0f), // Center of the terrain
-};
-angle += orbitSpeed * glfwGetTime();
-glfwSetTime(0.0);
-for (int i = 0; i < numRabbits; ++i) {
-    float currentAngle = angle + i * spacing;
-
-    //    
-    float x = rotationCenter.x + orbitRadius * cos(currentAngle);
-    float z = rotationCenter.z + orbitRadius * sin(currentAngle);
-    float y = rotationCenter.y;
-
-    //      
-    if (!isJumping[i] && dis(gen) < 0.01) {
-        isJumping[i] = true;
-        jumpTimers[i] = jumpDuration; //   
-    }
-
-    //   
-    if (isJumping[i]) {
-        float jumpProgress = 1.0f - (jumpTimers[i] / jumpDuration);
-        y += maxJumpHeight * sin(jumpProgress * glm::pi<float>()); //   
-
-        //     ,   
-        jumpTimers[i] -= 0.016f; //  16   
-        if (jumpTimers[i] <= 0.0f) {
-            isJumping[i] = false; //   
-            jumpTimers[i] = 0.0f;
-        }
-    }
-
-    //    
-    glm::mat4 model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(x, y, z));
-    model = glm::scale(model, glm::vec3(2.5f, 2.5f, 2.5f)); //  
-
-    //      
-    glm::vec3 direction = glm::normalize(rotationCenter - glm::vec3(x, y, z));
-    glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f);
-    glm::vec3 right = glm::normalize(glm::cross(up, direction));
-    glm::vec3 adjustedUp = glm::cross(direction, right);
-
-    //  ,  a   
-    glm::mat4 rotationMatrix = glm::mat4(1.0f);
-    rotationMatrix[0] = glm::vec4(right, 0.0f);
-    rotationMatrix[1] = glm::vec4(adjustedUp, 0.0f);
-    rotationMatrix[2] = glm::vec4(direction, 0.0f);
-
-    model *= rotationMatrix;
-
-    //        
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    glBindTexture(GL_TEXTURE_2D, texture2);
-    objModel3.draw(shaderProgram);
-}
-glm::mat4 rabbitModel = glm::translate(glm::mat4(1.0f), rabbitPosition);
-glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(rabbitModel));
-objModel6.draw(shaderProgram);
+    // The cube only has positions; its normal and texcoord stay zero, as
+    // the attributes it left unset read
+    std::vector<float> cubeMeshVertices;
+    for (size_t i = 0; i + 2 < cubeVertices.size(); i += 3)
+        cubeMeshVertices.insert(cubeMeshVertices.end(), {cubeVertices[i], cubeVertices[i + 1], cubeVertices[i + 2],
+                                                         0.0f, 0.0f, 0.0f, 0.0f, 0.0f});
+    MeshRange cubeMesh = geometry.add(cubeMeshVertices, cubeIndices);
+    MeshBounds cubeBounds = computeBounds(cubeMeshVertices, cubeIndices);
+
+    // The props around the table never move: they are baked into world
+    // space here and drawn as one mesh per texture
+    StaticBatchBuilder props;
+    glm::vec4 grey(0.5f, 0.5f, 0.5f, 1.0f);
 //
 glm::mat4 model1 = glm::mat4(1.0f);
 model1 = glm::translate(model1, glm::vec3(150.0f*0.2f, 7.0f, 150.0f*0.2f));
 
-//        
-GLuint modelLoc1 = glGetUniformLocation(shaderProgram, "model");
-glUniformMatrix4fv(modelLoc1, 1, GL_FALSE, glm::value_ptr(model1));
-
-//     
-glUniform4fv(objectColorLocation, 1, glm::value_ptr(glm::vec4(0.5f, 0.5f, 0.5f, 1.0f)));
-glBindTexture(GL_TEXTURE_2D, texture3);
-objModel.draw(shaderProgram);
-
+props.add(objModel.vertices, objModel.indices, model1, 2, grey);
 //
 glm::mat4 model13 = glm::mat4(1.0f);
 model13 = glm::translate(model13, glm::vec3(150.0f*0.2f-0.75f, 8.5f, 150.0f*0.2f-0.3f));
 model13 = glm::scale(model13, glm::vec3(1.0f / 9.0f, 1.0f / 9.0f, 1.0f / 9.0f));
 model13 = glm::rotate(model13, glm::radians(270.0f), glm::vec3(1.0f, 0.0f, 0.0f));
 model13 = glm::rotate(model13, glm::radians(-120.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-//        
-GLuint modelLoc13 = glGetUniformLocation(shaderProgram, "model");
-glUniformMatrix4fv(modelLoc13, 1, GL_FALSE, glm::value_ptr(model13));
-
-//     
-glUniform4fv(objectColorLocation, 1, glm::value_ptr(glm::vec4(0.5f, 0.5f, 0.5f, 1.0f)));
-glBindTexture(GL_TEXTURE_2D, texture3);
-objModel5.draw(shaderProgram);
+props.add(objModel5.vertices, objModel5.indices, model13, 2, grey);
 // 1
 glm::mat4 model11 = glm::mat4(1.0f);  //   
 model11 = glm::translate(model11, glm::vec3(150.0f*0.2f, 8.4f, 150.0f*0.2f+1.0f));
 model11 = glm::scale(model11, glm::vec3(1.0f / 9.0f, 1.0f / 9.0f, 1.0f / 9.0f));
 
-//        
-GLuint modelLoc11 = glGetUniformLocation(shaderProgram, "model");
-glUniformMatrix4fv(modelLoc11, 1, GL_FALSE, glm::value_ptr(model11));
-
-//     
-glUniform4fv(objectColorLocation, 1, glm::value_ptr(glm::vec4(0.5f, 0.5f, 0.5f, 1.0f)));
-glBindTexture(GL_TEXTURE_2D, texture3);
-objModel4.draw(shaderProgram);
+props.add(objModel4.vertices, objModel4.indices, model11, 2, grey);
 // 2
 glm::mat4 model12 = glm::mat4(1.0f);
 model12 = glm::translate(model12, glm::vec3(150.0f*0.2f, 8.4f, 150.0f*0.2f-1.0f));
 model12 = glm::scale(model12, glm::vec3(1.0f / 9.0f, 1.0f / 9.0f, 1.0f / 9.0f));
 model12 = glm::rotate(model12, glm::radians(120.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 
-GLuint modelLoc12 = glGetUniformLocation(shaderProgram, "model");
-glUniformMatrix4fv(modelLoc12, 1, GL_FALSE, glm::value_ptr(model12));
-
-//     
-glUniform4fv(objectColorLocation, 1, glm::value_ptr(glm::vec4(0.5f, 0.5f, 0.5f, 1.0f)));
-glBindTexture(GL_TEXTURE_2D, texture3);
-objModel4.draw(shaderProgram);
+props.add(objModel4.vertices, objModel4.indices, model12, 2, grey);
 //
 glm::mat4 model2 = glm::mat4(1.0f);
 model2 = glm::translate(model2, glm::vec3(150.0f*0.2f, 5.0f, 150.0f*0.2f));
 model2 = glm::scale(model2, glm::vec3(1.0f / 9.0f, 1.0f / 9.0f, 1.0f / 9.0f));
 model2 = glm::rotate(model2, glm::radians(270.0f), glm::vec3(1.0f, 0.0f, 0.0f));
 
-GLuint modelLoc2 = glGetUniformLocation(shaderProgram, "model");
-glUniformMatrix4fv(modelLoc2, 1, GL_FALSE, glm::value_ptr(model2));
-
+props.add(objModel1.vertices, objModel1.indices, model2, 3, grey);
 //glUniform4fv(objectColorLocation, 1, glm::value_ptr(glm::vec4(0.6f, 0.3f, 0.0f, 1.0f)));
-glBindTexture(GL_TEXTURE_2D, texture4);
-objModel1.draw(shaderProgram);
+
 // 1
 glm::mat4 model3 = glm::mat4(1.0f);
 model3 = glm::translate(model3, glm::vec3(150.0f*0.2f+1.0f, 7.0f, 150.0f*0.2f-1.5f));
 model3 = glm::scale(model3, glm::vec3(1.0f*2.0f , 1.0f*2.0f , 1.0f*2.0f));
 model3 = glm::rotate(model3, glm::radians(-40.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 
-GLuint modelLoc3 = glGetUniformLocation(shaderProgram, "model");
-glUniformMatrix4fv(modelLoc3, 1, GL_FALSE, glm::value_ptr(model3));
-
-
+props.add(objModel2.vertices, objModel2.indices, model3, 4, grey);
 //glUniform4fv(objectColorLocation, 1, glm::value_ptr(glm::vec4(0.6f, 0.3f, 0.0f, 1.0f)));
-glBindTexture(GL_TEXTURE_2D, texture5);
-objModel2.draw(shaderProgram);
+
 // 2
 glm::mat4 model4 = glm::mat4(1.0f);
 model4 = glm::translate(model4, glm::vec3(150.0f*0.2f-1.0f, 7.0f, 150.0f*0.2f+1.5f));
 model4 = glm::scale(model4, glm::vec3(1.0f*2.0f , 1.0f*2.0f , 1.0f*2.0f));
 model4 = glm::rotate(model4, glm::radians(145.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-GLuint modelLoc4 = glGetUniformLocation(shaderProgram, "model");
-glUniformMatrix4fv(modelLoc4, 1, GL_FALSE, glm::value_ptr(model4));
+props.add(objModel2.vertices, objModel2.indices, model4, 4, grey);
 //glUniform4fv(objectColorLocation, 1, glm::value_ptr(glm::vec4(0.6f, 0.3f, 0.0f, 1.0f)));
-glBindTexture(GL_TEXTURE_2D, texture5);
-objModel2.draw(shaderProgram);
 
-for (int i = 0; i < 6; ++i) {
-    std::string uniformName = "lightPos[" + std::to_string(i) + "]";
-    glUniform3fv(glGetUniformLocation(shaderProgram, uniformName.c_str()), 1, glm::value_ptr(lightPos[i]));
-}
-        glUniform4fv(objectColorLocation, 1, glm::value_ptr(glm::vec4(0.0f, 2.0f, 6.0f, 1.0f)));
-        //glBindTexture(GL_TEXTURE_2D, texture5);
-        glBindVertexArray(VAO_Cube);
-        glm::mat4 cubeModel = glm::mat4(1.0f);
-        cubeModel = glm::translate(cubeModel, glm::vec3(terrainSize * 0.2f*0.5f, cubeYOffset, terrainSize * 0.2f*0.5f));
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(cubeModel));
-        glDrawElements(GL_TRIANGLES, cubeIndices.size(), GL_UNSIGNED_INT, 0);
+    std::vector<StaticBatch> propBatches = props.build(geometry);
+    geometry.upload();
+
+    // The orbiting rabbits are all objModel3, drawn in one instanced call
+    InstanceBuffer rabbitInstances;
+    rabbitInstances.attach(geometry.vao(), 3);
+    GpuInstanceCuller rabbitCulling;
+
+    // Per-frame data is written in place into a persistently mapped ring
+    // when the driver can map one (GL 4.4); 4 MB a frame holds the scene's
+    // blocks and instances many times over
+    const bool ringStreaming = FrameRingBuffer::supported();
+    FrameRingBuffer frameRing(4 << 20);
+    if (ringStreaming) {
+        frameUniforms.useRing(&frameRing);
+        objectUniforms.useRing(&frameRing);
+        rabbitInstances.useRing(&frameRing);
+        rabbitCulling.useRing(&frameRing);
+    }
+
+int numRabbits = 31;
+    // The rabbits move in fixed steps, however fast frames come; frames are
+    // drawn between the last two steps
+    std::random_device rd;
+    CrowdSimulation crowd(numRabbits, rd());
+    FixedStepClock simulationClock(simulationStep);
+    double lastTime = glfwGetTime();
+std::vector<glm::mat4> rabbitModels(numRabbits);
+std::vector<int> rabbitBounds(numRabbits);
+std::vector<glm::mat4> visibleRabbits;
+    // A command list per part of the scene: the terrain's chunk rows, the
+    // crowd, and everything else
+    // (chunks were added row by row along z, terrainColumns to a row along x)
+    const int terrainColumns = (terrainSize - 1 + terrainChunk - 1) / terrainChunk;
+    const int terrainRows = static_cast<int>(terrainChunks.size()) / terrainColumns;
+    std::vector<CommandList> commandLists(terrainRows + 2);
+size_t reportedCulled = 0, reportedOccluded = 0, reportedObjects = 0;
+
+    while (!glfwWindowShouldClose(window)) {
+        if (ringStreaming)
+            frameRing.beginFrame();
+        textures.update();
+        processInput(window,terrainVertices, terrainSize);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        processRabbitInput(window, terrainVertices, terrainSize);
+
+        glm::mat4 model = glm::mat4(1.0f);
+        glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+
+        // The frame's draws are collected first, so their ObjectData blocks
+        // and indirect commands go to GL in one upload each before any of
+        // them is drawn
+        renderQueue.clear();
+        keyTextures.clear();
+        keyVertexArrays.clear();
+        sceneObjects.clear();
+        culling.clear();
+        occlusion.begin(projection * view);
+        pendingDraws.clear();
+        glm::vec4 white(1.0f, 1.0f, 1.0f, 1.0f);
+
+
+//  
+
+        //    5  
+glm::vec3 lightPos[6] = {
+    glm::vec3(-terrainSize * 0.5f, 50.0f, -terrainSize * 0.5f), // Top-left corner
+    glm::vec3( terrainSize * 0.5f, 50.0f, -terrainSize * 0.5f), // Top-right corner
+   glm::vec3(-terrainSize * 0.5f, 50.0f,  terrainSize * 0.5f), // Bottom-left corner
+    glm::vec3( terrainSize * 0.5f, 50.0f,  terrainSize * 0.5f), // Bottom-right corner
+    glm::vec3(0.0f, 50.0f, 0.0f), // Center of the terrain
+};
+        double now = glfwGetTime();
+        int steps = simulationClock.advance(now - lastTime);
+        lastTime = now;
+        for (int i = 0; i < steps; ++i)
+            crowd.step(static_cast<float>(simulationClock.step()));
+        const float alpha = simulationClock.alpha();
+
+        // The scene is recorded in parts, each into a command list of its
+        // own on the thread pool: a row of terrain chunks per part, then
+        // the crowd, then the player's rabbit, the props and the cube. The
+        // parts only read the simulation's state.
+        auto recordCrowd = [&](CommandList& list) {
+            for (int i = 0; i < crowd.size(); ++i)
+                list.draw(objModel3.mesh, objModel3.bounds, 1, crowd.model(i, alpha), white, DRAW_INSTANCE);
+        };
+        auto recordPart = [&](int part) {
+            CommandList& list = commandLists[part];
+            list.begin(cameraPos);
+            if (part < terrainRows) {
+                //  
+                for (int i = part * terrainColumns; i < (part + 1) * terrainColumns; ++i)
+                    list.draw(terrainChunks[i], terrainChunkBounds[i], virtualTerrain ? -1 : 0, model, white,
+                              virtualTerrain ? DRAW_FEEDBACK : 0); //    
+            } else if (part == terrainRows) {
+                recordCrowd(list);
+            } else {
+                glm::mat4 rabbitModel = glm::translate(glm::mat4(1.0f), rabbitPosition);
+                list.draw(objModel6.mesh, objModel6.bounds, 1, rabbitModel, white);
+                for (const StaticBatch& batch : propBatches)
+                    list.draw(batch.mesh, batch.bounds, batch.texture, glm::mat4(1.0f), batch.color);
+
+                //glBindTexture(GL_TEXTURE_2D, texture5);
+                glm::mat4 cubeModel = glm::mat4(1.0f);
+                cubeModel = glm::translate(cubeModel, glm::vec3(terrainSize * 0.2f*0.5f, cubeYOffset, terrainSize * 0.2f*0.5f));
+                list.draw(cubeMesh, cubeBounds, 4, cubeModel, glm::vec4(0.0f, 2.0f, 6.0f, 1.0f));
+            }
+        };
+        ThreadPool::shared().parallelFor(static_cast<int>(commandLists.size()), recordPart);
+
+        // Replay the lists in order on this thread. The crowd's instances
+        // become the rabbits' instanced draw; a chunk of the virtual terrain
+        // goes into the feedback pass as well.
+        int rabbit = 0;
+        for (const CommandList& list : commandLists) {
+            for (const DrawCommand& command : list.commands()) {
+                if (command.flags & DRAW_INSTANCE) {
+                    rabbitModels[rabbit] = command.model;
+                    if (!gpuCulling)
+                        rabbitBounds[rabbit] = culling.add(command.bounds, command.model);
+                    ++rabbit;
+                    continue;
+                }
+                PendingDraw draw = addDraw(command);
+                if (command.flags & DRAW_FEEDBACK) {
+                    draw.pass = RENDER_PASS_FEEDBACK;
+                    draw.program = pageFeedbackProgram;
+                    pendingDraws.push_back(draw);
+                }
+            }
+        }
+        occlusion.addOccluder(terrainOccluder, terrainOccluderIndices, model);
+        occlusion.addOccluder(tableOccluder, tableOccluderIndices, model1);
+
+        // Cull everything against the view frustum in one go, then what is
+        // left against the occluders, and queue the rest; the rabbits'
+        // instances are culled one by one, or all of them on the GPU once
+        // their indirect command is uploaded
+        culling.cull(projection * view);
+        occlusion.rasterize();
+        culling.occlude(occlusion);
+        for (const PendingDraw& draw : pendingDraws)
+            if (culling.visible(draw.bounds))
+                submit(draw.pass, draw.program, draw.item, draw.distance);
+        int rabbitObject = -1;
+        if (gpuCulling) {
+            rabbitCulling.upload(rabbitModels);
+            rabbitInstances.resize(rabbitModels.size());
+            rabbitObject = addInstancedDraw(objModel3.mesh, 1, rabbitInstances.count(), white);
+        } else {
+            visibleRabbits.clear();
+            for (int i = 0; i < numRabbits; ++i)
+                if (culling.visible(rabbitBounds[i]))
+                    visibleRabbits.push_back(rabbitModels[i]);
+            rabbitInstances.upload(visibleRabbits);
+            if (!visibleRabbits.empty())
+                addInstancedDraw(objModel3.mesh, 1, rabbitInstances.count(), white);
+        }
+        if (culling.culled() != reportedCulled || culling.occluded() != reportedOccluded || culling.size() != reportedObjects) {
+            reportedCulled = culling.culled();
+            reportedOccluded = culling.occluded();
+            reportedObjects = culling.size();
+            std::string title = "Witches tea party - " + std::to_string(reportedObjects - reportedCulled) + " of " +
+                                std::to_string(reportedObjects) + " objects in view, " + std::to_string(reportedCulled) + " culled (" +
+                                std::to_string(reportedOccluded) + " occluded)";
+            glfwSetWindowTitle(window, title.c_str());
+        }
+
+        FrameUniforms frame;
+        frame.view = view;
+        frame.projection = projection;
+        frame.viewPos = glm::vec4(cameraPos, 1.0f);
+        frame.lightColor = glm::vec4(0.8f, 0.8f, 0.8f, 1.0f);
+        for (int i = 0; i < 6; ++i)
+            frame.lightPos[i] = glm::vec4(lightPos[i], 1.0f);
+        frameUniforms.update(frame);
+
+        // Cut the sorted queue into batches of draws that share all state
+        // but their ObjectUniforms. A batch gets its own ObjectData block,
+        // filled in draw order, and each draw an indirect command.
+        renderQueue.sort();
+        objectUniforms.clear();
+        drawBatches.clear();
+        drawCommands.clear();
+        int rabbitCommand = -1;
+        for (size_t i = 0; i < renderQueue.size(); ++i) {
+            const RenderItem& draw = renderQueue.item(i);
+            if (drawBatches.empty() || drawBatches.back().count == ObjectUniformBuffer::batchObjects ||
+                RenderQueue::keyState(renderQueue.key(i)) != RenderQueue::keyState(renderQueue.key(drawBatches.back().first)))
+                drawBatches.push_back({i, 0, objectUniforms.beginBatch()});
+            objectUniforms.add(sceneObjects[draw.object]);
+            drawCommands.push_back({static_cast<unsigned int>(draw.count), static_cast<unsigned int>(std::max(draw.instances, 1)),
+                                    draw.firstIndex, draw.baseVertex, 0});
+            // the GPU cull counts the rabbits it keeps in here
+            if (draw.object == rabbitObject) {
+                drawCommands.back().instanceCount = 0;
+                rabbitCommand = static_cast<int>(i);
+            }
+            ++drawBatches.back().count;
+        }
+        objectUniforms.upload();
+        if (multiDrawIndirect)
+            indirectDraws.upload(drawCommands);
+        if (rabbitCommand >= 0)
+            rabbitCulling.cull(objModel3.bounds, projection * view, rabbitInstances.id(), indirectDraws.id(), rabbitCommand);
+
+        // Run the batches in order, changing only the state that differs
+        // from the previous one. Leaving the feedback pass uploads the pages
+        // it asked for a frame or two ago.
+        int pass = -1, program = -1, texture = INT_MIN;
+        GLuint vao = 0;
+        for (const DrawBatch& batch : drawBatches) {
+            uint64_t key = renderQueue.key(batch.first);
+            const RenderItem& draw = renderQueue.item(batch.first);
+            if (static_cast<int>(RenderQueue::keyPass(key)) != pass) {
+                if (pass == RENDER_PASS_FEEDBACK) {
+                    terrainPages.endFeedback();
+                    terrainPages.update();
+                }
+                pass = RenderQueue::keyPass(key);
+                if (pass == RENDER_PASS_FEEDBACK)
+                    terrainPages.beginFeedback();
+            }
+            ShaderProgram& current = *programs[RenderQueue::keyProgram(key)];
+            if (static_cast<int>(RenderQueue::keyProgram(key)) != program) {
+                program = RenderQueue::keyProgram(key);
+                current.use();
+                current.set(UNIFORM_CUT_OFF, cutOff);
+                texture = INT_MIN;
+            }
+            if (texture == INT_MIN || textureBinding(draw.texture) != textureBinding(texture)) {
+                texture = draw.texture;
+                if (texture < 0) {
+                    terrainPages.setUniforms(current, 2, 3, program == pageFeedbackProgram);
+                    current.set(UNIFORM_VIRTUAL_TEXTURE, 1);
+                } else {
+                    current.set(UNIFORM_VIRTUAL_TEXTURE, 0);
+                    useTexture(texture);
+                }
+            }
+            if (draw.vao != vao) {
+                vao = draw.vao;
+                glBindVertexArray(vao);
+            }
+            objectUniforms.bind(batch.objects);
+            if (multiDrawIndirect) {
+                current.set(UNIFORM_DRAW_BASE, 0);
+                glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                                            (void*)(batch.first * sizeof(DrawElementsIndirectCommand)), batch.count, 0);
+                continue;
+            }
+            for (int j = 0; j < batch.count; ++j) {
+                const RenderItem& item = renderQueue.item(batch.first + j);
+                current.set(UNIFORM_DRAW_BASE, j);
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, item.count, GL_UNSIGNED_INT,
+                                                  (void*)(item.firstIndex * sizeof(unsigned int)), std::max(item.instances, 1),
+                                                  item.baseVertex);
+            }
+        }
+        if (pass == RENDER_PASS_FEEDBACK) {
+            terrainPages.endFeedback();
+            terrainPages.update();
+        }
+
+        // This frame's depth is what next frame's rabbits are tested against
+        if (gpuCulling) {
+            int width, height;
+            glfwGetFramebufferSize(window, &width, &height);
+            rabbitCulling.buildDepthPyramid(width, height, projection * view);
+        }
+        if (ringStreaming)
+            frameRing.endFrame();
 
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
     // Clean up
-    glDeleteVertexArrays(1, &VAO_Terrain);
-    glDeleteBuffers(1, &VBO_Terrain);
-    glDeleteBuffers(1, &EBO_Terrain);
-    glDeleteProgram(shaderProgram);
+    textures.shutdown();
+    terrainPages.shutdown();
+    frameRing.destroy();
+    geometry.destroy();
+    indirectDraws.destroy();
+    rabbitCulling.destroy();
+    glDeleteProgram(shaderProgram.id());
     glfwTerminate();
     return 0;
 }
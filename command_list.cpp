@@ -0,0 +1,12 @@
+#include "command_list.h"
+
+void CommandList::begin(const glm::vec3& frameCamera) {
+    camera = frameCamera;
+    recorded.clear();
+}
+
+void CommandList::draw(const MeshRange& mesh, const MeshBounds& bounds, int texture, const glm::mat4& model,
+                       const glm::vec4& color, unsigned int flags) {
+    float distance = glm::length(glm::vec3(model * glm::vec4(bounds.center, 1.0f)) - camera);
+    recorded.push_back({mesh, bounds, model, color, texture, flags, distance});
+}
@@ -0,0 +1,48 @@
+#ifndef COMMAND_LIST_H
+#define COMMAND_LIST_H
+
+#include "frustum_cull.h"
+#include "geometry_buffer.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+// What a recorded draw needs besides the plain opaque pass
+enum DrawCommandFlags {
+    DRAW_FEEDBACK = 1, // drawn into the virtual texture's feedback pass too
+    DRAW_INSTANCE = 2  // an instance of the crowd's instanced draw
+};
+
+// One draw as a part of the scene describes it, with nothing of GL in it:
+// the mesh with its model-space bounds and placement, and the material.
+// The camera distance of the placed bounds' centre is worked out while
+// recording.
+struct DrawCommand {
+    MeshRange mesh;
+    MeshBounds bounds;
+    glm::mat4 model;
+    glm::vec4 color;
+    int texture; // scene texture, -1 for the virtual terrain
+    unsigned int flags;
+    float distance;
+};
+
+// The draws one part of the scene recorded, in order. Every part records
+// into a list of its own, so the parts can be recorded at the same time on
+// the ThreadPool; the GL thread then replays the lists one after another
+// into the culling and the render queue. A list keeps its storage from
+// frame to frame.
+struct CommandList {
+    // Starts a frame's recording, seen from camera
+    void begin(const glm::vec3& camera);
+
+    void draw(const MeshRange& mesh, const MeshBounds& bounds, int texture, const glm::mat4& model, const glm::vec4& color,
+              unsigned int flags = 0);
+
+    const std::vector<DrawCommand>& commands() const { return recorded; }
+
+private:
+    glm::vec3 camera = glm::vec3(0.0f);
+    std::vector<DrawCommand> recorded;
+};
+
+#endif
@@ -0,0 +1,147 @@
+#include "frustum_cull.h"
+#include "occlusion_cull.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CULL_SSE2
+#endif
+
+namespace {
+
+// Frustum planes of a projection * view matrix (Gribb and Hartmann), with
+// unit normals pointing inside: a point p is inside plane i when
+// dot(xyz, p) + w >= 0
+void extractPlanes(const glm::mat4& m, glm::vec4 planes[6]) {
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+    planes[0] = row3 + row0;
+    planes[1] = row3 - row0;
+    planes[2] = row3 + row1;
+    planes[3] = row3 - row1;
+    planes[4] = row3 + row2;
+    planes[5] = row3 - row2;
+    for (int i = 0; i < 6; ++i)
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+}
+
+MeshBounds computeBounds(const std::vector<float>& vertices, const std::vector<unsigned int>& indices, int stride) {
+    MeshBounds bounds;
+    if (indices.empty())
+        return bounds;
+    bounds.min = bounds.max = glm::vec3(vertices[indices[0] * stride], vertices[indices[0] * stride + 1],
+                                        vertices[indices[0] * stride + 2]);
+    for (unsigned int index : indices) {
+        glm::vec3 p(vertices[index * stride], vertices[index * stride + 1], vertices[index * stride + 2]);
+        bounds.min = glm::min(bounds.min, p);
+        bounds.max = glm::max(bounds.max, p);
+    }
+    bounds.center = (bounds.min + bounds.max) * 0.5f;
+    float radius2 = 0.0f;
+    for (unsigned int index : indices) {
+        glm::vec3 d = glm::vec3(vertices[index * stride], vertices[index * stride + 1], vertices[index * stride + 2]) - bounds.center;
+        radius2 = std::max(radius2, glm::dot(d, d));
+    }
+    bounds.radius = std::sqrt(radius2);
+    return bounds;
+}
+
+void CullList::clear() {
+    count = 0;
+    culledCount = 0;
+    occludedCount = 0;
+    for (std::vector<float>* values : {&centerX, &centerY, &centerZ, &radius, &extentX, &extentY, &extentZ})
+        values->clear();
+    visibility.clear();
+}
+
+// The box's world extent along each axis is the sum of its model-space half
+// extents scaled by the absolute matrix; the sphere grows by the largest
+// axis scale
+int CullList::add(const MeshBounds& bounds, const glm::mat4& model) {
+    glm::vec3 center = glm::vec3(model * glm::vec4(bounds.center, 1.0f));
+    glm::vec3 half = (bounds.max - bounds.min) * 0.5f;
+    glm::vec3 extent;
+    for (int axis = 0; axis < 3; ++axis)
+        extent[axis] = std::fabs(model[0][axis]) * half.x + std::fabs(model[1][axis]) * half.y + std::fabs(model[2][axis]) * half.z;
+    float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+
+    centerX.push_back(center.x);
+    centerY.push_back(center.y);
+    centerZ.push_back(center.z);
+    radius.push_back(bounds.radius * scale);
+    extentX.push_back(extent.x);
+    extentY.push_back(extent.y);
+    extentZ.push_back(extent.z);
+    return static_cast<int>(count++);
+}
+
+void CullList::cull(const glm::mat4& viewProjection) {
+    glm::vec4 planes[6];
+    extractPlanes(viewProjection, planes);
+
+    size_t padded = (count + 3) & ~size_t(3);
+    for (std::vector<float>* values : {&centerX, &centerY, &centerZ, &radius, &extentX, &extentY, &extentZ})
+        values->resize(padded, 0.0f);
+    visibility.assign(padded, 0);
+
+#ifdef CULL_SSE2
+    const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    for (size_t i = 0; i < padded; i += 4) {
+        __m128 cx = _mm_loadu_ps(&centerX[i]);
+        __m128 cy = _mm_loadu_ps(&centerY[i]);
+        __m128 cz = _mm_loadu_ps(&centerZ[i]);
+        __m128 r = _mm_loadu_ps(&radius[i]);
+        __m128 ex = _mm_loadu_ps(&extentX[i]);
+        __m128 ey = _mm_loadu_ps(&extentY[i]);
+        __m128 ez = _mm_loadu_ps(&extentZ[i]);
+        __m128 negR = _mm_sub_ps(_mm_setzero_ps(), r);
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (const glm::vec4& plane : planes) {
+            __m128 nx = _mm_set1_ps(plane.x);
+            __m128 ny = _mm_set1_ps(plane.y);
+            __m128 nz = _mm_set1_ps(plane.z);
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)),
+                                         _mm_add_ps(_mm_mul_ps(nz, cz), _mm_set1_ps(plane.w)));
+            // the box's reach towards the plane's inside
+            __m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_and_ps(nx, signMask), ex), _mm_mul_ps(_mm_and_ps(ny, signMask), ey)),
+                                      _mm_mul_ps(_mm_and_ps(nz, signMask), ez));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negR));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, reach), _mm_setzero_ps()));
+        }
+        int mask = _mm_movemask_ps(inside);
+        for (int k = 0; k < 4; ++k)
+            visibility[i + k] = static_cast<unsigned char>((mask >> k) & 1);
+    }
+#else
+    for (size_t i = 0; i < count; ++i) {
+        bool inside = true;
+        for (const glm::vec4& plane : planes) {
+            float distance = plane.x * centerX[i] + plane.y * centerY[i] + plane.z * centerZ[i] + plane.w;
+            float reach = std::fabs(plane.x) * extentX[i] + std::fabs(plane.y) * extentY[i] + std::fabs(plane.z) * extentZ[i];
+            inside = inside && distance >= -radius[i] && distance + reach >= 0.0f;
+        }
+        visibility[i] = inside ? 1 : 0;
+    }
+#endif
+
+    culledCount = 0;
+    occludedCount = 0;
+    for (size_t i = 0; i < count; ++i)
+        culledCount += visibility[i] ? 0 : 1;
+}
+
+void CullList::occlude(const OcclusionBuffer& occlusion) {
+    for (size_t i = 0; i < count; ++i) {
+        if (!visibility[i] || occlusion.visible(glm::vec3(centerX[i], centerY[i], centerZ[i]), glm::vec3(extentX[i], extentY[i], extentZ[i])))
+            continue;
+        visibility[i] = 0;
+        ++culledCount;
+        ++occludedCount;
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef FRUSTUM_CULL_H
+#define FRUSTUM_CULL_H
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <vector>
+
+struct OcclusionBuffer;
+
+// A mesh's extent in model space: its axis-aligned box, and the smallest
+// sphere around the box's centre that holds every vertex
+struct MeshBounds {
+    glm::vec3 min = glm::vec3(0.0f);
+    glm::vec3 max = glm::vec3(0.0f);
+    glm::vec3 center = glm::vec3(0.0f);
+    float radius = 0.0f;
+};
+
+// Bounds of the vertices indices refers to. Vertices are interleaved, stride
+// floats each with the position first.
+MeshBounds computeBounds(const std::vector<float>& vertices, const std::vector<unsigned int>& indices, int stride = 8);
+
+// The frame's bounding volumes, placed in the world and then tested together
+// against the six planes of the view frustum, four at a time with SSE2. An
+// entry is visible when both its sphere and its box (the world-space box
+// around the placed one) reach inside every plane; either alone would be
+// conservative, so whichever is tighter for the entry decides.
+struct CullList {
+    // Starts a new frame's entries
+    void clear();
+
+    // Adds bounds placed by model and returns its index
+    int add(const MeshBounds& bounds, const glm::mat4& model);
+
+    // Tests every entry against the frustum of viewProjection
+    void cull(const glm::mat4& viewProjection);
+
+    // Tests the boxes of the entries cull() left visible against the
+    // occluders rendered into occlusion
+    void occlude(const OcclusionBuffer& occlusion);
+
+    bool visible(int i) const { return visibility[i] != 0; }
+    size_t size() const { return count; }
+    // Entries hidden by either test, and those of them occlude() hid
+    size_t culled() const { return culledCount; }
+    size_t occluded() const { return occludedCount; }
+
+private:
+    size_t count = 0;
+    size_t culledCount = 0;
+    size_t occludedCount = 0;
+    // World-space centres, sphere radii and box half extents, as structure
+    // of arrays padded to a multiple of four
+    std::vector<float> centerX, centerY, centerZ, radius;
+    std::vector<float> extentX, extentY, extentZ;
+    std::vector<unsigned char> visibility;
+};
+
+#endif
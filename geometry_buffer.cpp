@@ -0,0 +1,76 @@
+#include <GL/glew.h>
+#include "geometry_buffer.h"
+#include <algorithm>
+
+namespace {
+
+const int vertexFloats = 8;
+
+}
+
+MeshRange GeometryBuffer::add(const std::vector<float>& meshVertices, const std::vector<unsigned int>& meshIndices) {
+    MeshRange mesh;
+    mesh.firstIndex = static_cast<unsigned int>(indices.size());
+    mesh.indexCount = static_cast<unsigned int>(meshIndices.size());
+    mesh.baseVertex = static_cast<int>(vertices.size() / vertexFloats);
+    vertices.insert(vertices.end(), meshVertices.begin(), meshVertices.end());
+    indices.insert(indices.end(), meshIndices.begin(), meshIndices.end());
+    return mesh;
+}
+
+MeshRange GeometryBuffer::addIndices(const std::vector<unsigned int>& meshIndices, int baseVertex) {
+    MeshRange mesh;
+    mesh.firstIndex = static_cast<unsigned int>(indices.size());
+    mesh.indexCount = static_cast<unsigned int>(meshIndices.size());
+    mesh.baseVertex = baseVertex;
+    indices.insert(indices.end(), meshIndices.begin(), meshIndices.end());
+    return mesh;
+}
+
+void GeometryBuffer::upload() {
+    if (!vertexArray) {
+        glGenVertexArrays(1, &vertexArray);
+        glGenBuffers(1, &vertexBuffer);
+        glGenBuffers(1, &indexBuffer);
+    }
+    glBindVertexArray(vertexArray);
+
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, vertexFloats * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, vertexFloats * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, vertexFloats * sizeof(float), (void*)(6 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+
+    glBindVertexArray(0);
+}
+
+void GeometryBuffer::destroy() {
+    glDeleteVertexArrays(1, &vertexArray);
+    glDeleteBuffers(1, &vertexBuffer);
+    glDeleteBuffers(1, &indexBuffer);
+    vertexArray = vertexBuffer = indexBuffer = 0;
+}
+
+// Grows to the largest count seen
+void IndirectDrawBuffer::upload(const std::vector<DrawElementsIndirectCommand>& commands) {
+    if (!buffer)
+        glGenBuffers(1, &buffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+    capacity = std::max(capacity, commands.size());
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, capacity * sizeof(DrawElementsIndirectCommand), nullptr, GL_STREAM_DRAW);
+    if (!commands.empty())
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+}
+
+void IndirectDrawBuffer::destroy() {
+    glDeleteBuffers(1, &buffer);
+    buffer = 0;
+    capacity = 0;
+}
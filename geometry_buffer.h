@@ -0,0 +1,81 @@
+#ifndef GEOMETRY_BUFFER_H
+#define GEOMETRY_BUFFER_H
+
+#include <cstddef>
+#include <vector>
+
+// Where a mesh's indices and vertices went in a GeometryBuffer
+struct MeshRange {
+    unsigned int firstIndex = 0;
+    unsigned int indexCount = 0;
+    int baseVertex = 0;
+};
+
+// One record of a GL_DRAW_INDIRECT_BUFFER, as glMultiDrawElementsIndirect
+// reads it
+struct DrawElementsIndirectCommand {
+    unsigned int count;
+    unsigned int instanceCount;
+    unsigned int firstIndex;
+    int baseVertex;
+    unsigned int baseInstance;
+};
+
+// Every static mesh of the scene in one vertex buffer and one index buffer,
+// behind a single VAO, so draws of different meshes need no state change in
+// between and can go out together from an indirect buffer. Vertices are
+// interleaved position, normal and texcoord (8 floats, attributes 0 to 2);
+// indices stay relative to their mesh and are offset by baseVertex.
+struct GeometryBuffer {
+    GeometryBuffer() = default;
+
+    GeometryBuffer(const GeometryBuffer&) = delete;
+    GeometryBuffer& operator=(const GeometryBuffer&) = delete;
+
+    // Appends a mesh; CPU side only until upload()
+    MeshRange add(const std::vector<float>& vertices, const std::vector<unsigned int>& indices);
+
+    // Appends another index range over vertices added before (baseVertex
+    // from their MeshRange), for drawing a mesh in parts
+    MeshRange addIndices(const std::vector<unsigned int>& indices, int baseVertex);
+
+    // Hands everything added so far to GL and builds the VAO. GL thread only.
+    void upload();
+
+    unsigned int vao() const { return vertexArray; }
+
+    // Deletes the VAO and buffers; call while the context is current, before
+    // glfwTerminate
+    void destroy();
+
+private:
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    unsigned int vertexArray = 0;
+    unsigned int vertexBuffer = 0;
+    unsigned int indexBuffer = 0;
+};
+
+// The commands of a frame's indirect draws. GL thread only.
+struct IndirectDrawBuffer {
+    IndirectDrawBuffer() = default;
+
+    IndirectDrawBuffer(const IndirectDrawBuffer&) = delete;
+    IndirectDrawBuffer& operator=(const IndirectDrawBuffer&) = delete;
+
+    // Replaces the commands (the buffer is orphaned, so draws of the previous
+    // frame still in flight keep theirs) and leaves the buffer bound to
+    // GL_DRAW_INDIRECT_BUFFER
+    void upload(const std::vector<DrawElementsIndirectCommand>& commands);
+
+    unsigned int id() const { return buffer; }
+
+    // Deletes the buffer; call while the context is current
+    void destroy();
+
+private:
+    unsigned int buffer = 0;
+    size_t capacity = 0; // commands allocated for buffer
+};
+
+#endif
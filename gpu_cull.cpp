@@ -0,0 +1,257 @@
+#include <GL/glew.h>
+#include "gpu_cull.h"
+#include "ring_buffer.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Storage buffer bindings of the cull shader
+const GLuint instanceBinding = 0, visibleBinding = 1, commandBinding = 2;
+
+const int cullGroupSize = 64;
+const int pyramidGroupSize = 8;
+
+// One thread per instance. An instance is dropped when its eight corners
+// are outside the same clip plane, or when the corners' nearest depth in
+// last frame's view is behind every pyramid texel under them, read at the
+// level where they span at most 4x4 texels. Boxes reaching behind last
+// frame's near plane are kept.
+const char* cullShaderSource = R"(
+#version 430 core
+layout(local_size_x = 64) in;
+
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout(std430, binding = 0) readonly buffer Instances { mat4 instances[]; };
+layout(std430, binding = 1) writeonly buffer Visible { mat4 visible[]; };
+layout(std430, binding = 2) buffer Commands { DrawCommand commands[]; };
+
+uniform mat4 cullViewProjection;
+uniform vec3 cullBoundsMin;
+uniform vec3 cullBoundsMax;
+uniform int cullInstances;
+uniform int cullCommand;
+uniform mat4 hizViewProjection;
+uniform int hizLevels;
+layout(binding = 0) uniform sampler2D hiz;
+
+bool occluded(vec3 corners[8]) {
+    if (hizLevels == 0)
+        return false;
+    vec2 size = vec2(textureSize(hiz, 0));
+    vec2 lo = vec2(1e30), hi = vec2(-1e30);
+    float nearest = 1.0;
+    for (int c = 0; c < 8; ++c) {
+        vec4 clip = hizViewProjection * vec4(corners[c], 1.0);
+        if (clip.w <= 1e-5 || clip.z < -clip.w)
+            return false;
+        vec3 ndc = clip.xyz / clip.w;
+        vec2 pixel = (ndc.xy * 0.5 + 0.5) * size;
+        lo = min(lo, pixel);
+        hi = max(hi, pixel);
+        nearest = min(nearest, ndc.z * 0.5 + 0.5);
+    }
+    if (any(lessThan(hi, vec2(0.0))) || any(greaterThanEqual(lo, size)))
+        return false;
+    ivec2 first = ivec2(max(lo, vec2(0.0)));
+    ivec2 last = ivec2(min(hi, size - 1.0));
+    int level = 0;
+    while (level + 1 < hizLevels && any(greaterThan((last >> level) - (first >> level), ivec2(3))))
+        ++level;
+    // texels past a level's edge were folded into its last row and column
+    ivec2 levelLast = textureSize(hiz, level) - 1;
+    for (int y = first.y >> level; y <= min(last.y >> level, levelLast.y); ++y)
+        for (int x = first.x >> level; x <= min(last.x >> level, levelLast.x); ++x)
+            if (texelFetch(hiz, ivec2(x, y), level).r >= nearest)
+                return false;
+    return true;
+}
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= uint(cullInstances))
+        return;
+    mat4 model = instances[i];
+    vec3 corners[8];
+    // how far the box reaches inside each clip plane
+    vec3 insideLow = vec3(-1e30), insideHigh = vec3(-1e30);
+    for (int c = 0; c < 8; ++c) {
+        corners[c] = vec3(model * vec4(mix(cullBoundsMin, cullBoundsMax, vec3(c & 1, (c >> 1) & 1, (c >> 2) & 1)), 1.0));
+        vec4 clip = cullViewProjection * vec4(corners[c], 1.0);
+        insideLow = max(insideLow, clip.xyz + clip.w);
+        insideHigh = max(insideHigh, clip.w - clip.xyz);
+    }
+    if (any(lessThan(insideLow, vec3(0.0))) || any(lessThan(insideHigh, vec3(0.0))) || occluded(corners))
+        return;
+    visible[atomicAdd(commands[cullCommand].instanceCount, 1u)] = model;
+}
+)";
+
+// Level 0 copies the depth texture; every level after it keeps the
+// farthest of the 2x2 texels under each of its own. Levels halve rounding
+// down, as mipmaps do, so on an odd edge the last texel takes in the extra
+// row or column too.
+const char* pyramidShaderSource = R"(
+#version 430 core
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(binding = 0) uniform sampler2D depth;
+layout(r32f, binding = 0) readonly uniform image2D source;
+layout(r32f, binding = 1) writeonly uniform image2D target;
+uniform int hizSourceLevel;
+
+void main() {
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(texel, imageSize(target))))
+        return;
+    float farthest;
+    if (hizSourceLevel < 0) {
+        farthest = texelFetch(depth, texel, 0).r;
+    } else {
+        ivec2 sourceSize = imageSize(source);
+        ivec2 last = texel * 2 + 1 + ivec2(equal(texel, imageSize(target) - 1)) * (sourceSize & 1);
+        last = min(last, sourceSize - 1);
+        farthest = 0.0;
+        for (int y = texel.y * 2; y <= last.y; ++y)
+            for (int x = texel.x * 2; x <= last.x; ++x)
+                farthest = max(farthest, imageLoad(source, ivec2(x, y)).r);
+    }
+    imageStore(target, texel, vec4(farthest));
+}
+)";
+
+int groups(int count, int size) {
+    return (count + size - 1) / size;
+}
+
+}
+
+bool GpuInstanceCuller::supported() {
+    return GLEW_VERSION_4_3 != 0;
+}
+
+void GpuInstanceCuller::createPrograms() {
+    cullProgram.linkCompute(cullShaderSource);
+    pyramidProgram.linkCompute(pyramidShaderSource);
+    glGenBuffers(1, &instanceBuffer);
+}
+
+// Grows to the largest count seen
+void GpuInstanceCuller::upload(const std::vector<glm::mat4>& models) {
+    if (!instanceBuffer)
+        createPrograms();
+    instances = models.size();
+    if (ring && !models.empty()) {
+        RingAllocation slice = ring->allocate(models.size() * sizeof(glm::mat4), ring->storageAlignment());
+        if (slice.data) {
+            std::memcpy(slice.data, models.data(), models.size() * sizeof(glm::mat4));
+            instanceSource = slice.buffer;
+            instanceOffset = slice.offset;
+            return;
+        }
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer);
+    capacity = std::max(capacity, std::max<size_t>(models.size(), 1));
+    glBufferData(GL_SHADER_STORAGE_BUFFER, capacity * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+    if (!models.empty())
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, models.size() * sizeof(glm::mat4), models.data());
+    instanceSource = instanceBuffer;
+    instanceOffset = 0;
+}
+
+void GpuInstanceCuller::cull(const MeshBounds& bounds, const glm::mat4& viewProjection, unsigned int outputBuffer,
+                             unsigned int commandBuffer, int commandIndex) {
+    if (!instanceBuffer)
+        createPrograms();
+    if (instances == 0)
+        return;
+    cullProgram.use();
+    cullProgram.set(UNIFORM_CULL_VIEW_PROJECTION, viewProjection);
+    cullProgram.set(UNIFORM_CULL_BOUNDS_MIN, bounds.min);
+    cullProgram.set(UNIFORM_CULL_BOUNDS_MAX, bounds.max);
+    cullProgram.set(UNIFORM_CULL_INSTANCES, static_cast<int>(instances));
+    cullProgram.set(UNIFORM_CULL_COMMAND, commandIndex);
+    cullProgram.set(UNIFORM_HIZ_VIEW_PROJECTION, pyramidViewProjection);
+    cullProgram.set(UNIFORM_HIZ_LEVELS, pyramidLevels);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, instanceBinding, instanceSource, instanceOffset, instances * sizeof(glm::mat4));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, visibleBinding, outputBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, commandBinding, commandBuffer);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+    glDispatchCompute(groups(static_cast<int>(instances), cullGroupSize), 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+// The depth buffer can't be sampled, so it is copied into a depth texture
+// first; the pyramid is reallocated when the size changes
+void GpuInstanceCuller::buildDepthPyramid(int width, int height, const glm::mat4& viewProjection) {
+    if (!instanceBuffer)
+        createPrograms();
+    if (width <= 0 || height <= 0)
+        return;
+    if (width != pyramidWidth || height != pyramidHeight) {
+        if (depthTexture)
+            glDeleteTextures(1, &depthTexture);
+        if (pyramidTexture)
+            glDeleteTextures(1, &pyramidTexture);
+        glGenTextures(1, &depthTexture);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+
+        int levels = 1;
+        while ((width >> levels) > 0 || (height >> levels) > 0)
+            ++levels;
+        glGenTextures(1, &pyramidTexture);
+        glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+        glTexStorage2D(GL_TEXTURE_2D, levels, GL_R32F, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        pyramidWidth = width;
+        pyramidHeight = height;
+        pyramidLevels = 0;
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+
+    pyramidProgram.use();
+    int levels = 0;
+    for (int w = width, h = height;; w = std::max(w / 2, 1), h = std::max(h / 2, 1)) {
+        pyramidProgram.set(UNIFORM_HIZ_SOURCE_LEVEL, levels - 1);
+        if (levels > 0)
+            glBindImageTexture(0, pyramidTexture, levels - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+        glBindImageTexture(1, pyramidTexture, levels, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glDispatchCompute(groups(w, pyramidGroupSize), groups(h, pyramidGroupSize), 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+        ++levels;
+        if (w == 1 && h == 1)
+            break;
+    }
+    pyramidLevels = levels;
+    pyramidViewProjection = viewProjection;
+}
+
+void GpuInstanceCuller::destroy() {
+    if (instanceBuffer) {
+        glDeleteProgram(cullProgram.id());
+        glDeleteProgram(pyramidProgram.id());
+    }
+    glDeleteBuffers(1, &instanceBuffer);
+    glDeleteTextures(1, &depthTexture);
+    glDeleteTextures(1, &pyramidTexture);
+    instanceBuffer = depthTexture = pyramidTexture = 0;
+    capacity = instances = 0;
+    pyramidWidth = pyramidHeight = pyramidLevels = 0;
+}
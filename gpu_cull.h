@@ -0,0 +1,78 @@
+#ifndef GPU_CULL_H
+#define GPU_CULL_H
+
+#include "frustum_cull.h"
+#include "shader_program.h"
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <vector>
+
+struct FrameRingBuffer;
+
+// Culls the instances of an instanced draw in a compute pass, so the CPU
+// does the same work for any number of them. Each instance's box is tested
+// against the view frustum and against a max-depth pyramid of the previous
+// frame's depth buffer; the instances left are appended to the draw's
+// InstanceBuffer and counted in the instanceCount of its indirect command,
+// which glMultiDrawElementsIndirect then reads without a round trip to the
+// CPU.
+//
+// The occlusion test is a frame late: it asks whether the box was hidden
+// from last frame's camera by what was drawn then, which holds for the
+// scene's static occluders but can let an instance show up a frame after
+// the camera turns towards it. Needs GL 4.3 (compute shaders and storage
+// buffers). GL thread only.
+struct GpuInstanceCuller {
+    GpuInstanceCuller() = default;
+
+    GpuInstanceCuller(const GpuInstanceCuller&) = delete;
+    GpuInstanceCuller& operator=(const GpuInstanceCuller&) = delete;
+
+    static bool supported();
+
+    // Replaces the instances' model matrices (the buffer is orphaned, so a
+    // cull of the previous frame still in flight keeps its)
+    void upload(const std::vector<glm::mat4>& models);
+
+    // Tests the uploaded instances, with bounds in model space, against
+    // viewProjection and the pyramid, writes those left to outputBuffer (an
+    // InstanceBuffer with room for all of them) and adds them to the
+    // instanceCount of command commandIndex in commandBuffer, which has to
+    // start at zero. Draws reading either buffer have to come after.
+    void cull(const MeshBounds& bounds, const glm::mat4& viewProjection, unsigned int outputBuffer,
+              unsigned int commandBuffer, int commandIndex);
+
+    // Builds the pyramid from the depth buffer of the frame just drawn to
+    // the default framebuffer (width x height, seen through viewProjection)
+    // for the next frame's cull
+    void buildDepthPyramid(int width, int height, const glm::mat4& viewProjection);
+
+    // Writes upload()'s matrices into ring's current frame instead of
+    // orphaning, falling back to it when the frame's region is full; null
+    // goes back
+    void useRing(FrameRingBuffer* frameRing) { ring = frameRing; }
+
+    // Deletes the programs, the instance buffer and the depth and pyramid
+    // textures; call while the context is current, before glfwTerminate
+    void destroy();
+
+private:
+    void createPrograms();
+
+    ShaderProgram cullProgram;
+    ShaderProgram pyramidProgram;
+    FrameRingBuffer* ring = nullptr;
+    unsigned int instanceBuffer = 0;
+    size_t capacity = 0; // matrices allocated for instanceBuffer
+    size_t instances = 0;
+    unsigned int instanceSource = 0; // the buffer holding this frame's matrices
+    size_t instanceOffset = 0;       // and where they start in it
+    unsigned int depthTexture = 0;
+    unsigned int pyramidTexture = 0;
+    int pyramidWidth = 0;
+    int pyramidHeight = 0;
+    int pyramidLevels = 0; // 0 until a frame has been drawn
+    glm::mat4 pyramidViewProjection = glm::mat4(1.0f);
+};
+
+#endif
@@ -0,0 +1,69 @@
+#include <GL/glew.h>
+#include "instance_buffer.h"
+#include "ring_buffer.h"
+#include <algorithm>
+#include <cstring>
+
+void InstanceBuffer::attach(unsigned int vao, unsigned int location) {
+    if (!buffer)
+        glGenBuffers(1, &buffer);
+    vertexArray = vao;
+    firstLocation = location;
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    for (unsigned int column = 0; column < 4; ++column) {
+        glEnableVertexAttribArray(location + column);
+        glVertexAttribPointer(location + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                              (void*)(sizeof(glm::vec4) * column));
+        glVertexAttribDivisor(location + column, 1);
+    }
+    glBindVertexArray(0);
+    pointedBuffer = buffer;
+    pointedOffset = 0;
+}
+
+void InstanceBuffer::point(unsigned int source, size_t offset) {
+    if (!vertexArray || (source == pointedBuffer && offset == pointedOffset))
+        return;
+    glBindVertexArray(vertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, source);
+    for (unsigned int column = 0; column < 4; ++column)
+        glVertexAttribPointer(firstLocation + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                              (void*)(offset + sizeof(glm::vec4) * column));
+    glBindVertexArray(0);
+    pointedBuffer = source;
+    pointedOffset = offset;
+}
+
+// Grows to the largest count seen. Never empty: the attribute stays enabled
+// on the shared VAO, so every draw through it fetches instance 0, instanced
+// or not.
+void InstanceBuffer::upload(const std::vector<glm::mat4>& models) {
+    instances = models.size();
+    if (ring && !models.empty()) {
+        RingAllocation slice = ring->allocate(models.size() * sizeof(glm::mat4), sizeof(glm::vec4));
+        if (slice.data) {
+            std::memcpy(slice.data, models.data(), models.size() * sizeof(glm::mat4));
+            point(slice.buffer, slice.offset);
+            return;
+        }
+    }
+    if (!buffer)
+        glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    capacity = std::max({capacity, models.size(), size_t(1)});
+    glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+    if (!models.empty())
+        glBufferSubData(GL_ARRAY_BUFFER, 0, models.size() * sizeof(glm::mat4), models.data());
+    point(buffer, 0);
+}
+
+void InstanceBuffer::resize(size_t count) {
+    if (!buffer)
+        glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    capacity = std::max({capacity, count, size_t(1)});
+    glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+    instances = count;
+    point(buffer, 0);
+}
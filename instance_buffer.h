@@ -0,0 +1,52 @@
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <vector>
+
+struct FrameRingBuffer;
+
+// Per-instance model matrices for a mesh drawn with glDrawElementsInstanced.
+// The mat4 is fed to the vertex shader as four vec4 attributes with divisor
+// 1, so one draw covers any number of copies. GL thread only.
+struct InstanceBuffer {
+    InstanceBuffer() = default;
+
+    InstanceBuffer(const InstanceBuffer&) = delete;
+    InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+    // Adds the matrix attribute to vao at locations location..location+3
+    void attach(unsigned int vao, unsigned int location);
+
+    // Replaces the instances (the buffer is orphaned, so draws of the
+    // previous frame still in flight keep theirs)
+    void upload(const std::vector<glm::mat4>& models);
+
+    // Makes room for count instances for the GPU to write (see
+    // gpu_cull.h); orphans the buffer like upload()
+    void resize(size_t count);
+
+    unsigned int id() const { return buffer; }
+    size_t count() const { return instances; }
+
+    // Writes upload()'s matrices into ring's current frame instead of
+    // orphaning, falling back to it when the frame's region is full; null
+    // goes back
+    void useRing(FrameRingBuffer* frameRing) { ring = frameRing; }
+
+private:
+    // Points the attribute at offset in source, when it points elsewhere
+    void point(unsigned int source, size_t offset);
+
+    unsigned int buffer = 0;
+    FrameRingBuffer* ring = nullptr;
+    unsigned int vertexArray = 0;
+    unsigned int firstLocation = 0;
+    unsigned int pointedBuffer = 0;
+    size_t pointedOffset = 0;
+    size_t capacity = 0; // matrices allocated for buffer
+    size_t instances = 0;
+};
+
+#endif
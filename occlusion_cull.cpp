@@ -0,0 +1,248 @@
+#include "occlusion_cull.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OCCLUSION_SSE2
+#endif
+
+namespace {
+
+const int tileSize = 32;
+
+// One side of an occluder triangle, for finding the triangle across it
+struct EdgeRecord {
+    unsigned long long key; // the corners' indices, lower first
+    int triangle;
+    int edge;
+    bool clockwise;
+
+    bool operator<(const EdgeRecord& other) const { return key < other.key; }
+};
+
+}
+
+OcclusionBuffer::OcclusionBuffer(int w, int h)
+    : width((w + tileSize - 1) / tileSize * tileSize),
+      height((h + tileSize - 1) / tileSize * tileSize),
+      tilesX(width / tileSize),
+      tilesY(height / tileSize),
+      bins(tilesX * tilesY) {
+    // Each level halves the one before, rounding up; the pyramid ends at a
+    // single texel
+    glm::ivec2 size(width, height);
+    for (;;) {
+        levelSizes.push_back(size);
+        levels.emplace_back(static_cast<size_t>(size.x) * size.y, 1.0f);
+        if (size.x == 1 && size.y == 1)
+            break;
+        size = glm::ivec2((size.x + 1) / 2, (size.y + 1) / 2);
+    }
+}
+
+void OcclusionBuffer::begin(const glm::mat4& frameViewProjection) {
+    viewProjection = frameViewProjection;
+    triangles.clear();
+}
+
+void OcclusionBuffer::addOccluder(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices, const glm::mat4& model) {
+    glm::mat4 transform = viewProjection * model;
+    std::vector<glm::vec3> screen(positions.size());
+    std::vector<unsigned char> usable(positions.size());
+    for (size_t i = 0; i < positions.size(); ++i) {
+        glm::vec4 clip = transform * glm::vec4(positions[i], 1.0f);
+        // in front of the near plane
+        usable[i] = clip.w > 1e-5f && clip.z >= -clip.w;
+        if (!usable[i])
+            continue;
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        screen[i] = glm::vec3((ndc.x * 0.5f + 0.5f) * width, (ndc.y * 0.5f + 0.5f) * height, std::min(ndc.z * 0.5f + 0.5f, 1.0f));
+    }
+    // An edge two triangles share is inside the mesh when they wind the
+    // same way on screen, so they lie on either side of it; where they wind
+    // opposite ways the mesh folds over and the edge is part of the outline
+    std::vector<EdgeRecord> edges;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        unsigned int corners[3] = {indices[i], indices[i + 1], indices[i + 2]};
+        if (!usable[corners[0]] || !usable[corners[1]] || !usable[corners[2]])
+            continue;
+        Triangle triangle = {{screen[corners[0]], screen[corners[1]], screen[corners[2]]}, {false, false, false}};
+        const glm::vec3* v = triangle.v;
+        float minX = std::min(std::min(v[0].x, v[1].x), v[2].x);
+        float maxX = std::max(std::max(v[0].x, v[1].x), v[2].x);
+        float minY = std::min(std::min(v[0].y, v[1].y), v[2].y);
+        float maxY = std::max(std::max(v[0].y, v[1].y), v[2].y);
+        if (maxX < 0.0f || maxY < 0.0f || minX >= width || minY >= height)
+            continue;
+        bool clockwise = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y) < 0.0f;
+        for (int edge = 0; edge < 3; ++edge) {
+            unsigned long long p = corners[edge], q = corners[(edge + 1) % 3];
+            edges.push_back({std::min(p, q) << 32 | std::max(p, q), static_cast<int>(triangles.size()), edge, clockwise});
+        }
+        triangles.push_back(triangle);
+    }
+    std::sort(edges.begin(), edges.end());
+    for (size_t i = 0; i < edges.size();) {
+        size_t end = i + 1;
+        while (end < edges.size() && edges[end].key == edges[i].key)
+            ++end;
+        if (end - i == 2 && edges[i].clockwise == edges[i + 1].clockwise) {
+            triangles[edges[i].triangle].inner[edges[i].edge] = true;
+            triangles[edges[i + 1].triangle].inner[edges[i + 1].edge] = true;
+        }
+        i = end;
+    }
+}
+
+void OcclusionBuffer::rasterize() {
+    for (std::vector<int>& bin : bins)
+        bin.clear();
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        const Triangle& t = triangles[i];
+        float minX = std::min(std::min(t.v[0].x, t.v[1].x), t.v[2].x);
+        float maxX = std::max(std::max(t.v[0].x, t.v[1].x), t.v[2].x);
+        float minY = std::min(std::min(t.v[0].y, t.v[1].y), t.v[2].y);
+        float maxY = std::max(std::max(t.v[0].y, t.v[1].y), t.v[2].y);
+        int tx0 = std::max(static_cast<int>(minX) / tileSize, 0);
+        int tx1 = std::min(static_cast<int>(maxX) / tileSize, tilesX - 1);
+        int ty0 = std::max(static_cast<int>(minY) / tileSize, 0);
+        int ty1 = std::min(static_cast<int>(maxY) / tileSize, tilesY - 1);
+        for (int ty = ty0; ty <= ty1; ++ty)
+            for (int tx = tx0; tx <= tx1; ++tx)
+                bins[ty * tilesX + tx].push_back(static_cast<int>(i));
+    }
+
+    ThreadPool::shared().parallelFor(tilesX * tilesY, [&](int tile) { rasterizeTile(tile); });
+
+    // Missing texels past an odd edge count as far, so they never hide anything
+    for (size_t level = 1; level < levels.size(); ++level) {
+        const std::vector<float>& fine = levels[level - 1];
+        glm::ivec2 fineSize = levelSizes[level - 1];
+        glm::ivec2 size = levelSizes[level];
+        for (int y = 0; y < size.y; ++y) {
+            for (int x = 0; x < size.x; ++x) {
+                float farthest = 0.0f;
+                for (int dy = 0; dy < 2; ++dy)
+                    for (int dx = 0; dx < 2; ++dx) {
+                        int fx = x * 2 + dx, fy = y * 2 + dy;
+                        farthest = std::max(farthest, fx < fineSize.x && fy < fineSize.y ? fine[fy * fineSize.x + fx] : 1.0f);
+                    }
+                levels[level][y * size.x + x] = farthest;
+            }
+        }
+    }
+}
+
+// Edge functions are set up so the inside is positive. On the outline a
+// pixel needs the function to be at least half its gradient's L1 norm at
+// the pixel centre, which puts the whole pixel square inside; on inner
+// edges the centre has to be inside. Written pixels get the depth plane's
+// largest value over the square.
+void OcclusionBuffer::rasterizeTile(int tile) {
+    int x0 = (tile % tilesX) * tileSize, y0 = (tile / tilesX) * tileSize;
+    float* depth = levels[0].data();
+    for (int y = y0; y < y0 + tileSize; ++y)
+        std::fill(depth + y * width + x0, depth + y * width + x0 + tileSize, 1.0f);
+
+    for (int index : bins[tile]) {
+        const Triangle& t = triangles[index];
+        glm::vec3 a = t.v[0], b = t.v[1], c = t.v[2];
+        float area = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+        if (std::fabs(area) < 1e-6f)
+            continue;
+        float orient = area > 0.0f ? 1.0f : -1.0f;
+        // edge i runs from corner i to corner i + 1: E = A x + B y + C
+        const glm::vec3* corners[3] = {&a, &b, &c};
+        float edgeA[3], edgeB[3], edgeC[3], edgeMin[3];
+        for (int i = 0; i < 3; ++i) {
+            const glm::vec3& p = *corners[i];
+            const glm::vec3& q = *corners[(i + 1) % 3];
+            edgeA[i] = -(q.y - p.y) * orient;
+            edgeB[i] = (q.x - p.x) * orient;
+            edgeC[i] = -(edgeA[i] * p.x + edgeB[i] * p.y);
+            edgeMin[i] = t.inner[i] ? 0.0f : 0.5f * (std::fabs(edgeA[i]) + std::fabs(edgeB[i]));
+        }
+        float dzdx = ((b.z - a.z) * (c.y - a.y) - (c.z - a.z) * (b.y - a.y)) / area;
+        float dzdy = ((c.z - a.z) * (b.x - a.x) - (b.z - a.z) * (c.x - a.x)) / area;
+        float zBias = 0.5f * (std::fabs(dzdx) + std::fabs(dzdy));
+        float zC = a.z - dzdx * a.x - dzdy * a.y + zBias;
+
+        int minX = std::max(static_cast<int>(std::floor(std::min(std::min(a.x, b.x), c.x))), x0) & ~3;
+        int maxX = std::min(static_cast<int>(std::ceil(std::max(std::max(a.x, b.x), c.x))), x0 + tileSize - 1);
+        int minY = std::max(static_cast<int>(std::floor(std::min(std::min(a.y, b.y), c.y))), y0);
+        int maxY = std::min(static_cast<int>(std::ceil(std::max(std::max(a.y, b.y), c.y))), y0 + tileSize - 1);
+
+        for (int y = minY; y <= maxY; ++y) {
+            float py = y + 0.5f;
+            float* row = depth + y * width;
+#ifdef OCCLUSION_SSE2
+            __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+            __m128 rowEdge[3], stepA[3], limit[3];
+            for (int i = 0; i < 3; ++i) {
+                rowEdge[i] = _mm_set1_ps(edgeB[i] * py + edgeC[i]);
+                stepA[i] = _mm_set1_ps(edgeA[i]);
+                limit[i] = _mm_set1_ps(edgeMin[i]);
+            }
+            __m128 rowDepth = _mm_set1_ps(dzdy * py + zC);
+            __m128 stepZ = _mm_set1_ps(dzdx);
+            for (int x = minX; x <= maxX; x += 4) {
+                __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), offsets);
+                __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(stepA[0], px), rowEdge[0]), limit[0]);
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(stepA[1], px), rowEdge[1]), limit[1]));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(stepA[2], px), rowEdge[2]), limit[2]));
+                if (_mm_movemask_ps(inside) == 0)
+                    continue;
+                __m128 z = _mm_add_ps(_mm_mul_ps(stepZ, px), rowDepth);
+                __m128 old = _mm_loadu_ps(row + x);
+                __m128 nearer = _mm_min_ps(old, z);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+            }
+#else
+            for (int x = minX; x <= maxX; ++x) {
+                float px = x + 0.5f;
+                bool inside = true;
+                for (int i = 0; i < 3; ++i)
+                    inside = inside && edgeA[i] * px + edgeB[i] * py + edgeC[i] >= edgeMin[i];
+                if (inside)
+                    row[x] = std::min(row[x], dzdx * px + dzdy * py + zC);
+            }
+#endif
+        }
+    }
+}
+
+// Tests the box's nearest depth against the pyramid level where its screen
+// rectangle spans at most 4x4 texels
+bool OcclusionBuffer::visible(const glm::vec3& center, const glm::vec3& extent) const {
+    float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f, nearest = 1.0f;
+    for (int corner = 0; corner < 8; ++corner) {
+        glm::vec3 p = center + extent * glm::vec3(corner & 1 ? 1.0f : -1.0f, corner & 2 ? 1.0f : -1.0f, corner & 4 ? 1.0f : -1.0f);
+        glm::vec4 clip = viewProjection * glm::vec4(p, 1.0f);
+        if (clip.w <= 1e-5f || clip.z < -clip.w)
+            return true; // reaches the camera
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        float x = (ndc.x * 0.5f + 0.5f) * width, y = (ndc.y * 0.5f + 0.5f) * height;
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        nearest = std::min(nearest, ndc.z * 0.5f + 0.5f);
+    }
+    if (maxX < 0.0f || maxY < 0.0f || minX >= width || minY >= height)
+        return true; // off screen is for frustum culling to decide
+    int x0 = std::max(static_cast<int>(minX), 0), x1 = std::min(static_cast<int>(maxX), width - 1);
+    int y0 = std::max(static_cast<int>(minY), 0), y1 = std::min(static_cast<int>(maxY), height - 1);
+
+    size_t level = 0;
+    while (level + 1 < levels.size() && ((x1 >> level) - (x0 >> level) > 3 || (y1 >> level) - (y0 >> level) > 3))
+        ++level;
+    const std::vector<float>& depth = levels[level];
+    int levelWidth = levelSizes[level].x;
+    for (int y = y0 >> level; y <= y1 >> level; ++y)
+        for (int x = x0 >> level; x <= x1 >> level; ++x)
+            if (depth[y * levelWidth + x] >= nearest)
+                return true;
+    return false;
+}
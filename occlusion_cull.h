@@ -0,0 +1,61 @@
+#ifndef OCCLUSION_CULL_H
+#define OCCLUSION_CULL_H
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <vector>
+
+// A low-resolution depth buffer of the frame's big occluders, rasterized on
+// the CPU, that bounding boxes are tested against before their draws reach
+// GL. The buffer is cut into tiles rendered in parallel on the shared
+// ThreadPool, four pixels at a time with SSE2, and a pyramid of the farthest
+// depth under each 2x2 texels makes a test a handful of reads.
+//
+// It errs towards hiding less than the real scene would. Along an occluder's
+// outline a pixel is written only where the occluder covers all of it;
+// inside the mesh, where two triangles facing the same way share an edge,
+// the pixel centre decides, so the mesh has no cracks between triangles.
+// Pixels get the farthest depth of the triangle over them, and triangles
+// crossing the near plane are skipped. Occluders themselves have to lie
+// inside what they stand for.
+struct OcclusionBuffer {
+    // width and height are rounded up to whole tiles
+    explicit OcclusionBuffer(int width = 256, int height = 192);
+
+    // Starts a frame seen through viewProjection and drops the occluders of
+    // the last one
+    void begin(const glm::mat4& viewProjection);
+
+    // Adds a triangle mesh placed by model
+    void addOccluder(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices, const glm::mat4& model);
+
+    // Renders the occluders added since begin() and builds the pyramid
+    void rasterize();
+
+    // False when the world-space box (centre and half extents) is certainly
+    // behind the occluders
+    bool visible(const glm::vec3& center, const glm::vec3& extent) const;
+
+private:
+    // Screen position in pixels and depth in 0..1 of each corner; edge i
+    // runs from corner i to corner i + 1 and is inner when another triangle
+    // of the mesh continues past it
+    struct Triangle {
+        glm::vec3 v[3];
+        bool inner[3];
+    };
+
+    void rasterizeTile(int tile);
+
+    int width;
+    int height;
+    int tilesX;
+    int tilesY;
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+    std::vector<Triangle> triangles;
+    std::vector<std::vector<int>> bins; // triangles overlapping each tile
+    std::vector<std::vector<float>> levels;
+    std::vector<glm::ivec2> levelSizes;
+};
+
+#endif
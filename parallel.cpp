@@ -0,0 +1,100 @@
+#include "parallel.h"
+#include <algorithm>
+
+namespace {
+thread_local bool insidePoolWorker = false;
+}
+
+ThreadPool::ThreadPool(unsigned int threadCount) {
+    if (threadCount == 0) {
+        threadCount = std::thread::hardware_concurrency();
+        if (threadCount == 0)
+            threadCount = 1;
+    }
+    // The caller of parallelFor is one of the threads
+    for (unsigned int i = 1; i < threadCount; ++i)
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+// Hands out job's next index, or -1 when none are left; the job leaves the
+// list with its last one. Needs mutex held.
+int ThreadPool::claim(Job& job) {
+    if (job.next >= job.count)
+        return -1;
+    int i = job.next++;
+    if (job.next == job.count)
+        jobs.erase(std::find(jobs.begin(), jobs.end(), &job));
+    return i;
+}
+
+void ThreadPool::finish(Job& job) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (++job.finished == job.count)
+        done.notify_all();
+}
+
+void ThreadPool::workerLoop() {
+    insidePoolWorker = true;
+    for (;;) {
+        Job* job;
+        int i;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || !jobs.empty(); });
+            if (stopping)
+                return;
+            job = jobs.back();
+            i = claim(*job);
+        }
+        (*job->fn)(i);
+        finish(*job);
+    }
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)>& fn) {
+    if (count <= 0)
+        return;
+    if (workers.empty() || count == 1 || insidePoolWorker) {
+        for (int i = 0; i < count; ++i)
+            fn(i);
+        return;
+    }
+
+    Job job = {&fn, count, 0, 0};
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(&job);
+    }
+    wake.notify_all();
+
+    // The caller only works on its own job, so it never waits on another's
+    for (;;) {
+        int i;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            i = claim(job);
+        }
+        if (i < 0)
+            break;
+        fn(i);
+        finish(job);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return job.finished == job.count; });
+}
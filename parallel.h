@@ -0,0 +1,50 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small fixed pool of worker threads for data-parallel loops
+// (texture block compression, mip filtering and so on).
+struct ThreadPool {
+    explicit ThreadPool(unsigned int threadCount = 0);
+    ~ThreadPool();
+
+    // Calls fn(i) for every i in [0, count). The calling thread helps with the
+    // work and the call returns once every index has been processed.
+    // Calls made from inside a worker run serially on that worker.
+    // Several threads may have jobs in at once: workers take indices from the
+    // newest job first, so a short job (a frame's) gets help as soon as they
+    // finish the index in hand instead of waiting out a long one (a bake).
+    void parallelFor(int count, const std::function<void(int)>& fn);
+
+    // Number of threads taking part in parallelFor, including the caller
+    unsigned int size() const { return static_cast<unsigned int>(workers.size()) + 1; }
+
+    // Process-wide pool sized to the hardware
+    static ThreadPool& shared();
+
+private:
+    struct Job {
+        const std::function<void(int)>* fn;
+        int count;
+        int next;     // first index not handed out yet
+        int finished; // indices done
+    };
+
+    void workerLoop();
+    int claim(Job& job);
+    void finish(Job& job);
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::vector<Job*> jobs; // with indices left to hand out, oldest first
+    bool stopping = false;
+};
+
+#endif
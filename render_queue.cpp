@@ -0,0 +1,42 @@
+#include "render_queue.h"
+#include <algorithm>
+
+uint64_t RenderQueue::makeKey(unsigned int pass, unsigned int program, unsigned int texture, unsigned int vao, float depth) {
+    const uint64_t depthBuckets = (1u << 24) - 1;
+    uint64_t bucket = static_cast<uint64_t>(std::min(std::max(depth, 0.0f), 1.0f) * depthBuckets);
+    return static_cast<uint64_t>(pass & 0xf) << 60 |
+           static_cast<uint64_t>(program & 0xff) << 52 |
+           static_cast<uint64_t>(texture & 0xfff) << 40 |
+           static_cast<uint64_t>(vao & 0xffff) << 24 |
+           bucket;
+}
+
+void RenderQueue::submit(uint64_t key, const RenderItem& item) {
+    entries.push_back({key, static_cast<uint32_t>(items.size())});
+    items.push_back(item);
+}
+
+// Least significant byte first, skipping bytes every key has in common
+// (most of the key, since a frame uses few passes, programs and textures)
+void RenderQueue::sort() {
+    size_t count = entries.size();
+    if (count < 2)
+        return;
+    scratch.resize(count);
+    for (int shift = 0; shift < 64; shift += 8) {
+        size_t offsets[256] = {};
+        for (const Entry& entry : entries)
+            ++offsets[(entry.key >> shift) & 0xff];
+        if (offsets[(entries[0].key >> shift) & 0xff] == count)
+            continue;
+        size_t offset = 0;
+        for (size_t& bucket : offsets) {
+            size_t size = bucket;
+            bucket = offset;
+            offset += size;
+        }
+        for (const Entry& entry : entries)
+            scratch[offsets[(entry.key >> shift) & 0xff]++] = entry;
+        entries.swap(scratch);
+    }
+}
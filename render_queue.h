@@ -0,0 +1,66 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Passes, in the order they run
+enum RenderPass {
+    RENDER_PASS_FEEDBACK = 0, // virtual texture feedback (see VirtualTexture)
+    RENDER_PASS_OPAQUE = 1
+};
+
+// What a draw needs besides the state its key already names
+struct RenderItem {
+    unsigned int vao;
+    int count;               // indices
+    unsigned int firstIndex; // in the element buffer
+    int baseVertex;
+    int texture;             // scene texture, -1 for the virtual terrain
+    int object;              // index of the draw's ObjectUniforms
+    int instances;           // 0 for a plain draw, else drawn instanced
+};
+
+// The frame's draws, each submitted with a 64-bit key packing, most
+// significant first, its pass (4 bits), program (8), texture (12), VAO (16)
+// and a depth bucket (24). Sorting by key puts the draws in pass order,
+// groups them by state so running them in order changes as little of it as
+// possible, and orders each group front to back. Submission order doesn't
+// matter.
+//
+// Program, texture and VAO are small numbers the caller gives out, not GL
+// names, which could be anything: two names that agreed in the bits kept
+// would batch together.
+struct RenderQueue {
+    // depth is the draw's distance over the far plane; values outside 0..1
+    // are clamped. The other fields must fit their bits.
+    static uint64_t makeKey(unsigned int pass, unsigned int program, unsigned int texture, unsigned int vao, float depth);
+    static unsigned int keyPass(uint64_t key) { return static_cast<unsigned int>(key >> 60); }
+    static unsigned int keyProgram(uint64_t key) { return static_cast<unsigned int>(key >> 52) & 0xff; }
+    // All of the key but depth: draws with equal state can go out together
+    static uint64_t keyState(uint64_t key) { return key >> 24; }
+
+    void clear() { entries.clear(); items.clear(); }
+    void submit(uint64_t key, const RenderItem& item);
+
+    // Radix sorts the draws by key; stable, so equal keys keep their order
+    void sort();
+
+    size_t size() const { return entries.size(); }
+    // The i-th draw in key order once sorted
+    uint64_t key(size_t i) const { return entries[i].key; }
+    const RenderItem& item(size_t i) const { return items[entries[i].item]; }
+
+private:
+    struct Entry {
+        uint64_t key;
+        uint32_t item;
+    };
+
+    std::vector<Entry> entries;
+    std::vector<Entry> scratch;
+    std::vector<RenderItem> items;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#include <GL/glew.h>
+#include "ring_buffer.h"
+
+namespace {
+
+// Regions start on this, which covers every offset alignment GL allows
+const size_t regionAlignment = 256;
+
+}
+
+FrameRingBuffer::FrameRingBuffer(size_t bytes)
+    : frameBytes((bytes + regionAlignment - 1) / regionAlignment * regionAlignment) {
+}
+
+bool FrameRingBuffer::supported() {
+    return GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+}
+
+void FrameRingBuffer::create() {
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferStorage(GL_COPY_WRITE_BUFFER, frameBytes * frames, nullptr, flags);
+    mapped = static_cast<unsigned char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, frameBytes * frames, flags));
+
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    uniformOffsetAlignment = alignment > 0 ? static_cast<size_t>(alignment) : 256;
+    alignment = 256;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    storageOffsetAlignment = alignment > 0 ? static_cast<size_t>(alignment) : 256;
+}
+
+void FrameRingBuffer::beginFrame() {
+    if (!buffer)
+        create();
+    frame = (frame + 1) % frames;
+    head = 0;
+    GLsync fence = static_cast<GLsync>(fences[frame]);
+    if (!fence)
+        return;
+    // flush on the first wait only, so the fence is sure to be reached
+    GLbitfield flush = GL_SYNC_FLUSH_COMMANDS_BIT;
+    while (glClientWaitSync(fence, flush, 1000000000) == GL_TIMEOUT_EXPIRED)
+        flush = 0;
+    glDeleteSync(fence);
+    fences[frame] = nullptr;
+}
+
+void FrameRingBuffer::endFrame() {
+    if (!buffer)
+        return;
+    if (fences[frame])
+        glDeleteSync(static_cast<GLsync>(fences[frame]));
+    fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+RingAllocation FrameRingBuffer::allocate(size_t bytes, size_t alignment) {
+    if (!buffer)
+        create();
+    RingAllocation allocation;
+    size_t base = frameBytes * frame;
+    size_t offset = (base + head + alignment - 1) & ~(alignment - 1);
+    if (!mapped || offset + bytes > base + frameBytes)
+        return allocation;
+    head = offset + bytes - base;
+    allocation.data = mapped + offset;
+    allocation.buffer = buffer;
+    allocation.offset = offset;
+    return allocation;
+}
+
+size_t FrameRingBuffer::uniformAlignment() {
+    if (!buffer)
+        create();
+    return uniformOffsetAlignment;
+}
+
+size_t FrameRingBuffer::storageAlignment() {
+    if (!buffer)
+        create();
+    return storageOffsetAlignment;
+}
+
+void FrameRingBuffer::destroy() {
+    for (void*& fence : fences) {
+        if (fence)
+            glDeleteSync(static_cast<GLsync>(fence));
+        fence = nullptr;
+    }
+    if (!buffer)
+        return;
+    if (mapped) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    glDeleteBuffers(1, &buffer);
+    buffer = 0;
+    mapped = nullptr;
+}
@@ -0,0 +1,67 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <cstddef>
+
+// Where an allocation from a FrameRingBuffer went: write the data through
+// data, then bind buffer at offset. data is null when the frame's region
+// was full.
+struct RingAllocation {
+    void* data = nullptr;
+    unsigned int buffer = 0;
+    size_t offset = 0;
+};
+
+// One buffer, mapped once for good (persistent and coherent), cut into a
+// region per frame in flight. A frame bump-allocates its transient data
+// (uniform blocks, storage buffers, instance attributes) from its region and
+// writes it in place, so streaming needs no glBufferData or glBufferSubData
+// and never waits on the driver to orphan. A fence at the end of each frame
+// marks when the GPU is done with the region; the frame that next reuses it
+// waits on that fence, which only blocks when the GPU is more than
+// frames - 1 frames behind. Needs GL 4.4 or ARB_buffer_storage. GL thread
+// only.
+struct FrameRingBuffer {
+    static const int frames = 3;
+
+    // frameBytes is each frame's region; the buffer is created on first use
+    explicit FrameRingBuffer(size_t frameBytes);
+
+    FrameRingBuffer(const FrameRingBuffer&) = delete;
+    FrameRingBuffer& operator=(const FrameRingBuffer&) = delete;
+
+    static bool supported();
+
+    // Moves to the next frame's region, waiting until the GPU is done with
+    // what was last written there
+    void beginFrame();
+
+    // Fences the frame's region; call after its last draw
+    void endFrame();
+
+    // bytes at an offset that is a multiple of alignment (a power of two)
+    RingAllocation allocate(size_t bytes, size_t alignment);
+
+    // Offset alignments for binding ranges as uniform or storage blocks
+    size_t uniformAlignment();
+    size_t storageAlignment();
+
+    // Unmaps and deletes the buffer and the regions' fences. Call while the
+    // context is current, before glfwTerminate; there is no destructor doing
+    // it, since one could run once the context is gone.
+    void destroy();
+
+private:
+    void create();
+
+    size_t frameBytes;
+    unsigned int buffer = 0;
+    unsigned char* mapped = nullptr;
+    void* fences[frames] = {};
+    int frame = 0;
+    size_t head = 0; // bytes used in the current region
+    size_t uniformOffsetAlignment = 0;
+    size_t storageOffsetAlignment = 0;
+};
+
+#endif
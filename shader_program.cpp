@@ -0,0 +1,252 @@
+#include <GL/glew.h>
+#include "shader_program.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+// Names in the shaders, in UniformId order
+const char* const uniformNames[] = {
+    "cutOff",
+    "textureLayers",
+    "virtualTexture",
+    "drawBase",
+    "vtPhysical",
+    "vtIndirection",
+    "vtPages",
+    "vtLevels",
+    "vtTileSize",
+    "vtBorder",
+    "vtPhysicalSize",
+    "vtLodBias",
+    "cullViewProjection",
+    "cullBoundsMin",
+    "cullBoundsMax",
+    "cullInstances",
+    "cullCommand",
+    "hizViewProjection",
+    "hizLevels",
+    "hizSourceLevel",
+};
+
+static_assert(sizeof(uniformNames) / sizeof(uniformNames[0]) == UNIFORM_COUNT,
+              "uniformNames needs a name for every UniformId");
+
+// Bytes of one element of a uniform of the given GL type; samplers and bools
+// are set as ints
+size_t uniformTypeBytes(GLenum type) {
+    switch (type) {
+    case GL_FLOAT_VEC2:
+    case GL_INT_VEC2:
+    case GL_UNSIGNED_INT_VEC2:
+    case GL_BOOL_VEC2:
+        return 8;
+    case GL_FLOAT_VEC3:
+    case GL_INT_VEC3:
+    case GL_UNSIGNED_INT_VEC3:
+    case GL_BOOL_VEC3:
+        return 12;
+    case GL_FLOAT_VEC4:
+    case GL_INT_VEC4:
+    case GL_UNSIGNED_INT_VEC4:
+    case GL_BOOL_VEC4:
+    case GL_FLOAT_MAT2:
+        return 16;
+    case GL_FLOAT_MAT3:
+        return 36;
+    case GL_FLOAT_MAT4:
+        return 64;
+    default:
+        return 4;
+    }
+}
+
+GLuint compileShader(GLenum type, const char* source) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+    int success;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        char infoLog[512];
+        glGetShaderInfoLog(shader, 512, nullptr, infoLog);
+        std::cout << "Shader compilation error: " << infoLog << std::endl;
+    }
+    return shader;
+}
+
+}
+
+bool ShaderProgram::link(const char* vertexSource, const char* fragmentSource) {
+    GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource);
+    GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+    program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    glLinkProgram(program);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+    return finishLink();
+}
+
+bool ShaderProgram::linkCompute(const char* computeSource) {
+    GLuint computeShader = compileShader(GL_COMPUTE_SHADER, computeSource);
+    program = glCreateProgram();
+    glAttachShader(program, computeShader);
+    glLinkProgram(program);
+    glDeleteShader(computeShader);
+    return finishLink();
+}
+
+bool ShaderProgram::finishLink() {
+    int success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        char infoLog[512];
+        glGetProgramInfoLog(program, 512, nullptr, infoLog);
+        std::cout << "Shader link error: " << infoLog << std::endl;
+        return false;
+    }
+    reflect();
+    return true;
+}
+
+void ShaderProgram::use() const {
+    glUseProgram(program);
+}
+
+void ShaderProgram::addUniform(const std::string& name, unsigned int type, int elements, int location) {
+    // arrays are reported as "name[0]"
+    std::string base = name.substr(0, name.find('['));
+    for (int i = 0; i < UNIFORM_COUNT; ++i) {
+        if (base != uniformNames[i])
+            continue;
+        Uniform& uniform = uniforms[i];
+        uniform.location = location;
+        uniform.offset = values.size();
+        uniform.bytes = uniformTypeBytes(type) * elements;
+        values.resize(values.size() + uniform.bytes, 0);
+        return;
+    }
+}
+
+// Program interface queries when there are (GL 4.3), the older per-uniform
+// queries otherwise
+void ShaderProgram::reflect() {
+    for (Uniform& uniform : uniforms)
+        uniform = Uniform();
+    values.clear();
+    blocks.clear();
+
+    std::vector<char> name;
+    if (GLEW_VERSION_4_3 || GLEW_ARB_program_interface_query) {
+        GLint count = 0, maxName = 0;
+        glGetProgramInterfaceiv(program, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+        glGetProgramInterfaceiv(program, GL_UNIFORM, GL_MAX_NAME_LENGTH, &maxName);
+        name.resize(maxName + 1);
+        const GLenum properties[4] = {GL_TYPE, GL_ARRAY_SIZE, GL_LOCATION, GL_BLOCK_INDEX};
+        for (GLint i = 0; i < count; ++i) {
+            GLint results[4];
+            glGetProgramResourceiv(program, GL_UNIFORM, i, 4, properties, 4, nullptr, results);
+            if (results[3] != -1)
+                continue; // block members are set through their buffer
+            glGetProgramResourceName(program, GL_UNIFORM, i, maxName + 1, nullptr, name.data());
+            addUniform(name.data(), results[0], results[1], results[2]);
+        }
+
+        glGetProgramInterfaceiv(program, GL_UNIFORM_BLOCK, GL_ACTIVE_RESOURCES, &count);
+        glGetProgramInterfaceiv(program, GL_UNIFORM_BLOCK, GL_MAX_NAME_LENGTH, &maxName);
+        name.resize(maxName + 1);
+        for (GLint i = 0; i < count; ++i) {
+            glGetProgramResourceName(program, GL_UNIFORM_BLOCK, i, maxName + 1, nullptr, name.data());
+            blocks.push_back({name.data(), i});
+        }
+        return;
+    }
+
+    GLint count = 0, maxName = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxName);
+    name.resize(maxName + 1);
+    for (GLint i = 0; i < count; ++i) {
+        GLint elements;
+        GLenum type;
+        glGetActiveUniform(program, i, maxName + 1, nullptr, &elements, &type, name.data());
+        GLint location = glGetUniformLocation(program, name.data());
+        if (location >= 0)
+            addUniform(name.data(), type, elements, location);
+    }
+
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxName);
+    name.resize(maxName + 1);
+    for (GLint i = 0; i < count; ++i) {
+        glGetActiveUniformBlockName(program, i, maxName + 1, nullptr, name.data());
+        blocks.push_back({name.data(), i});
+    }
+}
+
+int ShaderProgram::blockIndex(const char* name) const {
+    for (const Block& block : blocks)
+        if (block.name == name)
+            return block.index;
+    return -1;
+}
+
+bool ShaderProgram::bindBlock(const char* name, unsigned int binding) {
+    int index = blockIndex(name);
+    if (index < 0)
+        return false;
+    glUniformBlockBinding(program, static_cast<GLuint>(index), binding);
+    return true;
+}
+
+// Records value as the uniform's current one; false when the program doesn't
+// have the uniform or already holds that value
+bool ShaderProgram::changed(UniformId uniform, const void* value, size_t bytes) {
+    const Uniform& entry = uniforms[uniform];
+    if (entry.location < 0)
+        return false;
+    bytes = std::min(bytes, entry.bytes);
+    unsigned char* last = &values[entry.offset];
+    if (std::memcmp(last, value, bytes) == 0)
+        return false;
+    std::memcpy(last, value, bytes);
+    return true;
+}
+
+void ShaderProgram::set(UniformId uniform, int value) {
+    if (changed(uniform, &value, sizeof(value)))
+        glUniform1i(uniforms[uniform].location, value);
+}
+
+void ShaderProgram::set(UniformId uniform, float value) {
+    if (changed(uniform, &value, sizeof(value)))
+        glUniform1f(uniforms[uniform].location, value);
+}
+
+void ShaderProgram::set(UniformId uniform, const glm::ivec2& value) {
+    if (changed(uniform, &value[0], sizeof(value)))
+        glUniform2iv(uniforms[uniform].location, 1, &value[0]);
+}
+
+void ShaderProgram::set(UniformId uniform, const glm::vec2& value) {
+    if (changed(uniform, &value[0], sizeof(value)))
+        glUniform2fv(uniforms[uniform].location, 1, &value[0]);
+}
+
+void ShaderProgram::set(UniformId uniform, const glm::vec3& value) {
+    if (changed(uniform, &value[0], sizeof(value)))
+        glUniform3fv(uniforms[uniform].location, 1, &value[0]);
+}
+
+void ShaderProgram::set(UniformId uniform, const glm::vec4& value) {
+    if (changed(uniform, &value[0], sizeof(value)))
+        glUniform4fv(uniforms[uniform].location, 1, &value[0]);
+}
+
+void ShaderProgram::set(UniformId uniform, const glm::mat4& value) {
+    if (changed(uniform, &value[0][0], sizeof(value)))
+        glUniformMatrix4fv(uniforms[uniform].location, 1, GL_FALSE, &value[0][0]);
+}
@@ -0,0 +1,96 @@
+#ifndef SHADER_PROGRAM_H
+#define SHADER_PROGRAM_H
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+// Every uniform the scene's shaders use. A program reflects which of them it
+// has when it links, so the draw code addresses them by ID and never by name.
+// Per-frame and per-object values live in uniform blocks instead (see
+// uniform_buffers.h).
+enum UniformId {
+    UNIFORM_CUT_OFF,
+    UNIFORM_TEXTURE_LAYERS,
+    UNIFORM_VIRTUAL_TEXTURE,
+    UNIFORM_DRAW_BASE,
+    UNIFORM_VT_PHYSICAL,
+    UNIFORM_VT_INDIRECTION,
+    UNIFORM_VT_PAGES,
+    UNIFORM_VT_LEVELS,
+    UNIFORM_VT_TILE_SIZE,
+    UNIFORM_VT_BORDER,
+    UNIFORM_VT_PHYSICAL_SIZE,
+    UNIFORM_VT_LOD_BIAS,
+    UNIFORM_CULL_VIEW_PROJECTION,
+    UNIFORM_CULL_BOUNDS_MIN,
+    UNIFORM_CULL_BOUNDS_MAX,
+    UNIFORM_CULL_INSTANCES,
+    UNIFORM_CULL_COMMAND,
+    UNIFORM_HIZ_VIEW_PROJECTION,
+    UNIFORM_HIZ_LEVELS,
+    UNIFORM_HIZ_SOURCE_LEVEL,
+    UNIFORM_COUNT
+};
+
+// A linked GLSL program with its uniform locations looked up once, in a flat
+// table indexed by UniformId. The setters keep a copy of what each uniform
+// was last set to and skip the GL call when the value hasn't changed; they
+// need the program to be current (use()). Uniforms the program doesn't have
+// are ignored, so one set of calls works for every program.
+struct ShaderProgram {
+    ShaderProgram() = default;
+
+    ShaderProgram(const ShaderProgram&) = delete;
+    ShaderProgram& operator=(const ShaderProgram&) = delete;
+
+    // Compiles and links the program and reflects its active uniforms and
+    // uniform blocks. Prints the log and returns false on failure.
+    bool link(const char* vertexSource, const char* fragmentSource);
+
+    // The same for a compute program (GL 4.3)
+    bool linkCompute(const char* computeSource);
+
+    unsigned int id() const { return program; }
+    void use() const;
+
+    void set(UniformId uniform, int value);
+    void set(UniformId uniform, float value);
+    void set(UniformId uniform, const glm::ivec2& value);
+    void set(UniformId uniform, const glm::vec2& value);
+    void set(UniformId uniform, const glm::vec3& value);
+    void set(UniformId uniform, const glm::vec4& value);
+    void set(UniformId uniform, const glm::mat4& value);
+
+    // Index of a uniform block, or -1 when the program has none by that
+    // name. For setting up bindings, not per frame.
+    int blockIndex(const char* name) const;
+
+    // Connects the named block to a buffer binding point; false when the
+    // program doesn't have it
+    bool bindBlock(const char* name, unsigned int binding);
+
+private:
+    struct Uniform {
+        int location = -1;
+        size_t offset = 0; // of the last set value in values
+        size_t bytes = 0;
+    };
+
+    struct Block {
+        std::string name;
+        int index;
+    };
+
+    bool finishLink();
+    void reflect();
+    void addUniform(const std::string& name, unsigned int type, int elements, int location);
+    bool changed(UniformId uniform, const void* value, size_t bytes);
+
+    unsigned int program = 0;
+    Uniform uniforms[UNIFORM_COUNT];
+    std::vector<unsigned char> values; // starts zeroed, like the uniforms after linking
+    std::vector<Block> blocks;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include "simulation.h"
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const float orbitRadius = 17.0f;
+const float orbitSpeed = 0.5f;    // radians a second
+const glm::vec3 rotationCenter(150.0f * 0.2f, 6.0f, 150.0f * 0.2f);
+const float spacing = 0.2f;       // radians between neighbours
+const float maxJumpHeight = 2.0f;
+const float jumpDuration = 0.5f;
+const float jumpsPerSecond = 0.6f; // chance of starting a jump, per rabbit
+
+}
+
+FixedStepClock::FixedStepClock(double stepSeconds, int maxSteps)
+    : stepSeconds(stepSeconds), maxSteps(maxSteps) {
+}
+
+int FixedStepClock::advance(double elapsed) {
+    accumulated += std::max(elapsed, 0.0);
+    int steps = static_cast<int>(accumulated / stepSeconds);
+    if (steps > maxSteps) {
+        // too far behind to catch up: keep only the fraction of a step
+        steps = maxSteps;
+        accumulated = std::fmod(accumulated, stepSeconds);
+    } else {
+        accumulated -= steps * stepSeconds;
+    }
+    return steps;
+}
+
+float FixedStepClock::alpha() const {
+    return static_cast<float>(std::min(accumulated / stepSeconds, 1.0));
+}
+
+CrowdSimulation::CrowdSimulation(int rabbits, unsigned int seed)
+    : random(seed), chance(0.0f, 1.0f),
+      jumpTimers(rabbits, 0.0f), previousLift(rabbits, 0.0f), lift(rabbits, 0.0f) {
+}
+
+void CrowdSimulation::step(float dt) {
+    previousAngle = angle;
+    previousLift = lift;
+    angle += orbitSpeed * dt;
+    if (angle > glm::two_pi<float>()) {
+        // both wrap together, so blending between them still works
+        angle -= glm::two_pi<float>();
+        previousAngle -= glm::two_pi<float>();
+    }
+
+    for (int i = 0; i < size(); ++i) {
+        if (jumpTimers[i] <= 0.0f && chance(random) < jumpsPerSecond * dt)
+            jumpTimers[i] = jumpDuration;
+
+        if (jumpTimers[i] > 0.0f) {
+            float jumpProgress = 1.0f - jumpTimers[i] / jumpDuration;
+            lift[i] = maxJumpHeight * std::sin(jumpProgress * glm::pi<float>());
+            jumpTimers[i] = std::max(jumpTimers[i] - dt, 0.0f);
+        } else {
+            lift[i] = 0.0f;
+        }
+    }
+}
+
+// Faces the rabbit towards the centre of the ring, as it always has
+glm::mat4 CrowdSimulation::model(int i, float alpha) const {
+    float currentAngle = previousAngle + (angle - previousAngle) * alpha + i * spacing;
+    glm::vec3 position(rotationCenter.x + orbitRadius * std::cos(currentAngle),
+                       rotationCenter.y + previousLift[i] + (lift[i] - previousLift[i]) * alpha,
+                       rotationCenter.z + orbitRadius * std::sin(currentAngle));
+
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+    model = glm::scale(model, glm::vec3(2.5f, 2.5f, 2.5f));
+
+    glm::vec3 direction = glm::normalize(rotationCenter - position);
+    glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::vec3 right = glm::normalize(glm::cross(up, direction));
+    glm::vec3 adjustedUp = glm::cross(direction, right);
+
+    glm::mat4 rotation = glm::mat4(1.0f);
+    rotation[0] = glm::vec4(right, 0.0f);
+    rotation[1] = glm::vec4(adjustedUp, 0.0f);
+    rotation[2] = glm::vec4(direction, 0.0f);
+    return model * rotation;
+}
+
+bool CrowdSimulation::valid() const {
+    if (!std::isfinite(angle))
+        return false;
+    for (int i = 0; i < size(); ++i) {
+        if (!(jumpTimers[i] >= 0.0f && jumpTimers[i] <= jumpDuration))
+            return false;
+        if (!(lift[i] >= 0.0f && lift[i] <= maxJumpHeight))
+            return false;
+    }
+    return true;
+}
+
+double CrowdSimulation::checksum() const {
+    double sum = angle;
+    for (int i = 0; i < size(); ++i)
+        sum += jumpTimers[i] + lift[i];
+    return sum;
+}
@@ -0,0 +1,62 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <glm/glm.hpp>
+#include <random>
+#include <vector>
+
+// Turns real elapsed time into a whole number of fixed simulation steps. The
+// time left over carries into the next frame, and alpha() says how far it is
+// into the step after the last one run, for blending the last two states.
+struct FixedStepClock {
+    // maxSteps caps the steps run for one frame, so a long stall (loading,
+    // a breakpoint, a dragged window) drops time instead of piling up steps
+    explicit FixedStepClock(double stepSeconds, int maxSteps = 8);
+
+    // Adds elapsed real seconds and returns how many steps to run now
+    int advance(double elapsed);
+
+    double step() const { return stepSeconds; }
+
+    // 0 to 1: the leftover time as a fraction of a step
+    float alpha() const;
+
+private:
+    double stepSeconds;
+    int maxSteps;
+    double accumulated = 0.0;
+};
+
+// The rabbits circling the table: one angle for the whole ring, and a jump
+// that each rabbit starts at random. step() advances the state by a fixed
+// time and keeps the one before it, so model() can place a rabbit anywhere
+// between the two. Uses no GL, so it runs without a window too.
+struct CrowdSimulation {
+    CrowdSimulation(int rabbits, unsigned int seed);
+
+    void step(float dt);
+
+    int size() const { return static_cast<int>(lift.size()); }
+
+    // Model matrix of rabbit i, alpha of the way from the previous step's
+    // state to the current one
+    glm::mat4 model(int i, float alpha) const;
+
+    // False when the state has gone somewhere it never should (a NaN angle,
+    // a jump timer or height out of range); for soak runs
+    bool valid() const;
+
+    // Sum over the state, for comparing runs with the same seed
+    double checksum() const;
+
+private:
+    std::mt19937 random;
+    std::uniform_real_distribution<float> chance;
+    float previousAngle = 0.0f;
+    float angle = 0.0f;
+    std::vector<float> jumpTimers;     // seconds left of each rabbit's jump, 0 when not jumping
+    std::vector<float> previousLift;
+    std::vector<float> lift;           // height of each rabbit above the ring
+};
+
+#endif
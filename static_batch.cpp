@@ -0,0 +1,35 @@
+#include "static_batch.h"
+
+void StaticBatchBuilder::add(const std::vector<float>& vertices, const std::vector<unsigned int>& indices,
+                             const glm::mat4& model, int texture, const glm::vec4& color) {
+    Material* material = nullptr;
+    for (Material& candidate : materials)
+        if (candidate.texture == texture && candidate.color == color)
+            material = &candidate;
+    if (!material) {
+        materials.push_back({texture, color, {}, {}});
+        material = &materials.back();
+    }
+
+    unsigned int first = static_cast<unsigned int>(material->vertices.size() / 8);
+    glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+    for (size_t i = 0; i + 7 < vertices.size(); i += 8) {
+        glm::vec3 position = glm::vec3(model * glm::vec4(vertices[i], vertices[i + 1], vertices[i + 2], 1.0f));
+        glm::vec3 normal = normalMatrix * glm::vec3(vertices[i + 3], vertices[i + 4], vertices[i + 5]);
+        material->vertices.insert(material->vertices.end(), {position.x, position.y, position.z, normal.x, normal.y, normal.z,
+                                                             vertices[i + 6], vertices[i + 7]});
+    }
+    for (unsigned int index : indices)
+        material->indices.push_back(first + index);
+}
+
+std::vector<StaticBatch> StaticBatchBuilder::build(GeometryBuffer& geometry) const {
+    std::vector<StaticBatch> batches;
+    for (const Material& material : materials) {
+        if (material.indices.empty())
+            continue;
+        batches.push_back({material.texture, material.color, geometry.add(material.vertices, material.indices),
+                           computeBounds(material.vertices, material.indices)});
+    }
+    return batches;
+}
@@ -0,0 +1,42 @@
+#ifndef STATIC_BATCH_H
+#define STATIC_BATCH_H
+
+#include "frustum_cull.h"
+#include "geometry_buffer.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+// Every static mesh of one material, merged into a single mesh in world
+// space: drawn with an identity model matrix in one call
+struct StaticBatch {
+    int texture;
+    glm::vec4 color;
+    MeshRange mesh;
+    MeshBounds bounds;
+};
+
+// Collects meshes that never move, bakes each into world space with its
+// model matrix as it is added, and merges those with the same texture and
+// colour. Vertices are in the GeometryBuffer layout (8 floats); normals go
+// through the matrix's inverse transpose, as the vertex shader would take
+// them.
+struct StaticBatchBuilder {
+    void add(const std::vector<float>& vertices, const std::vector<unsigned int>& indices, const glm::mat4& model,
+             int texture, const glm::vec4& color);
+
+    // Appends a mesh per material to geometry, in the order the materials
+    // were first added
+    std::vector<StaticBatch> build(GeometryBuffer& geometry) const;
+
+private:
+    struct Material {
+        int texture;
+        glm::vec4 color;
+        std::vector<float> vertices;
+        std::vector<unsigned int> indices;
+    };
+
+    std::vector<Material> materials;
+};
+
+#endif
@@ -37,7 +37,7 @@
 
       - decode from memory or through FILE (define STBI_NO_STDIO to remove code)
       - decode from arbitrary I/O callbacks
-      - SIMD acceleration on x86/x64 (SSE2) and ARM (NEON)
+      - SIMD acceleration on x86/x64 (SSE2, AVX2 for JPEG) and ARM (NEON)
 
    Full documentation under "DOCUMENTATION" below.
 
@@ -429,6 +429,29 @@ STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in
 // for stbi_load_from_file, file pointer is left pointing immediately after image
 #endif
 
+// decode into memory the caller provides (such as a mapped upload buffer)
+// instead of a new allocation; size it from stbi_info as x*y*desired_channels
+// bytes. JPEGs are decoded straight into it, other formats are decoded as
+// usual and copied in. desired_channels can't be 0. Returns 0 on failure,
+// including when the image doesn't fit in out_size bytes.
+STBIDEF int stbi_load_from_memory_into(stbi_uc const *buffer, int len, stbi_uc *out, size_t out_size, int *x, int *y, int *channels_in_file, int desired_channels);
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_into            (char const *filename, stbi_uc *out, size_t out_size, int *x, int *y, int *channels_in_file, int desired_channels);
+#endif
+
+// JPEGs can also be decoded at 1/2, 1/4 or 1/8 size (scale_shift 1, 2 or 3):
+// every block goes through a reduced IDCT of only its lowest frequencies,
+// which is much cheaper than decoding at full size and filtering down. The
+// image comes out ceil(x / 2^scale_shift) by ceil(y / 2^scale_shift); other
+// formats ignore scale_shift. stbi_info_scaled reports the size a scaled
+// load will produce, to size out with.
+STBIDEF int stbi_info_from_memory_scaled(stbi_uc const *buffer, int len, int scale_shift, int *x, int *y, int *comp);
+STBIDEF int stbi_load_from_memory_into_scaled(stbi_uc const *buffer, int len, int scale_shift, stbi_uc *out, size_t out_size, int *x, int *y, int *channels_in_file, int desired_channels);
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_info_scaled          (char const *filename, int scale_shift, int *x, int *y, int *comp);
+STBIDEF int stbi_load_into_scaled     (char const *filename, int scale_shift, stbi_uc *out, size_t out_size, int *x, int *y, int *channels_in_file, int desired_channels);
+#endif
+
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp);
 #endif
@@ -524,6 +547,19 @@ STBIDEF void stbi_set_unpremultiply_on_load_thread(int flag_true_if_should_unpre
 STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert);
 STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
 
+// the JPEG decoder uses AVX2 kernels when the CPU supports them (results are
+// identical to the SSE2 ones); pass 0 to force the SSE2 path, e.g. to compare
+STBIDEF void stbi_jpeg_use_avx2(int flag_true_if_should_use);
+
+// lets the JPEG decoder spread large images over threads: fn must call
+// task(task_user, i) once for every i in [0, count), on any threads and in
+// any order, and return once they are all done. Scans with restart markers
+// are split at them and decoded in parallel; without them, entropy decoding
+// runs alongside the IDCT of the rows before. NULL (the default) decodes on
+// the calling thread.
+typedef void stbi_parallel_for_func(void *user, int count, void (*task)(void *task_user, int i), void *task_user);
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for_func *fn, void *user);
+
 // ZLIB client - used by PNG, available for other purposes
 
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -643,12 +679,14 @@ typedef unsigned short stbi__uint16;
 typedef   signed short stbi__int16;
 typedef unsigned int   stbi__uint32;
 typedef   signed int   stbi__int32;
+typedef unsigned __int64 stbi__uint64;
 #else
 #include <stdint.h>
 typedef uint16_t stbi__uint16;
 typedef int16_t  stbi__int16;
 typedef uint32_t stbi__uint32;
 typedef int32_t  stbi__int32;
+typedef uint64_t stbi__uint64;
 #endif
 
 // should produce compiler error if size is wrong
@@ -660,16 +698,6 @@ typedef unsigned char validate_uint32[sizeof(stbi__uint32)==4 ? 1 : -1];
 #define STBI_NOTUSED(v)  (void)sizeof(v)
 #endif
 
-#ifdef _MSC_VER
-#define STBI_HAS_LROTL
-#endif
-
-#ifdef STBI_HAS_LROTL
-   #define stbi_lrot(x,y)  _lrotl(x,y)
-#else
-   #define stbi_lrot(x,y)  (((x) << (y)) | ((x) >> (-(y) & 31)))
-#endif
-
 #if defined(STBI_MALLOC) && defined(STBI_FREE) && (defined(STBI_REALLOC) || defined(STBI_REALLOC_SIZED))
 // ok
 #elif !defined(STBI_MALLOC) && !defined(STBI_FREE) && !defined(STBI_REALLOC) && !defined(STBI_REALLOC_SIZED)
@@ -750,7 +778,7 @@ static int stbi__cpuid3(void)
 
 #define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    int info3 = stbi__cpuid3();
@@ -761,7 +789,7 @@ static int stbi__sse2_available(void)
 #else // assume GCC-style if not VC++
 #define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    // If we're even attempting to compile this on GCC/Clang, that means
@@ -774,6 +802,55 @@ static int stbi__sse2_available(void)
 #endif
 #endif
 
+// AVX2 versions of the JPEG kernels. They are compiled per function (no
+// -mavx2 needed) and picked at runtime when the CPU and OS support AVX2;
+// their output is bit-identical to the SSE2 kernels. #define STBI_NO_AVX2
+// to leave them out.
+#if defined(STBI_SSE2) && !defined(STBI_NO_AVX2) && !defined(STBI_NO_JPEG)
+#if defined(_MSC_VER) && _MSC_VER >= 1700
+#define STBI_AVX2
+#define STBI__AVX2_TARGET
+#elif defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#define STBI_AVX2
+#define STBI__AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+#ifdef STBI_AVX2
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+static int stbi__avx2_available(void)
+{
+   int info[4];
+   __cpuid(info,0);
+   if (info[0] < 7) return 0;
+   // AVX and OSXSAVE, then the OS has to save the YMM state on context switches
+   __cpuid(info,1);
+   if ((info[2] & 0x18000000) != 0x18000000) return 0;
+   if ((_xgetbv(0) & 6) != 6) return 0;
+   __cpuidex(info,7,0);
+   return ((info[1] >> 5) & 1) != 0;
+}
+#else
+#include <cpuid.h>
+static int stbi__avx2_available(void)
+{
+   unsigned int a,b,c,d,xcr0_lo,xcr0_hi;
+   if (__get_cpuid_max(0, 0) < 7) return 0;
+   // AVX and OSXSAVE, then the OS has to save the YMM state on context switches
+   __cpuid(1,a,b,c,d);
+   if ((c & 0x18000000) != 0x18000000) return 0;
+   __asm__ ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+   if ((xcr0_lo & 6) != 6) return 0;
+   __cpuid_count(7,0,a,b,c,d);
+   return ((b >> 5) & 1) != 0;
+}
+#endif
+
+static int stbi__jpeg_use_avx2 = 1;
+#endif
+
 // ARM NEON
 #if defined(STBI_NO_SIMD) && defined(STBI_NEON)
 #undef STBI_NEON
@@ -817,6 +894,13 @@ typedef struct
 
    stbi_uc *img_buffer, *img_buffer_end;
    stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+   // caller memory for the decoded image (stbi_load_into), or NULL
+   stbi_uc *out_buffer;
+   size_t out_buffer_size;
+
+   // JPEG downscale, see stbi_load_into_scaled
+   int jpeg_scale_shift;
 } stbi__context;
 
 
@@ -830,6 +914,9 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
    s->callback_already_read = 0;
    s->img_buffer = s->img_buffer_original = (stbi_uc *) buffer;
    s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *) buffer+len;
+   s->out_buffer = NULL;
+   s->out_buffer_size = 0;
+   s->jpeg_scale_shift = 0;
 }
 
 // initialize a callback-based context
@@ -843,6 +930,9 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
    s->img_buffer = s->img_buffer_original = s->buffer_start;
    stbi__refill_buffer(s);
    s->img_buffer_original_end = s->img_buffer_end;
+   s->out_buffer = NULL;
+   s->out_buffer_size = 0;
+   s->jpeg_scale_shift = 0;
 }
 
 #ifndef STBI_NO_STDIO
@@ -1058,6 +1148,17 @@ static void *stbi__malloc_mad3(int a, int b, int c, int add)
    return stbi__malloc(a*b*c + add);
 }
 
+#ifndef STBI_NO_JPEG
+// allocates a decoder's final image: the caller's buffer when stbi_load_into
+// passed one that is large enough, otherwise new memory
+static stbi_uc *stbi__malloc_output(stbi__context *s, int comp, int x, int y, int add)
+{
+   if (s->out_buffer && stbi__mad3sizes_valid(comp, x, y, add) && (size_t) comp*x*y + add <= s->out_buffer_size)
+      return s->out_buffer;
+   return (stbi_uc *) stbi__malloc_mad3(comp, x, y, add);
+}
+#endif
+
 #if !defined(STBI_NO_LINEAR) || !defined(STBI_NO_HDR) || !defined(STBI_NO_PNM)
 static void *stbi__malloc_mad4(int a, int b, int c, int d, int add)
 {
@@ -1134,6 +1235,24 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
                                          : stbi__vertically_flip_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+static stbi_parallel_for_func *stbi__parallel_for_fn = NULL;
+static void *stbi__parallel_for_user = NULL;
+
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for_func *fn, void *user)
+{
+   stbi__parallel_for_fn = fn;
+   stbi__parallel_for_user = user;
+}
+
+STBIDEF void stbi_jpeg_use_avx2(int flag_true_if_should_use)
+{
+#ifdef STBI_AVX2
+   stbi__jpeg_use_avx2 = flag_true_if_should_use;
+#else
+   STBI_NOTUSED(flag_true_if_should_use);
+#endif
+}
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1283,6 +1402,29 @@ static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x,
    return (unsigned char *) result;
 }
 
+static int stbi__load_into(stbi__context *s, stbi_uc *out, size_t out_size, int *x, int *y, int *comp, int req_comp)
+{
+   stbi_uc *result;
+   size_t size;
+   if (req_comp < 1 || req_comp > 4) return stbi__err("bad req_comp", "Internal error");
+
+   // decoders that can write the final image to out do so (see stbi__malloc_output)
+   s->out_buffer = out;
+   s->out_buffer_size = out_size;
+   result = stbi__load_and_postprocess_8bit(s,x,y,comp,req_comp);
+   if (result == NULL) return 0;
+   if (result == out) return 1;
+
+   size = (size_t) *x * *y * req_comp;
+   if (size > out_size) {
+      STBI_FREE(result);
+      return stbi__err("buffer too small", "Output buffer too small for image");
+   }
+   memcpy(out, result, size);
+   STBI_FREE(result);
+   return 1;
+}
+
 static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x, int *y, int *comp, int req_comp)
 {
    stbi__result_info ri;
@@ -1373,6 +1515,26 @@ STBIDEF stbi_uc *stbi_load(char const *filename, int *x, int *y, int *comp, int
    return result;
 }
 
+STBIDEF int stbi_load_into(char const *filename, stbi_uc *out, size_t out_size, int *x, int *y, int *comp, int req_comp)
+{
+   return stbi_load_into_scaled(filename,0,out,out_size,x,y,comp,req_comp);
+}
+
+STBIDEF int stbi_load_into_scaled(char const *filename, int scale_shift, stbi_uc *out, size_t out_size, int *x, int *y, int *comp, int req_comp)
+{
+   FILE *f;
+   stbi__context s;
+   int result;
+   if (scale_shift < 0 || scale_shift > 3) return stbi__err("bad scale", "scale_shift must be 0 to 3");
+   f = stbi__fopen(filename, "rb");
+   if (!f) return stbi__err("can't fopen", "Unable to open file");
+   stbi__start_file(&s,f);
+   s.jpeg_scale_shift = scale_shift;
+   result = stbi__load_into(&s,out,out_size,x,y,comp,req_comp);
+   fclose(f);
+   return result;
+}
+
 STBIDEF stbi_uc *stbi_load_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
 {
    unsigned char *result;
@@ -1440,6 +1602,20 @@ STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *u
    return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
 }
 
+STBIDEF int stbi_load_from_memory_into(stbi_uc const *buffer, int len, stbi_uc *out, size_t out_size, int *x, int *y, int *comp, int req_comp)
+{
+   return stbi_load_from_memory_into_scaled(buffer,len,0,out,out_size,x,y,comp,req_comp);
+}
+
+STBIDEF int stbi_load_from_memory_into_scaled(stbi_uc const *buffer, int len, int scale_shift, stbi_uc *out, size_t out_size, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__context s;
+   if (scale_shift < 0 || scale_shift > 3) return stbi__err("bad scale", "scale_shift must be 0 to 3");
+   stbi__start_mem(&s,buffer,len);
+   s.jpeg_scale_shift = scale_shift;
+   return stbi__load_into(&s,out,out_size,x,y,comp,req_comp);
+}
+
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp)
 {
@@ -1752,10 +1928,58 @@ static stbi_uc stbi__compute_y(int r, int g, int b)
 #if defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM)
 // nothing
 #else
+#ifdef STBI_AVX2
+// expands 8 pixels per step with a byte shuffle in each 128-bit lane; each
+// step reads 28 bytes for the 24 it uses, so it stops early enough to stay
+// inside src. Returns the number of pixels done.
+STBI__AVX2_TARGET static int stbi__rgb_to_rgba_avx2(stbi_uc *dest, stbi_uc const *src, int count)
+{
+   const __m256i shuffle = _mm256_setr_epi8(0,1,2,-1, 3,4,5,-1, 6,7,8,-1, 9,10,11,-1,
+                                            0,1,2,-1, 3,4,5,-1, 6,7,8,-1, 9,10,11,-1);
+   const __m256i alpha = _mm256_set1_epi32((int) 0xff000000u);
+   int i;
+   for (i=0; i + 10 <= count; i += 8) {
+      __m128i lo = _mm_loadu_si128((__m128i const *) (src + i*3));
+      __m128i hi = _mm_loadu_si128((__m128i const *) (src + i*3 + 12));
+      __m256i rgb = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+      _mm256_storeu_si256((__m256i *) (dest + i*4), _mm256_or_si256(_mm256_shuffle_epi8(rgb, shuffle), alpha));
+   }
+   return i;
+}
+#endif
+
+// whether stbi__rgb_to_rgba can use SIMD; checked once per image, not per row
+static int stbi__rgb_to_rgba_simd(void)
+{
+#ifdef STBI_AVX2
+   return stbi__avx2_available();
+#else
+   return 0;
+#endif
+}
+
+// RGB to RGBA with alpha 255; dest and src must not overlap
+static void stbi__rgb_to_rgba(stbi_uc *dest, stbi_uc const *src, int count, int use_simd)
+{
+   int i = 0;
+#ifdef STBI_AVX2
+   if (use_simd) i = stbi__rgb_to_rgba_avx2(dest, src, count);
+#else
+   STBI_NOTUSED(use_simd);
+#endif
+   for (; i < count; ++i) {
+      dest[i*4+0] = src[i*3+0];
+      dest[i*4+1] = src[i*3+1];
+      dest[i*4+2] = src[i*3+2];
+      dest[i*4+3] = 255;
+   }
+}
+
 static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y)
 {
    int i,j;
    unsigned char *good;
+   int use_simd = img_n == 3 && req_comp == 4 && stbi__rgb_to_rgba_simd();
 
    if (req_comp == img_n) return data;
    STBI_ASSERT(req_comp >= 1 && req_comp <= 4);
@@ -1770,6 +1994,11 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
       unsigned char *src  = data + j * x * img_n   ;
       unsigned char *dest = good + j * x * req_comp;
 
+      if (img_n == 3 && req_comp == 4) {
+         stbi__rgb_to_rgba(dest, src, x, use_simd);
+         continue;
+      }
+
       #define STBI__COMBO(a,b)  ((a)*8+(b))
       #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
       // convert source image with img_n components to one with req_comp components;
@@ -1933,11 +2162,13 @@ static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
 #ifndef STBI_NO_JPEG
 
 // huffman decoding acceleration
-#define FAST_BITS   9  // larger handles more cases; smaller stomps less cache
+#define FAST_BITS   10 // larger handles more cases; smaller stomps less cache
 
 typedef struct
 {
    stbi_uc  fast[1 << FAST_BITS];
+   // symbol and its extra bits decoded in one lookup, see stbi__build_fast_sym
+   stbi__int32 fast_sym[1 << FAST_BITS];
    // weirdly, repacking this into AoS is a 10% speed loss, instead of a win
    stbi__uint16 code[256];
    stbi_uc  values[256];
@@ -1952,7 +2183,6 @@ typedef struct
    stbi__huffman huff_dc[4];
    stbi__huffman huff_ac[4];
    stbi__uint16 dequant[4][64];
-   stbi__int16 fast_ac[4][1 << FAST_BITS];
 
 // sizes for components, interleaved MCUs
    int img_h_max, img_v_max;
@@ -1976,7 +2206,7 @@ typedef struct
       int      coeff_w, coeff_h; // number of 8x8 coefficient blocks
    } img_comp[4];
 
-   stbi__uint32   code_buffer; // jpeg entropy-coded buffer
+   stbi__uint64   code_buffer; // jpeg entropy-coded buffer, msb first
    int            code_bits;   // number of valid bits
    unsigned char  marker;      // marker seen while filling entropy buffer
    int            nomore;      // flag if we saw a marker so must stop
@@ -1994,6 +2224,8 @@ typedef struct
    int scan_n, order[4];
    int restart_interval, todo;
 
+   int scale_shift; // blocks decode to (8 >> scale_shift) pixels square
+
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
    void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
@@ -2045,28 +2277,33 @@ static int stbi__build_huffman(stbi__huffman *h, int *count)
    return 1;
 }
 
-// build a table that decodes both magnitude and value of small ACs in
-// one go.
-static void stbi__build_fast_ac(stbi__int16 *fast_ac, stbi__huffman *h)
+// build a table that decodes a symbol together with the extra bits that
+// follow it, when both fit in FAST_BITS. entries are
+//    value << 16 | symbol << 8 | total length
+// with 0 for "not covered". symbols without extra bits (DC 0, EOB, ZRL,
+// EOB runs) are stored with value 0 and left to the caller to interpret.
+// DC tables only cover symbols 0..15 so anything else takes the checked path.
+static void stbi__build_fast_sym(stbi__huffman *h, int is_dc)
 {
    int i;
    for (i=0; i < (1 << FAST_BITS); ++i) {
       stbi_uc fast = h->fast[i];
-      fast_ac[i] = 0;
+      h->fast_sym[i] = 0;
       if (fast < 255) {
          int rs = h->values[fast];
-         int run = (rs >> 4) & 15;
          int magbits = rs & 15;
          int len = h->size[fast];
 
-         if (magbits && len + magbits <= FAST_BITS) {
+         if (is_dc && rs > 15) continue;
+         if (len + magbits <= FAST_BITS) {
             // magnitude code followed by receive_extend code
-            int k = ((i << len) & ((1 << FAST_BITS) - 1)) >> (FAST_BITS - magbits);
-            int m = 1 << (magbits - 1);
-            if (k < m) k += (~0U << magbits) + 1;
-            // if the result is small enough, we can fit it in fast_ac table
-            if (k >= -128 && k <= 127)
-               fast_ac[i] = (stbi__int16) ((k * 256) + (run * 16) + (len + magbits));
+            int k = 0;
+            if (magbits) {
+               int m = 1 << (magbits - 1);
+               k = ((i << len) & ((1 << FAST_BITS) - 1)) >> (FAST_BITS - magbits);
+               if (k < m) k += (~0U << magbits) + 1;
+            }
+            h->fast_sym[i] = (stbi__int32) (k * 65536 + (rs << 8) + (len + magbits));
          }
       }
    }
@@ -2074,6 +2311,23 @@ static void stbi__build_fast_ac(stbi__int16 *fast_ac, stbi__huffman *h)
 
 static void stbi__grow_buffer_unsafe(stbi__jpeg *j)
 {
+   // fast path: when the next eight bytes hold no 0xff (so no stuffed zero
+   // and no marker) append as many whole bytes as fit without branching per
+   // byte. the byte straddling the end of the buffer is partly merged too;
+   // it gets merged again with the same bits next time, which is harmless.
+   if (!j->nomore && j->s->img_buffer_end - j->s->img_buffer >= 8) {
+      stbi_uc *p = j->s->img_buffer;
+      stbi__uint64 v = ((stbi__uint64) p[0] << 56) | ((stbi__uint64) p[1] << 48) | ((stbi__uint64) p[2] << 40) | ((stbi__uint64) p[3] << 32)
+                     | ((stbi__uint64) p[4] << 24) | ((stbi__uint64) p[5] << 16) | ((stbi__uint64) p[6] <<  8) |  (stbi__uint64) p[7];
+      stbi__uint64 t = ~v;
+      if (((t - 0x0101010101010101ull) & ~t & 0x8080808080808080ull) == 0) {
+         j->code_buffer |= v >> j->code_bits;
+         j->s->img_buffer += (63 - j->code_bits) >> 3;
+         j->code_bits |= 56;
+         return;
+      }
+   }
+
    do {
       unsigned int b = j->nomore ? 0 : stbi__get8(j->s);
       if (b == 0xff) {
@@ -2085,14 +2339,11 @@ static void stbi__grow_buffer_unsafe(stbi__jpeg *j)
             return;
          }
       }
-      j->code_buffer |= b << (24 - j->code_bits);
+      j->code_buffer |= (stbi__uint64) b << (56 - j->code_bits);
       j->code_bits += 8;
-   } while (j->code_bits <= 24);
+   } while (j->code_bits <= 56);
 }
 
-// (1 << n) - 1
-static const stbi__uint32 stbi__bmask[17]={0,1,3,7,15,31,63,127,255,511,1023,2047,4095,8191,16383,32767,65535};
-
 // decode a jpeg huffman value from the bitstream
 stbi_inline static int stbi__jpeg_huff_decode(stbi__jpeg *j, stbi__huffman *h)
 {
@@ -2103,7 +2354,7 @@ stbi_inline static int stbi__jpeg_huff_decode(stbi__jpeg *j, stbi__huffman *h)
 
    // look at the top FAST_BITS and determine what symbol ID it is,
    // if the code is <= FAST_BITS
-   c = (j->code_buffer >> (32 - FAST_BITS)) & ((1 << FAST_BITS)-1);
+   c = (int) (j->code_buffer >> (64 - FAST_BITS));
    k = h->fast[c];
    if (k < 255) {
       int s = h->size[k];
@@ -2120,7 +2371,7 @@ stbi_inline static int stbi__jpeg_huff_decode(stbi__jpeg *j, stbi__huffman *h)
    // end; in other words, regardless of the number of bits, it
    // wants to be compared against something shifted to have 16;
    // that way we don't need to shift inside the loop.
-   temp = j->code_buffer >> 16;
+   temp = (unsigned int) (j->code_buffer >> 48);
    for (k=FAST_BITS+1 ; ; ++k)
       if (temp < h->maxcode[k])
          break;
@@ -2134,10 +2385,10 @@ stbi_inline static int stbi__jpeg_huff_decode(stbi__jpeg *j, stbi__huffman *h)
       return -1;
 
    // convert the huffman code to the symbol id
-   c = ((j->code_buffer >> (32 - k)) & stbi__bmask[k]) + h->delta[k];
+   c = (int) (j->code_buffer >> (64 - k)) + h->delta[k];
    if(c < 0 || c >= 256) // symbol id out of bounds!
        return -1;
-   STBI_ASSERT((((j->code_buffer) >> (32 - h->size[c])) & stbi__bmask[h->size[c]]) == h->code[c]);
+   STBI_ASSERT(((j->code_buffer) >> (64 - h->size[c])) == h->code[c]);
 
    // convert the id to a symbol
    j->code_bits -= k;
@@ -2157,10 +2408,9 @@ stbi_inline static int stbi__extend_receive(stbi__jpeg *j, int n)
    if (j->code_bits < n) stbi__grow_buffer_unsafe(j);
    if (j->code_bits < n) return 0; // ran out of bits from stream, return 0s intead of continuing
 
-   sgn = j->code_buffer >> 31; // sign bit always in MSB; 0 if MSB clear (positive), 1 if MSB set (negative)
-   k = stbi_lrot(j->code_buffer, n);
-   j->code_buffer = k & ~stbi__bmask[n];
-   k &= stbi__bmask[n];
+   sgn = (int) (j->code_buffer >> 63); // sign bit always in MSB; 0 if MSB clear (positive), 1 if MSB set (negative)
+   k = (unsigned int) (j->code_buffer >> (64 - n));
+   j->code_buffer <<= n;
    j->code_bits -= n;
    return k + (stbi__jbias[n] & (sgn - 1));
 }
@@ -2171,22 +2421,21 @@ stbi_inline static int stbi__jpeg_get_bits(stbi__jpeg *j, int n)
    unsigned int k;
    if (j->code_bits < n) stbi__grow_buffer_unsafe(j);
    if (j->code_bits < n) return 0; // ran out of bits from stream, return 0s intead of continuing
-   k = stbi_lrot(j->code_buffer, n);
-   j->code_buffer = k & ~stbi__bmask[n];
-   k &= stbi__bmask[n];
+   k = (unsigned int) (j->code_buffer >> (64 - n));
+   j->code_buffer <<= n;
    j->code_bits -= n;
    return k;
 }
 
 stbi_inline static int stbi__jpeg_get_bit(stbi__jpeg *j)
 {
-   unsigned int k;
+   int k;
    if (j->code_bits < 1) stbi__grow_buffer_unsafe(j);
    if (j->code_bits < 1) return 0; // ran out of bits from stream, return 0s intead of continuing
-   k = j->code_buffer;
+   k = (int) (j->code_buffer >> 63);
    j->code_buffer <<= 1;
    --j->code_bits;
-   return k & 0x80000000;
+   return k;
 }
 
 // given a value that's at position X in the zigzag stream,
@@ -2207,19 +2456,25 @@ static const stbi_uc stbi__jpeg_dezigzag[64+15] =
 };
 
 // decode one 64-entry block--
-static int stbi__jpeg_decode_block(stbi__jpeg *j, short data[64], stbi__huffman *hdc, stbi__huffman *hac, stbi__int16 *fac, int b, stbi__uint16 *dequant)
+static int stbi__jpeg_decode_block(stbi__jpeg *j, short data[64], stbi__huffman *hdc, stbi__huffman *hac, int b, stbi__uint16 *dequant)
 {
    int diff,dc,k;
    int t;
 
    if (j->code_bits < 16) stbi__grow_buffer_unsafe(j);
-   t = stbi__jpeg_huff_decode(j, hdc);
-   if (t < 0 || t > 15) return stbi__err("bad huffman code","Corrupt JPEG");
+   t = hdc->fast_sym[j->code_buffer >> (64 - FAST_BITS)];
+   if (t && (t & 255) <= j->code_bits) { // fast-DC path
+      j->code_buffer <<= t & 255;
+      j->code_bits -= t & 255;
+      diff = t >> 16;
+   } else {
+      t = stbi__jpeg_huff_decode(j, hdc);
+      if (t < 0 || t > 15) return stbi__err("bad huffman code","Corrupt JPEG");
+      diff = t ? stbi__extend_receive(j, t) : 0;
+   }
 
    // 0 all the ac values now so we can do it 32-bits at a time
    memset(data,0,64*sizeof(data[0]));
-
-   diff = t ? stbi__extend_receive(j, t) : 0;
    if (!stbi__addints_valid(j->img_comp[b].dc_pred, diff)) return stbi__err("bad delta","Corrupt JPEG");
    dc = j->img_comp[b].dc_pred + diff;
    j->img_comp[b].dc_pred = dc;
@@ -2232,17 +2487,22 @@ static int stbi__jpeg_decode_block(stbi__jpeg *j, short data[64], stbi__huffman
       unsigned int zig;
       int c,r,s;
       if (j->code_bits < 16) stbi__grow_buffer_unsafe(j);
-      c = (j->code_buffer >> (32 - FAST_BITS)) & ((1 << FAST_BITS)-1);
-      r = fac[c];
+      c = (int) (j->code_buffer >> (64 - FAST_BITS));
+      r = hac->fast_sym[c];
       if (r) { // fast-AC path
-         k += (r >> 4) & 15; // run
-         s = r & 15; // combined length
+         s = r & 255; // combined length
          if (s > j->code_bits) return stbi__err("bad huffman code", "Combined length longer than code bits available");
          j->code_buffer <<= s;
          j->code_bits -= s;
-         // decode into unzigzag'd location
-         zig = stbi__jpeg_dezigzag[k++];
-         data[zig] = (short) ((r >> 8) * dequant[zig]);
+         if ((r & 0xf00) == 0) {
+            if ((r & 0xff00) != 0xf000) break; // end block
+            k += 16;
+         } else {
+            k += (r >> 12) & 15; // run
+            // decode into unzigzag'd location
+            zig = stbi__jpeg_dezigzag[k++];
+            data[zig] = (short) ((r >> 16) * dequant[zig]);
+         }
       } else {
          int rs = stbi__jpeg_huff_decode(j, hac);
          if (rs < 0) return stbi__err("bad huffman code","Corrupt JPEG");
@@ -2292,7 +2552,7 @@ static int stbi__jpeg_decode_block_prog_dc(stbi__jpeg *j, short data[64], stbi__
 
 // @OPTIMIZE: store non-zigzagged during the decode passes,
 // and only de-zigzag when dequantizing
-static int stbi__jpeg_decode_block_prog_ac(stbi__jpeg *j, short data[64], stbi__huffman *hac, stbi__int16 *fac)
+static int stbi__jpeg_decode_block_prog_ac(stbi__jpeg *j, short data[64], stbi__huffman *hac)
 {
    int k;
    if (j->spec_start == 0) return stbi__err("can't merge dc and ac", "Corrupt JPEG");
@@ -2310,16 +2570,16 @@ static int stbi__jpeg_decode_block_prog_ac(stbi__jpeg *j, short data[64], stbi__
          unsigned int zig;
          int c,r,s;
          if (j->code_bits < 16) stbi__grow_buffer_unsafe(j);
-         c = (j->code_buffer >> (32 - FAST_BITS)) & ((1 << FAST_BITS)-1);
-         r = fac[c];
-         if (r) { // fast-AC path
-            k += (r >> 4) & 15; // run
-            s = r & 15; // combined length
+         c = (int) (j->code_buffer >> (64 - FAST_BITS));
+         r = hac->fast_sym[c];
+         if (r && (r & 0xf00)) { // fast-AC path; EOB runs and ZRL go the slow way
+            k += (r >> 12) & 15; // run
+            s = r & 255; // combined length
             if (s > j->code_bits) return stbi__err("bad huffman code", "Combined length longer than code bits available");
             j->code_buffer <<= s;
             j->code_bits -= s;
             zig = stbi__jpeg_dezigzag[k++];
-            data[zig] = (short) ((r >> 8) * (1 << shift));
+            data[zig] = (short) ((r >> 16) * (1 << shift));
          } else {
             int rs = stbi__jpeg_huff_decode(j, hac);
             if (rs < 0) return stbi__err("bad huffman code","Corrupt JPEG");
@@ -2523,6 +2783,63 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
    }
 }
 
+// reduced IDCTs for decoding at 1/2 and 1/4 size: an n-point IDCT of the
+// n lowest frequencies in each direction samples the block's 8-point
+// reconstruction at the centres of its n x n output pixels. Same fixed point
+// as stbi__idct_block: the column pass keeps 2 extra bits, the row pass
+// folds in the level shift and rounding.
+#define stbi__idct4_1d(s0,s1,s2,s3) \
+   int e0 = ((s0) + (s2)) * stbi__f2f(0.35355339f); \
+   int e1 = ((s0) - (s2)) * stbi__f2f(0.35355339f); \
+   int o0 = (s1) * stbi__f2f(0.46193977f) + (s3) * stbi__f2f(0.19134172f); \
+   int o1 = (s1) * stbi__f2f(0.19134172f) - (s3) * stbi__f2f(0.46193977f);
+
+static void stbi__idct_reduced(stbi_uc *out, int out_stride, short data[64], int n)
+{
+   int i, val[16], *v=val;
+
+   if (n == 1) {
+      // 1/8 size: the DC term alone is the block average
+      out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+      return;
+   }
+
+   if (n == 2) {
+      // the 2-point transform is a sum and a difference, both times c
+      int c0 = (data[0] + data[8] ) * stbi__f2f(0.35355339f);
+      int c1 = (data[0] - data[8] ) * stbi__f2f(0.35355339f);
+      int d0 = (data[1] + data[9] ) * stbi__f2f(0.35355339f);
+      int d1 = (data[1] - data[9] ) * stbi__f2f(0.35355339f);
+      int bias = (128 << 14) + 8192;
+      v[0] = (c0 + 512) >> 10; v[1] = (d0 + 512) >> 10;
+      v[2] = (c1 + 512) >> 10; v[3] = (d1 + 512) >> 10;
+      for (i=0; i < 2; ++i, v+=2, out+=out_stride) {
+         out[0] = stbi__clamp(((v[0] + v[1]) * stbi__f2f(0.35355339f) + bias) >> 14);
+         out[1] = stbi__clamp(((v[0] - v[1]) * stbi__f2f(0.35355339f) + bias) >> 14);
+      }
+      return;
+   }
+
+   // columns: 4096 scale in, 4 out
+   for (i=0; i < 4; ++i) {
+      stbi__idct4_1d(data[i], data[8+i], data[16+i], data[24+i])
+      v[i]    = (e0 + o0 + 512) >> 10;
+      v[12+i] = (e0 - o0 + 512) >> 10;
+      v[4+i]  = (e1 + o1 + 512) >> 10;
+      v[8+i]  = (e1 - o1 + 512) >> 10;
+   }
+   // rows: 16384 scale in, with +128 and rounding
+   for (i=0; i < 4; ++i, v+=4, out+=out_stride) {
+      stbi__idct4_1d(v[0], v[1], v[2], v[3])
+      e0 += (128 << 14) + 8192;
+      e1 += (128 << 14) + 8192;
+      out[0] = stbi__clamp((e0 + o0) >> 14);
+      out[3] = stbi__clamp((e0 - o0) >> 14);
+      out[1] = stbi__clamp((e1 + o1) >> 14);
+      out[2] = stbi__clamp((e1 - o1) >> 14);
+   }
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2704,6 +3021,169 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 
 #endif // STBI_SSE2
 
+#ifdef STBI_AVX2
+// avx2 version of the sse2 IDCT above. the 16-bit parts (adds, transposes,
+// final packing) are unchanged; every 32-bit stage works on a whole row per
+// ymm register instead of two halves, so results are bit-identical.
+STBI__AVX2_TARGET static void stbi__idct_avx2(stbi_uc *out, int out_stride, short data[64])
+{
+   __m128i row0, row1, row2, row3, row4, row5, row6, row7;
+   __m128i tmp;
+
+   // dot product constant: even elems=x, odd elems=y
+   #define dct_const(x,y)  _mm256_setr_epi16((x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y))
+
+   // out(0) = c0[even]*x + c0[odd]*y   (c0, x, y 16-bit, out 32-bit)
+   // out(1) = c1[even]*x + c1[odd]*y
+   #define dct_rot(out0,out1, x,y,c0,c1) \
+      __m256i c0##xy = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16((x),(y))), _mm_unpackhi_epi16((x),(y)), 1); \
+      __m256i out0 = _mm256_madd_epi16(c0##xy, c0); \
+      __m256i out1 = _mm256_madd_epi16(c0##xy, c1)
+
+   // out = in << 12  (in 16-bit, out 32-bit)
+   #define dct_widen(out, in) \
+      __m256i out = _mm256_slli_epi32(_mm256_cvtepi16_epi32(in), 12)
+
+   // butterfly a/b, add bias, then shift by "s" and pack
+   #define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         __m256i abiased = _mm256_add_epi32(a, bias); \
+         __m256i sum = _mm256_srai_epi32(_mm256_add_epi32(abiased, b), s); \
+         __m256i dif = _mm256_srai_epi32(_mm256_sub_epi32(abiased, b), s); \
+         __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(sum, dif), 0xd8); \
+         out0 = _mm256_castsi256_si128(packed); \
+         out1 = _mm256_extracti128_si256(packed, 1); \
+      }
+
+   // 8-bit interleave step (for transposes)
+   #define dct_interleave8(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi8(a, b); \
+      b = _mm_unpackhi_epi8(tmp, b)
+
+   // 16-bit interleave step (for transposes)
+   #define dct_interleave16(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi16(a, b); \
+      b = _mm_unpackhi_epi16(tmp, b)
+
+   #define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         __m128i sum04 = _mm_add_epi16(row0, row4); \
+         __m128i dif04 = _mm_sub_epi16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         __m256i x0 = _mm256_add_epi32(t0e, t3e); \
+         __m256i x3 = _mm256_sub_epi32(t0e, t3e); \
+         __m256i x1 = _mm256_add_epi32(t1e, t2e); \
+         __m256i x2 = _mm256_sub_epi32(t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         __m128i sum17 = _mm_add_epi16(row1, row7); \
+         __m128i sum35 = _mm_add_epi16(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         __m256i x4 = _mm256_add_epi32(y0o, y4o); \
+         __m256i x5 = _mm256_add_epi32(y1o, y5o); \
+         __m256i x6 = _mm256_add_epi32(y2o, y5o); \
+         __m256i x7 = _mm256_add_epi32(y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+   __m256i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+   __m256i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f( 0.765366865f), stbi__f2f(0.5411961f));
+   __m256i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+   __m256i rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+   __m256i rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f( 0.298631336f), stbi__f2f(-1.961570560f));
+   __m256i rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f( 3.072711026f));
+   __m256i rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f( 2.053119869f), stbi__f2f(-0.390180644f));
+   __m256i rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f( 1.501321110f));
+
+   // rounding biases in column/row passes, see stbi__idct_block for explanation.
+   __m256i bias_0 = _mm256_set1_epi32(512);
+   __m256i bias_1 = _mm256_set1_epi32(65536 + (128<<17));
+
+   // load
+   row0 = _mm_load_si128((const __m128i *) (data + 0*8));
+   row1 = _mm_load_si128((const __m128i *) (data + 1*8));
+   row2 = _mm_load_si128((const __m128i *) (data + 2*8));
+   row3 = _mm_load_si128((const __m128i *) (data + 3*8));
+   row4 = _mm_load_si128((const __m128i *) (data + 4*8));
+   row5 = _mm_load_si128((const __m128i *) (data + 5*8));
+   row6 = _mm_load_si128((const __m128i *) (data + 6*8));
+   row7 = _mm_load_si128((const __m128i *) (data + 7*8));
+
+   // column pass
+   dct_pass(bias_0, 10);
+
+   {
+      // 16bit 8x8 transpose pass 1
+      dct_interleave16(row0, row4);
+      dct_interleave16(row1, row5);
+      dct_interleave16(row2, row6);
+      dct_interleave16(row3, row7);
+
+      // transpose pass 2
+      dct_interleave16(row0, row2);
+      dct_interleave16(row1, row3);
+      dct_interleave16(row4, row6);
+      dct_interleave16(row5, row7);
+
+      // transpose pass 3
+      dct_interleave16(row0, row1);
+      dct_interleave16(row2, row3);
+      dct_interleave16(row4, row5);
+      dct_interleave16(row6, row7);
+   }
+
+   // row pass
+   dct_pass(bias_1, 17);
+
+   {
+      // pack
+      __m128i p0 = _mm_packus_epi16(row0, row1); // a0a1a2a3...a7b0b1b2b3...b7
+      __m128i p1 = _mm_packus_epi16(row2, row3);
+      __m128i p2 = _mm_packus_epi16(row4, row5);
+      __m128i p3 = _mm_packus_epi16(row6, row7);
+
+      // 8bit 8x8 transpose pass 1
+      dct_interleave8(p0, p2); // a0e0a1e1...
+      dct_interleave8(p1, p3); // c0g0c1g1...
+
+      // transpose pass 2
+      dct_interleave8(p0, p1); // a0c0e0g0...
+      dct_interleave8(p2, p3); // b0d0f0h0...
+
+      // transpose pass 3
+      dct_interleave8(p0, p2); // a0b0c0d0...
+      dct_interleave8(p1, p3); // a4b4c4d4...
+
+      // store
+      _mm_storel_epi64((__m128i *) out, p0); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p0, 0x4e)); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, p2); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p2, 0x4e)); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, p1); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p1, 0x4e)); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, p3); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p3, 0x4e));
+   }
+
+#undef dct_const
+#undef dct_rot
+#undef dct_widen
+#undef dct_bfly32o
+#undef dct_interleave8
+#undef dct_interleave16
+#undef dct_pass
+}
+#endif // STBI_AVX2
+
 #ifdef STBI_NEON
 
 // NEON integer IDCT. should produce bit-identical
@@ -2946,67 +3426,290 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
-static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
+// IDCTs block (bx,by) of component n into its plane
+static void stbi__jpeg_idct_block(stbi__jpeg *z, int n, int bx, int by, short data[64])
 {
-   stbi__jpeg_reset(z);
-   if (!z->progressive) {
-      if (z->scan_n == 1) {
-         int i,j;
-         STBI_SIMD_ALIGN(short, data[64]);
-         int n = z->order[0];
-         // non-interleaved data, we just need to process one block at a time,
-         // in trivial scanline order
-         // number of blocks to do just depends on how many actual "pixels" this
-         // component has, independent of interleaved MCU blocking and such
-         int w = (z->img_comp[n].x+7) >> 3;
-         int h = (z->img_comp[n].y+7) >> 3;
-         for (j=0; j < h; ++j) {
-            for (i=0; i < w; ++i) {
+   int size = 8 >> z->scale_shift;
+   stbi_uc *out = z->img_comp[n].data + z->img_comp[n].w2*by*size + bx*size;
+   if (z->scale_shift)
+      stbi__idct_reduced(out, z->img_comp[n].w2, data, size);
+   else
+      z->idct_block_kernel(out, z->img_comp[n].w2, data);
+}
+
+// runs task for [0, count) through stbi_set_parallel_for's hook, or in
+// order on this thread without one
+static void stbi__parallel_for(int count, void (*task)(void *, int), void *task_user)
+{
+   int i;
+   if (stbi__parallel_for_fn && count > 1)
+      stbi__parallel_for_fn(stbi__parallel_for_user, count, task, task_user);
+   else
+      for (i=0; i < count; ++i)
+         task(task_user, i);
+}
+
+static int stbi__min_int(int a, int b) { return a < b ? a : b; }
+static int stbi__max_int(int a, int b) { return a > b ? a : b; }
+
+// scans smaller than this many blocks aren't worth handing to threads
+#define STBI__PARALLEL_MIN_BLOCKS  4096
+
+// the MCUs of a baseline scan: interleaved ones, or for a non-interleaved
+// scan single blocks of its component in raster order
+static int stbi__scan_mcus(stbi__jpeg *z, int *per_row, int *blocks_per_mcu)
+{
+   int k;
+   if (z->scan_n == 1) {
+      int n = z->order[0];
+      *per_row = (z->img_comp[n].x+7) >> 3;
+      *blocks_per_mcu = 1;
+      return *per_row * ((z->img_comp[n].y+7) >> 3);
+   }
+   *per_row = z->img_mcu_x;
+   *blocks_per_mcu = 0;
+   for (k=0; k < z->scan_n; ++k)
+      *blocks_per_mcu += z->img_comp[z->order[k]].h * z->img_comp[z->order[k]].v;
+   return z->img_mcu_x * z->img_mcu_y;
+}
+
+// decodes MCUs [first, first+count) of a baseline scan, counting down the
+// restart interval as it goes. Blocks are transformed straight into the
+// planes, or with coeff set stored there in decode order (dequantized) for
+// stbi__idct_mcus. Returns 0 on error, and 2 when a restart marker is
+// missing: the rest of the scan is skipped, so we get corrupt data rather
+// than no data
+static int stbi__decode_mcus(stbi__jpeg *z, int first, int count, short *coeff)
+{
+   int m,k,x,y,per_row,blocks;
+   STBI_SIMD_ALIGN(short, data[64]);
+   stbi__scan_mcus(z, &per_row, &blocks);
+   for (m=first; m < first+count; ++m) {
+      int i = m % per_row, j = m / per_row;
+      // scan an mcu... process scan_n components in order; for interleaved
+      // scans that's determined by the basic H and V of each component
+      for (k=0; k < z->scan_n; ++k) {
+         int n = z->order[k];
+         int h = z->scan_n == 1 ? 1 : z->img_comp[n].h;
+         int v = z->scan_n == 1 ? 1 : z->img_comp[n].v;
+         for (y=0; y < v; ++y) {
+            for (x=0; x < h; ++x) {
+               short *out = coeff ? coeff : data;
                int ha = z->img_comp[n].ha;
-               if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
-               // every data block is an MCU, so countdown the restart interval
-               if (--z->todo <= 0) {
-                  if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-                  // if it's NOT a restart, then just bail, so we get corrupt data
-                  // rather than no data
-                  if (!STBI__RESTART(z->marker)) return 1;
-                  stbi__jpeg_reset(z);
-               }
+               if (!stbi__jpeg_decode_block(z, out, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, n, z->dequant[z->img_comp[n].tq])) return 0;
+               if (coeff)
+                  coeff += 64;
+               else
+                  stbi__jpeg_idct_block(z, n, i*h + x, j*v + y, data);
             }
          }
-         return 1;
-      } else { // interleaved
-         int i,j,k,x,y;
-         STBI_SIMD_ALIGN(short, data[64]);
-         for (j=0; j < z->img_mcu_y; ++j) {
-            for (i=0; i < z->img_mcu_x; ++i) {
-               // scan an interleaved mcu... process scan_n components in order
-               for (k=0; k < z->scan_n; ++k) {
-                  int n = z->order[k];
-                  // scan out an mcu's worth of this component; that's just determined
-                  // by the basic H and V specified for the component
-                  for (y=0; y < z->img_comp[n].v; ++y) {
-                     for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
-                        int ha = z->img_comp[n].ha;
-                        if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
-                     }
-                  }
-               }
-               // after all interleaved components, that's an interleaved MCU,
-               // so now count down the restart interval
-               if (--z->todo <= 0) {
-                  if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-                  if (!STBI__RESTART(z->marker)) return 1;
-                  stbi__jpeg_reset(z);
-               }
+      }
+      // that's an MCU, so now count down the restart interval
+      if (--z->todo <= 0) {
+         if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+         if (!STBI__RESTART(z->marker)) return 2;
+         stbi__jpeg_reset(z);
+      }
+   }
+   return 1;
+}
+
+// the second half of stbi__decode_mcus with coeff set
+static void stbi__idct_mcus(stbi__jpeg *z, int first, int count, short *coeff)
+{
+   int m,k,x,y,per_row,blocks;
+   stbi__scan_mcus(z, &per_row, &blocks);
+   for (m=first; m < first+count; ++m) {
+      int i = m % per_row, j = m / per_row;
+      for (k=0; k < z->scan_n; ++k) {
+         int n = z->order[k];
+         int h = z->scan_n == 1 ? 1 : z->img_comp[n].h;
+         int v = z->scan_n == 1 ? 1 : z->img_comp[n].v;
+         for (y=0; y < v; ++y)
+            for (x=0; x < h; ++x, coeff += 64)
+               stbi__jpeg_idct_block(z, n, i*h + x, j*v + y, coeff);
+      }
+   }
+}
+
+// reads the rest of a scan into memory, up to and including the marker that
+// ends it, and notes where each restart interval's data starts
+static stbi_uc *stbi__read_scan(stbi__jpeg *z, int *len, int **starts, int *intervals)
+{
+   int n = 0, cap = 1 << 16, count = 1, starts_cap = 256;
+   stbi_uc *buf = (stbi_uc *) stbi__malloc(cap);
+   int *at = (int *) stbi__malloc(starts_cap * sizeof(int));
+   if (!buf || !at) goto oom;
+   at[0] = 0;
+   while (!stbi__at_eof(z->s)) {
+      stbi_uc c = stbi__get8(z->s);
+      if (n + 2 > cap) {
+         stbi_uc *grown = (stbi_uc *) STBI_REALLOC_SIZED(buf, cap, cap*2);
+         if (!grown) goto oom;
+         buf = grown;
+         cap *= 2;
+      }
+      buf[n++] = c;
+      if (c == 0xff) {
+         c = stbi__get8(z->s);
+         while (c == 0xff)
+            c = stbi__get8(z->s); // consume repeated 0xff fill bytes
+         buf[n++] = c;
+         if (STBI__RESTART(c)) {
+            if (count == starts_cap) {
+               int *grown = (int *) STBI_REALLOC_SIZED(at, starts_cap * sizeof(int), starts_cap * 2 * sizeof(int));
+               if (!grown) goto oom;
+               at = grown;
+               starts_cap *= 2;
             }
+            at[count++] = n;
+         } else if (c != 0) {
+            z->marker = c; // the end of the scan, for stbi__decode_jpeg_image
+            break;
          }
-         return 1;
       }
+   }
+   *len = n;
+   *starts = at;
+   *intervals = count;
+   return buf;
+oom:
+   STBI_FREE(buf);
+   STBI_FREE(at);
+   return NULL;
+}
+
+typedef struct
+{
+   stbi__jpeg *z;
+   stbi_uc *scan;
+   int *starts;
+   int len, intervals, per_task, mcus;
+   int failed;
+} stbi__jpeg_intervals;
+
+// decodes a run of restart intervals with its own copy of the decoder state
+// reading from its slice of the scan
+static void stbi__jpeg_interval_task(void *user, int t)
+{
+   stbi__jpeg_intervals *p = (stbi__jpeg_intervals *) user;
+   int a = t * p->per_task;
+   int b = stbi__min_int(a + p->per_task, p->intervals);
+   int end = b < p->intervals ? p->starts[b] : p->len;
+   int first = a * p->z->restart_interval;
+   int count = stbi__min_int(b * p->z->restart_interval, p->mcus) - first;
+   stbi__context s;
+   stbi__jpeg *j;
+   if (count <= 0) return; // junk restart markers past the last MCU
+   j = (stbi__jpeg *) stbi__malloc(sizeof(stbi__jpeg));
+   if (!j) { p->failed = 1; return; }
+   memcpy(j, p->z, sizeof(stbi__jpeg));
+   stbi__start_mem(&s, p->scan + p->starts[a], end - p->starts[a]);
+   j->s = &s;
+   stbi__jpeg_reset(j);
+   if (!stbi__decode_mcus(j, first, count, NULL))
+      p->failed = 1;
+   STBI_FREE(j);
+}
+
+// restart markers reset the entropy decoder and the dc prediction, so the
+// intervals between them can be decoded independently
+static int stbi__decode_intervals(stbi__jpeg *z, int mcus)
+{
+   stbi__jpeg_intervals p;
+   int tasks;
+   p.z = z;
+   p.mcus = mcus;
+   p.failed = 0;
+   p.scan = stbi__read_scan(z, &p.len, &p.starts, &p.intervals);
+   if (!p.scan) return stbi__err("outofmem", "Out of memory");
+   tasks = stbi__min_int(p.intervals, 64);
+   p.per_task = (p.intervals + tasks - 1) / tasks;
+   tasks = (p.intervals + p.per_task - 1) / p.per_task;
+   stbi__parallel_for(tasks, stbi__jpeg_interval_task, &p);
+   STBI_FREE(p.scan);
+   STBI_FREE(p.starts);
+   if (p.failed) return stbi__err("bad interval", "Corrupt JPEG");
+   return 1;
+}
+
+#define STBI__IDCT_TASKS  8
+
+typedef struct
+{
+   stbi__jpeg *z;
+   int blocks_per_mcu;
+   int first, count;           // MCUs being entropy decoded...
+   short *coeff;               // ...into here
+   int idct_first, idct_count; // the chunk before, being transformed
+   short *idct_coeff;
+   int result;
+} stbi__jpeg_pipeline;
+
+// task 0 entropy decodes the next chunk, the rest split the IDCT of the last
+static void stbi__jpeg_pipeline_task(void *user, int t)
+{
+   stbi__jpeg_pipeline *p = (stbi__jpeg_pipeline *) user;
+   if (t == 0) {
+      if (p->count)
+         p->result = stbi__decode_mcus(p->z, p->first, p->count, p->coeff);
+   } else {
+      int a = p->idct_count * (t-1) / STBI__IDCT_TASKS;
+      int b = p->idct_count * t / STBI__IDCT_TASKS;
+      stbi__idct_mcus(p->z, p->idct_first + a, b - a, p->idct_coeff + (size_t) a * p->blocks_per_mcu * 64);
+   }
+}
+
+// without restart markers the entropy decoding is serial, but it only takes
+// part of the time: decode a few MCU rows at a time into coefficients while
+// the rows before are transformed on the other threads
+static int stbi__decode_pipelined(stbi__jpeg *z, int mcus, int per_row, int blocks_per_mcu)
+{
+   stbi__jpeg_pipeline p;
+   int k, rows = (mcus + per_row - 1) / per_row;
+   int chunk = per_row * stbi__min_int(stbi__max_int(rows / 16, 1), 8);
+   size_t chunk_shorts = (size_t) chunk * blocks_per_mcu * 64;
+   void *raw = stbi__malloc_mad3(2 * chunk * blocks_per_mcu, 64, sizeof(short), 15);
+   short *coeff;
+   if (!raw) return stbi__err("outofmem", "Out of memory");
+   // the idct kernels want 16-byte aligned blocks; zeroed in case a missing
+   // restart marker stops a chunk early
+   coeff = (short *) (((size_t) raw + 15) & ~15);
+   memset(coeff, 0, 2 * chunk_shorts * sizeof(short));
+
+   p.z = z;
+   p.blocks_per_mcu = blocks_per_mcu;
+   p.first = 0;
+   p.count = 0;
+   p.idct_count = 0;
+   p.result = 1;
+   for (k=0; ; ++k) {
+      p.first += p.count;
+      p.count = p.result == 1 ? stbi__min_int(chunk, mcus - p.first) : 0;
+      p.coeff = coeff + (k & 1) * chunk_shorts;
+      if (!p.count && !p.idct_count) break;
+      stbi__parallel_for(p.idct_count ? 1 + STBI__IDCT_TASKS : 1, stbi__jpeg_pipeline_task, &p);
+      if (!p.result) break;
+      p.idct_first = p.first;
+      p.idct_count = p.count;
+      p.idct_coeff = p.coeff;
+   }
+   STBI_FREE(raw);
+   return p.result != 0;
+}
+
+static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
+{
+   stbi__jpeg_reset(z);
+   if (!z->progressive) {
+      int per_row, blocks_per_mcu;
+      int mcus = stbi__scan_mcus(z, &per_row, &blocks_per_mcu);
+      if (stbi__parallel_for_fn && mcus * blocks_per_mcu >= STBI__PARALLEL_MIN_BLOCKS) {
+         if (z->restart_interval)
+            return stbi__decode_intervals(z, mcus);
+         return stbi__decode_pipelined(z, mcus, per_row, blocks_per_mcu);
+      }
+      return stbi__decode_mcus(z, 0, mcus, NULL) != 0;
    } else {
       if (z->scan_n == 1) {
          int i,j;
@@ -3025,7 +3728,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                      return 0;
                } else {
                   int ha = z->img_comp[n].ha;
-                  if (!stbi__jpeg_decode_block_prog_ac(z, data, &z->huff_ac[ha], z->fast_ac[ha]))
+                  if (!stbi__jpeg_decode_block_prog_ac(z, data, &z->huff_ac[ha]))
                      return 0;
                }
                // every data block is an MCU, so countdown the restart interval
@@ -3077,21 +3780,40 @@ static void stbi__jpeg_dequantize(short *data, stbi__uint16 *dequant)
       data[i] *= dequant[i];
 }
 
+typedef struct
+{
+   stbi__jpeg *z;
+   int n;
+} stbi__jpeg_finish_job;
+
+#define STBI__FINISH_ROWS  8
+
+// dequantizes and transforms STBI__FINISH_ROWS block rows of a component
+static void stbi__jpeg_finish_task(void *user, int t)
+{
+   stbi__jpeg_finish_job *job = (stbi__jpeg_finish_job *) user;
+   stbi__jpeg *z = job->z;
+   int i,j,n = job->n;
+   int w = (z->img_comp[n].x+7) >> 3;
+   int h = (z->img_comp[n].y+7) >> 3;
+   for (j=t*STBI__FINISH_ROWS; j < h && j < (t+1)*STBI__FINISH_ROWS; ++j) {
+      for (i=0; i < w; ++i) {
+         short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
+         stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
+         stbi__jpeg_idct_block(z, n, i, j, data);
+      }
+   }
+}
+
 static void stbi__jpeg_finish(stbi__jpeg *z)
 {
    if (z->progressive) {
-      // dequantize and idct the data
-      int i,j,n;
-      for (n=0; n < z->s->img_n; ++n) {
-         int w = (z->img_comp[n].x+7) >> 3;
-         int h = (z->img_comp[n].y+7) >> 3;
-         for (j=0; j < h; ++j) {
-            for (i=0; i < w; ++i) {
-               short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
-               stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
-            }
-         }
+      // dequantize and idct the data, block rows in parallel
+      stbi__jpeg_finish_job job;
+      job.z = z;
+      for (job.n=0; job.n < z->s->img_n; ++job.n) {
+         int h = (z->img_comp[job.n].y+7) >> 3;
+         stbi__parallel_for((h + STBI__FINISH_ROWS-1) / STBI__FINISH_ROWS, stbi__jpeg_finish_task, &job);
       }
    }
 }
@@ -3147,8 +3869,7 @@ static int stbi__process_marker(stbi__jpeg *z, int m)
             }
             for (i=0; i < n; ++i)
                v[i] = stbi__get8(z->s);
-            if (tc != 0)
-               stbi__build_fast_ac(z->fast_ac[th], z->huff_ac + th);
+            stbi__build_fast_sym(tc == 0 ? z->huff_dc+th : z->huff_ac+th, tc == 0);
             L -= n;
          }
          return L==0;
@@ -3329,8 +4050,8 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       //
       // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
       // so these muls can't overflow with 32-bit ints (which we require)
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * (8 >> z->scale_shift);
+      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * (8 >> z->scale_shift);
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
@@ -3340,10 +4061,10 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // align blocks for idct using mmx/sse
       z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
       if (z->progressive) {
-         // w2, h2 are multiples of 8 (see above)
-         z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-         z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+         // one 8x8 block of coefficients per block of the (unscaled) image
+         z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+         z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
+         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].coeff_w * 8, z->img_comp[i].coeff_h * 8, sizeof(short), 15);
          if (z->img_comp[i].raw_coeff == NULL)
             return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
          z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
@@ -3643,6 +4364,75 @@ static stbi_uc *stbi__resample_row_hv_2_simd(stbi_uc *out, stbi_uc *in_near, stb
 }
 #endif
 
+#ifdef STBI_AVX2
+// same filter as stbi__resample_row_hv_2_simd, 16 pixels per iteration
+STBI__AVX2_TARGET static stbi_uc *stbi__resample_row_hv_2_avx2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+   int i=0,t0,t1;
+
+   if (w == 1) {
+      out[0] = out[1] = stbi__div4(3*in_near[0] + in_far[0] + 2);
+      return out;
+   }
+
+   t1 = 3*in_near[0] + in_far[0];
+   // the last pixel in a row is left to the scalar tail for the boundary
+   for (; i < ((w-1) & ~15); i += 16) {
+      // vertical pass: 3*x + y = 4*x + (y - x)
+      __m256i farw  = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_far + i)));
+      __m256i nearw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_near + i)));
+      __m256i diff  = _mm256_sub_epi16(farw, nearw);
+      __m256i nears = _mm256_slli_epi16(nearw, 2);
+      __m256i curr  = _mm256_add_epi16(nears, diff); // current row
+
+      // "prev"/"next" are the current row shifted by one pixel across the
+      // 128-bit lanes, with the neighbouring pixels of the block inserted
+      __m256i lo0  = _mm256_permute2x128_si256(curr, curr, 0x08); // 0 | curr.lo
+      __m256i hi0  = _mm256_permute2x128_si256(curr, curr, 0x81); // curr.hi | 0
+      __m256i prv0 = _mm256_alignr_epi8(curr, lo0, 14);
+      __m256i nxt0 = _mm256_alignr_epi8(hi0, curr, 2);
+      __m256i prev = _mm256_insert_epi16(prv0, t1, 0);
+      __m256i next = _mm256_insert_epi16(nxt0, 3*in_near[i+16] + in_far[i+16], 15);
+
+      // even pixels = cur*4 + (prev - cur), odd pixels = cur*4 + (next - cur)
+      __m256i bias = _mm256_set1_epi16(8);
+      __m256i curs = _mm256_slli_epi16(curr, 2);
+      __m256i prvd = _mm256_sub_epi16(prev, curr);
+      __m256i nxtd = _mm256_sub_epi16(next, curr);
+      __m256i curb = _mm256_add_epi16(curs, bias);
+      __m256i even = _mm256_add_epi16(prvd, curb);
+      __m256i odd  = _mm256_add_epi16(nxtd, curb);
+
+      // interleave within each lane, undo scaling; the in-lane pack puts
+      // pixels 0-7 in the low lane and 8-15 in the high one
+      __m256i int0 = _mm256_unpacklo_epi16(even, odd);
+      __m256i int1 = _mm256_unpackhi_epi16(even, odd);
+      __m256i de0  = _mm256_srli_epi16(int0, 4);
+      __m256i de1  = _mm256_srli_epi16(int1, 4);
+      _mm256_storeu_si256((__m256i *) (out + i*2), _mm256_packus_epi16(de0, de1));
+
+      // "previous" value for next iter
+      t1 = 3*in_near[i+15] + in_far[i+15];
+   }
+
+   t0 = t1;
+   t1 = 3*in_near[i] + in_far[i];
+   out[i*2] = stbi__div16(3*t1 + t0 + 8);
+
+   for (++i; i < w; ++i) {
+      t0 = t1;
+      t1 = 3*in_near[i]+in_far[i];
+      out[i*2-1] = stbi__div16(3*t0 + t1 + 8);
+      out[i*2  ] = stbi__div16(3*t1 + t0 + 8);
+   }
+   out[w*2-1] = stbi__div4(t1+2);
+
+   STBI_NOTUSED(hs);
+
+   return out;
+}
+#endif
+
 static stbi_uc *stbi__resample_row_generic(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
 {
    // resample with nearest-neighbor
@@ -3817,9 +4607,76 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 }
 #endif
 
+#ifdef STBI_AVX2
+// same arithmetic as the sse2 path of stbi__YCbCr_to_RGB_simd, 16 pixels per
+// iteration; the remainder (and step == 3) is handed to that function
+STBI__AVX2_TARGET static void stbi__YCbCr_to_RGB_avx2(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+{
+   int i = 0;
+
+   if (step == 4) {
+      __m128i signflip  = _mm_set1_epi8(-0x80);
+      __m256i cr_const0 = _mm256_set1_epi16(   (short) ( 1.40200f*4096.0f+0.5f));
+      __m256i cr_const1 = _mm256_set1_epi16( - (short) ( 0.71414f*4096.0f+0.5f));
+      __m256i cb_const0 = _mm256_set1_epi16( - (short) ( 0.34414f*4096.0f+0.5f));
+      __m256i cb_const1 = _mm256_set1_epi16(   (short) ( 1.77200f*4096.0f+0.5f));
+      __m128i y_bias = _mm_set1_epi8((char) (unsigned char) 128);
+      __m128i zero = _mm_setzero_si128();
+      __m256i xw = _mm256_set1_epi16(255); // alpha channel
+
+      for (; i+15 < count; i += 16) {
+         // load
+         __m128i y_bytes = _mm_loadu_si128((__m128i *) (y+i));
+         __m128i cr_biased = _mm_xor_si128(_mm_loadu_si128((__m128i *) (pcr+i)), signflip); // -128
+         __m128i cb_biased = _mm_xor_si128(_mm_loadu_si128((__m128i *) (pcb+i)), signflip); // -128
+
+         // unpack to short (and left-shift cr, cb by 8), pixels 0-7 in the low lane
+         __m256i yw  = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi8(y_bias, y_bytes)), _mm_unpackhi_epi8(y_bias, y_bytes), 1);
+         __m256i crw = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi8(zero, cr_biased)), _mm_unpackhi_epi8(zero, cr_biased), 1);
+         __m256i cbw = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi8(zero, cb_biased)), _mm_unpackhi_epi8(zero, cb_biased), 1);
+
+         // color transform
+         __m256i yws = _mm256_srli_epi16(yw, 4);
+         __m256i cr0 = _mm256_mulhi_epi16(cr_const0, crw);
+         __m256i cb0 = _mm256_mulhi_epi16(cb_const0, cbw);
+         __m256i cb1 = _mm256_mulhi_epi16(cbw, cb_const1);
+         __m256i cr1 = _mm256_mulhi_epi16(crw, cr_const1);
+         __m256i rws = _mm256_add_epi16(cr0, yws);
+         __m256i gwt = _mm256_add_epi16(cb0, yws);
+         __m256i bws = _mm256_add_epi16(yws, cb1);
+         __m256i gws = _mm256_add_epi16(gwt, cr1);
+
+         // descale
+         __m256i rw = _mm256_srai_epi16(rws, 4);
+         __m256i bw = _mm256_srai_epi16(bws, 4);
+         __m256i gw = _mm256_srai_epi16(gws, 4);
+
+         // back to byte, set up for transpose
+         __m256i brb = _mm256_packus_epi16(rw, bw);
+         __m256i gxb = _mm256_packus_epi16(gw, xw);
+
+         // transpose to interleave channels; each lane ends up holding
+         // pixels 0-3/4-7 (low) and 8-11/12-15 (high)
+         __m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+         __m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+         __m256i o0 = _mm256_unpacklo_epi16(t0, t1);
+         __m256i o1 = _mm256_unpackhi_epi16(t0, t1);
+
+         // store
+         _mm256_storeu_si256((__m256i *) (out + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+         _mm256_storeu_si256((__m256i *) (out + 32), _mm256_permute2x128_si256(o0, o1, 0x31));
+         out += 64;
+      }
+   }
+
+   stbi__YCbCr_to_RGB_simd(out, y+i, pcb+i, pcr+i, count-i, step);
+}
+#endif
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
+   j->scale_shift = j->s->jpeg_scale_shift;
    j->idct_block_kernel = stbi__idct_block;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
@@ -3832,6 +4689,14 @@ static void stbi__setup_jpeg(stbi__jpeg *j)
    }
 #endif
 
+#ifdef STBI_AVX2
+   if (stbi__jpeg_use_avx2 && stbi__avx2_available()) {
+      j->idct_block_kernel = stbi__idct_avx2;
+      j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_avx2;
+      j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_avx2;
+   }
+#endif
+
 #ifdef STBI_NEON
    j->idct_block_kernel = stbi__idct_simd;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
@@ -3862,6 +4727,147 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
+typedef struct
+{
+   stbi__jpeg *z;
+   stbi__resample res_comp[4]; // at row 0
+   stbi_uc *output;
+   stbi_uc *linebuf;           // per band: decode_n lines of img_x+3, and an output row
+   size_t band_bytes;
+   int n, decode_n, is_rgb;
+   int band_rows;
+} stbi__jpeg_convert;
+
+// moves a resampler at row 0 down to output row j
+static void stbi__resample_seek(stbi__resample *r, stbi_uc *data, int w2, int y, int j)
+{
+   // line1 moves down a row each time ystep wraps, line0 follows a row behind
+   int wraps = (r->ystep + j) / r->vs;
+   r->ystep = (r->ystep + j) % r->vs;
+   r->ypos = wraps;
+   r->line1 = data + w2 * stbi__min_int(wraps, y-1);
+   r->line0 = wraps ? data + w2 * stbi__min_int(wraps-1, y-1) : data;
+}
+
+// resamples and color-converts one band of output rows
+static void stbi__jpeg_convert_task(void *user, int band)
+{
+   stbi__jpeg_convert *c = (stbi__jpeg_convert *) user;
+   stbi__jpeg *z = c->z;
+   stbi__resample res_comp[4];
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+   stbi_uc *linebuf = c->linebuf + (size_t) band * c->band_bytes;
+   stbi_uc *last_row = linebuf + (size_t) c->decode_n * (z->s->img_x + 3);
+   unsigned int i,j;
+   unsigned int j0 = band * c->band_rows;
+   unsigned int j1 = stbi__min_int(j0 + c->band_rows, z->s->img_y);
+   int k, n = c->n, decode_n = c->decode_n;
+
+   for (k=0; k < decode_n; ++k) {
+      res_comp[k] = c->res_comp[k];
+      stbi__resample_seek(&res_comp[k], z->img_comp[k].data, z->img_comp[k].w2, z->img_comp[k].y, j0);
+   }
+   for (j=j0; j < j1; ++j) {
+      // some converters write one byte past the row when n is 1 or 3, which
+      // for the last row of a band would land in the next band's first row
+      int staged = (n == 1 || n == 3) && j == j1-1 && j1 < z->s->img_y;
+      stbi_uc *out = staged ? last_row : c->output + n * z->s->img_x * j;
+      for (k=0; k < decode_n; ++k) {
+         stbi__resample *r = &res_comp[k];
+         int y_bot = r->ystep >= (r->vs >> 1);
+         coutput[k] = r->resample(linebuf + (size_t) k * (z->s->img_x + 3),
+                                  y_bot ? r->line1 : r->line0,
+                                  y_bot ? r->line0 : r->line1,
+                                  r->w_lores, r->hs);
+         if (++r->ystep >= r->vs) {
+            r->ystep = 0;
+            r->line0 = r->line1;
+            if (++r->ypos < z->img_comp[k].y)
+               r->line1 += z->img_comp[k].w2;
+         }
+      }
+      if (n >= 3) {
+         stbi_uc *y = coutput[0];
+         if (z->s->img_n == 3) {
+            if (c->is_rgb) {
+               for (i=0; i < z->s->img_x; ++i) {
+                  out[0] = y[i];
+                  out[1] = coutput[1][i];
+                  out[2] = coutput[2][i];
+                  out[3] = 255;
+                  out += n;
+               }
+            } else {
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else if (z->s->img_n == 4) {
+            if (z->app14_color_transform == 0) { // CMYK
+               for (i=0; i < z->s->img_x; ++i) {
+                  stbi_uc m = coutput[3][i];
+                  out[0] = stbi__blinn_8x8(coutput[0][i], m);
+                  out[1] = stbi__blinn_8x8(coutput[1][i], m);
+                  out[2] = stbi__blinn_8x8(coutput[2][i], m);
+                  out[3] = 255;
+                  out += n;
+               }
+            } else if (z->app14_color_transform == 2) { // YCCK
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+               for (i=0; i < z->s->img_x; ++i) {
+                  stbi_uc m = coutput[3][i];
+                  out[0] = stbi__blinn_8x8(255 - out[0], m);
+                  out[1] = stbi__blinn_8x8(255 - out[1], m);
+                  out[2] = stbi__blinn_8x8(255 - out[2], m);
+                  out += n;
+               }
+            } else { // YCbCr + alpha?  Ignore the fourth channel for now
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = out[1] = out[2] = y[i];
+               out[3] = 255; // not used if n==3
+               out += n;
+            }
+      } else {
+         if (c->is_rgb) {
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i)
+                  *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+            else {
+               for (i=0; i < z->s->img_x; ++i, out += 2) {
+                  out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+                  out[1] = 255;
+               }
+            }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+            for (i=0; i < z->s->img_x; ++i) {
+               stbi_uc m = coutput[3][i];
+               stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+               stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+               stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+               out[0] = stbi__compute_y(r, g, b);
+               out[1] = 255;
+               out += n;
+            }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+               out[1] = 255;
+               out += n;
+            }
+         } else {
+            stbi_uc *y = coutput[0];
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
+            else
+               for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+         }
+      }
+      if (staged)
+         memcpy(c->output + n * z->s->img_x * j, last_row, n * z->s->img_x);
+   }
+}
+
 static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
 {
    int n, decode_n, is_rgb;
@@ -3873,6 +4879,17 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
    // load a jpeg image from whichever source, but leave in YCbCr format
    if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
 
+   // the planes were decoded downscaled; resample and convert at that size
+   if (z->scale_shift) {
+      int k, round = (1 << z->scale_shift) - 1;
+      z->s->img_x = (z->s->img_x + round) >> z->scale_shift;
+      z->s->img_y = (z->s->img_y + round) >> z->scale_shift;
+      for (k=0; k < z->s->img_n; ++k) {
+         z->img_comp[k].x = (z->img_comp[k].x + round) >> z->scale_shift;
+         z->img_comp[k].y = (z->img_comp[k].y + round) >> z->scale_shift;
+      }
+   }
+
    // determine actual number of components to generate
    n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
 
@@ -3889,20 +4906,25 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
 
    // resample and color-convert
    {
-      int k;
-      unsigned int i,j;
+      int k, bands = 1;
       stbi_uc *output;
-      stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+      stbi__jpeg_convert convert;
 
-      stbi__resample res_comp[4];
+      if (stbi__parallel_for_fn && z->s->img_x * z->s->img_y >= STBI__PARALLEL_MIN_BLOCKS * 64)
+         bands = stbi__max_int(stbi__min_int(z->s->img_y / 16, 32), 1);
+      convert.band_rows = (z->s->img_y + bands-1) / bands;
+      bands = (z->s->img_y + convert.band_rows-1) / convert.band_rows;
 
-      for (k=0; k < decode_n; ++k) {
-         stbi__resample *r = &res_comp[k];
+      // allocate line buffers big enough for upsampling off the edges with
+      // upsample factor of 4, one per component for every band, plus a row
+      // of output (and the byte past it) for the band's last row
+      convert.band_bytes = (size_t) decode_n * (z->s->img_x + 3) + (size_t) n * z->s->img_x + 1;
+      if (!stbi__mul2sizes_valid(bands, (int) convert.band_bytes)) { stbi__cleanup_jpeg(z); return stbi__errpuc("too large", "Corrupt JPEG"); }
+      z->img_comp[0].linebuf = (stbi_uc *) stbi__malloc(bands * convert.band_bytes);
+      if (!z->img_comp[0].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
 
-         // allocate line buffer big enough for upsampling off the edges
-         // with upsample factor of 4
-         z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
-         if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+      for (k=0; k < decode_n; ++k) {
+         stbi__resample *r = &convert.res_comp[k];
 
          r->hs      = z->img_h_max / z->img_comp[k].h;
          r->vs      = z->img_v_max / z->img_comp[k].v;
@@ -3918,105 +4940,21 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
          else                               r->resample = stbi__resample_row_generic;
       }
 
-      // can't error after this so, this is safe
-      output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
+      // can't error after this so, this is safe (the extra byte is for the
+      // converters in stbi__jpeg_convert_task, which write one alpha past
+      // the last pixel)
+      output = stbi__malloc_output(z->s, n, z->s->img_x, z->s->img_y, n == 4 ? 0 : 1);
       if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
 
-      // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
-         for (k=0; k < decode_n; ++k) {
-            stbi__resample *r = &res_comp[k];
-            int y_bot = r->ystep >= (r->vs >> 1);
-            coutput[k] = r->resample(z->img_comp[k].linebuf,
-                                     y_bot ? r->line1 : r->line0,
-                                     y_bot ? r->line0 : r->line1,
-                                     r->w_lores, r->hs);
-            if (++r->ystep >= r->vs) {
-               r->ystep = 0;
-               r->line0 = r->line1;
-               if (++r->ypos < z->img_comp[k].y)
-                  r->line1 += z->img_comp[k].w2;
-            }
-         }
-         if (n >= 3) {
-            stbi_uc *y = coutput[0];
-            if (z->s->img_n == 3) {
-               if (is_rgb) {
-                  for (i=0; i < z->s->img_x; ++i) {
-                     out[0] = y[i];
-                     out[1] = coutput[1][i];
-                     out[2] = coutput[2][i];
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else {
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else if (z->s->img_n == 4) {
-               if (z->app14_color_transform == 0) { // CMYK
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(coutput[0][i], m);
-                     out[1] = stbi__blinn_8x8(coutput[1][i], m);
-                     out[2] = stbi__blinn_8x8(coutput[2][i], m);
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else if (z->app14_color_transform == 2) { // YCCK
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(255 - out[0], m);
-                     out[1] = stbi__blinn_8x8(255 - out[1], m);
-                     out[2] = stbi__blinn_8x8(255 - out[2], m);
-                     out += n;
-                  }
-               } else { // YCbCr + alpha?  Ignore the fourth channel for now
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
-                  out += n;
-               }
-         } else {
-            if (is_rgb) {
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i)
-                     *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-               else {
-                  for (i=0; i < z->s->img_x; ++i, out += 2) {
-                     out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                     out[1] = 255;
-                  }
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  stbi_uc m = coutput[3][i];
-                  stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-                  stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-                  stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-                  out[0] = stbi__compute_y(r, g, b);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else {
-               stbi_uc *y = coutput[0];
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
-               else
-                  for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
-            }
-         }
-      }
+      // now go ahead and resample, in bands of rows when there are threads
+      // to spread them over
+      convert.z = z;
+      convert.output = output;
+      convert.linebuf = z->img_comp[0].linebuf;
+      convert.n = n;
+      convert.decode_n = decode_n;
+      convert.is_rgb = is_rgb;
+      stbi__parallel_for(bands, stbi__jpeg_convert_task, &convert);
       stbi__cleanup_jpeg(z);
       *out_x = z->s->img_x;
       *out_y = z->s->img_y;
@@ -4059,8 +4997,8 @@ static int stbi__jpeg_info_raw(stbi__jpeg *j, int *x, int *y, int *comp)
       stbi__rewind( j->s );
       return 0;
    }
-   if (x) *x = j->s->img_x;
-   if (y) *y = j->s->img_y;
+   if (x) *x = (j->s->img_x + (1 << j->s->jpeg_scale_shift) - 1) >> j->s->jpeg_scale_shift;
+   if (y) *y = (j->s->img_y + (1 << j->s->jpeg_scale_shift) - 1) >> j->s->jpeg_scale_shift;
    if (comp) *comp = j->s->img_n >= 3 ? 3 : 1;
    return 1;
 }
@@ -4090,6 +5028,8 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 // fast-way is faster to check than jpeg huffman, but slow way is slower
 #define STBI__ZFAST_BITS  9 // accelerate all cases in default tables
 #define STBI__ZFAST_MASK  ((1 << STBI__ZFAST_BITS) - 1)
+#define STBI__ZMULTI_BITS 11 // lookahead of the combined tables in the inflate loop
+#define STBI__ZMULTI_MASK ((1 << STBI__ZMULTI_BITS) - 1)
 #define STBI__ZNSYMS 288 // number of symbols in literal/length alphabet
 
 // zlib-style huffman encoding
@@ -4179,7 +5119,7 @@ typedef struct
    stbi_uc *zbuffer, *zbuffer_end;
    int num_bits;
    int hit_zeof_once;
-   stbi__uint32 code_buffer;
+   stbi__uint64 code_buffer;
 
    char *zout;
    char *zout_start;
@@ -4187,6 +5127,9 @@ typedef struct
    int   z_expandable;
 
    stbi__zhuffman z_length, z_distance;
+   // combined lookups for the current block, see stbi__zbuild_multi
+   stbi__uint32 zlength_multi[1 << STBI__ZMULTI_BITS];
+   stbi__uint32 zdistance_multi[1 << STBI__ZMULTI_BITS];
 } stbi__zbuf;
 
 stbi_inline static int stbi__zeof(stbi__zbuf *z)
@@ -4202,20 +5145,34 @@ stbi_inline static stbi_uc stbi__zget8(stbi__zbuf *z)
 static void stbi__fill_bits(stbi__zbuf *z)
 {
    do {
-      if (z->code_buffer >= (1U << z->num_bits)) {
+      if (z->code_buffer >= ((stbi__uint64) 1 << z->num_bits)) {
         z->zbuffer = z->zbuffer_end;  /* treat this as EOF so we fail. */
         return;
       }
-      z->code_buffer |= (unsigned int) stbi__zget8(z) << z->num_bits;
+      z->code_buffer |= (stbi__uint64) stbi__zget8(z) << z->num_bits;
       z->num_bits += 8;
    } while (z->num_bits <= 24);
 }
 
+// tops the bit buffer up to 56+ bits with a single load; the caller makes
+// sure 8 input bytes are left. only whole bytes are added, so nothing is
+// ever set above num_bits.
+stbi_inline static void stbi__fill_bits_fast(stbi__zbuf *z)
+{
+   stbi_uc *p = z->zbuffer;
+   int n = (63 - z->num_bits) >> 3;
+   stbi__uint64 v = (stbi__uint64) p[0]         | ((stbi__uint64) p[1] <<  8) | ((stbi__uint64) p[2] << 16) | ((stbi__uint64) p[3] << 24)
+                  | ((stbi__uint64) p[4] << 32) | ((stbi__uint64) p[5] << 40) | ((stbi__uint64) p[6] << 48) | ((stbi__uint64) p[7] << 56);
+   z->code_buffer |= (v & (((stbi__uint64) 1 << (n*8)) - 1)) << z->num_bits;
+   z->zbuffer += n;
+   z->num_bits += n*8;
+}
+
 stbi_inline static unsigned int stbi__zreceive(stbi__zbuf *z, int n)
 {
    unsigned int k;
    if (z->num_bits < n) stbi__fill_bits(z);
-   k = z->code_buffer & ((1 << n) - 1);
+   k = (unsigned int) (z->code_buffer & ((1 << n) - 1));
    z->code_buffer >>= n;
    z->num_bits -= n;
    return k;
@@ -4226,7 +5183,7 @@ static int stbi__zhuffman_decode_slowpath(stbi__zbuf *a, stbi__zhuffman *z)
    int b,s,k;
    // not resolved by fast table, so compute it the slow way
    // use jpeg approach, which requires MSbits at top
-   k = stbi__bit_reverse(a->code_buffer, 16);
+   k = stbi__bit_reverse((int) (a->code_buffer & 0xffff), 16);
    for (s=STBI__ZFAST_BITS+1; ; ++s)
       if (k < z->maxcode[s])
          break;
@@ -4306,21 +5263,119 @@ static const int stbi__zdist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129
 static const int stbi__zdist_extra[32] =
 { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
 
+// kinds of entries in the combined tables; an entry is
+//    payload << 8 | kind << 4 | bits consumed
+// and 0 means the code is longer than STBI__ZMULTI_BITS (or invalid)
+enum {
+   STBI__ZMULTI_SYMBOL = 1, // payload: symbol, its extra bits still to be read
+   STBI__ZMULTI_VALUE  = 2, // payload: final length/distance, extra bits included
+   STBI__ZMULTI_LIT1   = 3, // payload: one literal
+   STBI__ZMULTI_LIT2   = 4  // payload: two literals, first in the low byte
+};
+
+// builds the table the inflate loop looks up STBI__ZMULTI_BITS bits at a
+// time in: a length or distance together with its extra bits when they fit,
+// and for the literal/length alphabet two literals at once when both fit.
+// sizelist must already have been validated by stbi__zbuild_huffman.
+static void stbi__zbuild_multi(stbi__uint32 *table, const stbi_uc *sizelist, int num, int is_length)
+{
+   int i, code, next_code[16], sizes[16];
+
+   memset(table, 0, sizeof(table[0]) << STBI__ZMULTI_BITS);
+   memset(sizes, 0, sizeof(sizes));
+   for (i=0; i < num; ++i)
+      ++sizes[sizelist[i]];
+   sizes[0] = 0;
+   code = 0;
+   for (i=1; i < 16; ++i) {
+      next_code[i] = code;
+      code = (code + sizes[i]) << 1;
+   }
+
+   for (i=0; i < num; ++i) {
+      int s = sizelist[i], j, extra = 0, base = 0, kind;
+      if (!s) continue;
+      j = stbi__bit_reverse(next_code[s]++, s);
+      if (s > STBI__ZMULTI_BITS) continue;
+
+      if (is_length && i < 256) {
+         kind = STBI__ZMULTI_LIT1;
+      } else if (is_length ? (i > 256 && i < 286) : (i < 30)) {
+         extra = is_length ? stbi__zlength_extra[i-257] : stbi__zdist_extra[i];
+         base  = is_length ? stbi__zlength_base[i-257]  : stbi__zdist_base[i];
+         kind = (s + extra <= STBI__ZMULTI_BITS) ? STBI__ZMULTI_VALUE : STBI__ZMULTI_SYMBOL;
+      } else {
+         kind = STBI__ZMULTI_SYMBOL; // end of block, or invalid and rejected by the caller
+      }
+
+      for (; j < (1 << STBI__ZMULTI_BITS); j += 1 << s) {
+         if (kind == STBI__ZMULTI_VALUE)
+            table[j] = (stbi__uint32) (base + ((j >> s) & ((1 << extra) - 1))) << 8 | (kind << 4) | (s + extra);
+         else
+            table[j] = (stbi__uint32) i << 8 | (kind << 4) | s;
+      }
+   }
+
+   // pair up literals; going downwards, the entry for the bits after the
+   // first literal (a smaller index) still holds a single symbol
+   if (is_length) {
+      for (i = (1 << STBI__ZMULTI_BITS) - 1; i >= 0; --i) {
+         stbi__uint32 e = table[i], e2;
+         int s = e & 15;
+         if (((e >> 4) & 7) != STBI__ZMULTI_LIT1) continue;
+         e2 = table[i >> s];
+         if (((e2 >> 4) & 7) == STBI__ZMULTI_LIT1 && s + (int) (e2 & 15) <= STBI__ZMULTI_BITS)
+            table[i] = ((e >> 8) | (e2 >> 8) << 8) << 8 | (STBI__ZMULTI_LIT2 << 4) | (s + (e2 & 15));
+      }
+   }
+}
+
 static int stbi__parse_huffman_block(stbi__zbuf *a)
 {
    char *zout = a->zout;
    for(;;) {
-      int z = stbi__zhuffman_decode(a, &a->z_length);
-      if (z < 256) {
-         if (z < 0) return stbi__err("bad huffman code","Corrupt PNG"); // error in huffman codes
-         if (zout >= a->zout_end) {
-            if (!stbi__zexpand(a, zout, 1)) return 0;
-            zout = a->zout;
+      int z=0,len=0,dist;
+      stbi__uint32 e = 0;
+      // with 8+ input bytes left the bit buffer can be topped up to 56+ bits,
+      // enough for a literal pair or a whole length/distance pair, and the
+      // combined tables apply. near the end the checked decoder takes over.
+      int fast = a->zbuffer_end - a->zbuffer >= 8;
+      if (fast) {
+         stbi__fill_bits_fast(a);
+         e = a->zlength_multi[a->code_buffer & STBI__ZMULTI_MASK];
+      }
+      if (e) {
+         int kind = (e >> 4) & 7;
+         a->code_buffer >>= e & 15;
+         a->num_bits -= e & 15;
+         if (kind >= STBI__ZMULTI_LIT1) {
+            int n = kind - STBI__ZMULTI_LIT1 + 1;
+            if (a->zout_end - zout < n) {
+               if (!stbi__zexpand(a, zout, n)) return 0;
+               zout = a->zout;
+            }
+            *zout++ = (char) (e >> 8);
+            if (n == 2) *zout++ = (char) (e >> 16);
+            continue;
          }
-         *zout++ = (char) z;
+         if (kind == STBI__ZMULTI_VALUE)
+            len = (int) (e >> 8);
+         else
+            z = (int) (e >> 8);
       } else {
-         stbi_uc *p;
-         int len,dist;
+         z = fast ? stbi__zhuffman_decode_slowpath(a, &a->z_length) : stbi__zhuffman_decode(a, &a->z_length);
+      }
+
+      if (!len) {
+         if (z < 256) {
+            if (z < 0) return stbi__err("bad huffman code","Corrupt PNG"); // error in huffman codes
+            if (zout >= a->zout_end) {
+               if (!stbi__zexpand(a, zout, 1)) return 0;
+               zout = a->zout;
+            }
+            *zout++ = (char) z;
+            continue;
+         }
          if (z == 256) {
             a->zout = zout;
             if (a->hit_zeof_once && a->num_bits < 16) {
@@ -4336,21 +5391,47 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
          z -= 257;
          len = stbi__zlength_base[z];
          if (stbi__zlength_extra[z]) len += stbi__zreceive(a, stbi__zlength_extra[z]);
-         z = stbi__zhuffman_decode(a, &a->z_distance);
+      }
+
+      e = fast ? a->zdistance_multi[a->code_buffer & STBI__ZMULTI_MASK] : 0;
+      if (e) {
+         a->code_buffer >>= e & 15;
+         a->num_bits -= e & 15;
+      }
+      if (((e >> 4) & 7) == STBI__ZMULTI_VALUE) {
+         dist = (int) (e >> 8);
+      } else {
+         if (e)
+            z = (int) (e >> 8);
+         else
+            z = fast ? stbi__zhuffman_decode_slowpath(a, &a->z_distance) : stbi__zhuffman_decode(a, &a->z_distance);
          if (z < 0 || z >= 30) return stbi__err("bad huffman code","Corrupt PNG"); // per DEFLATE, distance codes 30 and 31 must not appear in compressed data
          dist = stbi__zdist_base[z];
          if (stbi__zdist_extra[z]) dist += stbi__zreceive(a, stbi__zdist_extra[z]);
-         if (zout - a->zout_start < dist) return stbi__err("bad dist","Corrupt PNG");
-         if (len > a->zout_end - zout) {
-            if (!stbi__zexpand(a, zout, len)) return 0;
-            zout = a->zout;
-         }
-         p = (stbi_uc *) (zout - dist);
+      }
+
+      if (zout - a->zout_start < dist) return stbi__err("bad dist","Corrupt PNG");
+      if (len > a->zout_end - zout) {
+         if (!stbi__zexpand(a, zout, len)) return 0;
+         zout = a->zout;
+      }
+      {
+         stbi_uc *p = (stbi_uc *) (zout - dist);
          if (dist == 1) { // run of one byte; common in images.
-            stbi_uc v = *p;
-            if (len) { do *zout++ = v; while (--len); }
+            memset(zout, *p, len);
+            zout += len;
+         } else if (dist >= 8 && a->zout_end - zout >= len + 8) {
+            // 8 bytes at a time; the last copy may run up to 7 bytes past
+            // the match, into space the following output overwrites
+            char *end = zout + len;
+            do {
+               memcpy(zout, p, 8);
+               zout += 8;
+               p += 8;
+            } while (zout < end);
+            zout = end;
          } else {
-            if (len) { do *zout++ = *p++; while (--len); }
+            do *zout++ = *p++; while (--len);
          }
       }
    }
@@ -4403,6 +5484,8 @@ static int stbi__compute_huffman_codes(stbi__zbuf *a)
    if (n != ntot) return stbi__err("bad codelengths","Corrupt PNG");
    if (!stbi__zbuild_huffman(&a->z_length, lencodes, hlit)) return 0;
    if (!stbi__zbuild_huffman(&a->z_distance, lencodes+hlit, hdist)) return 0;
+   stbi__zbuild_multi(a->zlength_multi, lencodes, hlit, 1);
+   stbi__zbuild_multi(a->zdistance_multi, lencodes+hlit, hdist, 0);
    return 1;
 }
 
@@ -4412,17 +5495,15 @@ static int stbi__parse_uncompressed_block(stbi__zbuf *a)
    int len,nlen,k;
    if (a->num_bits & 7)
       stbi__zreceive(a, a->num_bits & 7); // discard
-   // drain the bit-packed data into header
-   k = 0;
-   while (a->num_bits > 0) {
-      header[k++] = (stbi_uc) (a->code_buffer & 255); // suppress MSVC run-time check
-      a->code_buffer >>= 8;
-      a->num_bits -= 8;
-   }
-   if (a->num_bits < 0) return stbi__err("zlib corrupt","Corrupt PNG");
-   // now fill header the normal way
-   while (k < 4)
-      header[k++] = stbi__zget8(a);
+   // a stored block can't start inside the zero padding added at the end
+   if (a->num_bits < 0 || a->hit_zeof_once) return stbi__err("zlib corrupt","Corrupt PNG");
+   // the whole bytes left in the bit buffer came straight from the input, so
+   // step back over them and read the header from there
+   a->zbuffer -= a->num_bits >> 3;
+   a->code_buffer = 0;
+   a->num_bits = 0;
+   for (k=0; k < 4; ++k)
+      header[k] = stbi__zget8(a);
    len  = header[1] * 256 + header[0];
    nlen = header[3] * 256 + header[2];
    if (nlen != (len ^ 0xffff)) return stbi__err("zlib corrupt","Corrupt PNG");
@@ -4498,6 +5579,8 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
             // use fixed code lengths
             if (!stbi__zbuild_huffman(&a->z_length  , stbi__zdefault_length  , STBI__ZNSYMS)) return 0;
             if (!stbi__zbuild_huffman(&a->z_distance, stbi__zdefault_distance,  32)) return 0;
+            stbi__zbuild_multi(a->zlength_multi  , stbi__zdefault_length  , STBI__ZNSYMS, 1);
+            stbi__zbuild_multi(a->zdistance_multi, stbi__zdefault_distance,  32, 0);
          } else {
             if (!stbi__compute_huffman_codes(a)) return 0;
          }
@@ -4669,6 +5752,127 @@ static int stbi__paeth(int a, int b, int c)
 
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
+#ifdef STBI_SSE2
+stbi_inline static __m128i stbi__png_load4(const stbi_uc *p)
+{
+   int v;
+   memcpy(&v, p, 4);
+   return _mm_cvtsi32_si128(v);
+}
+
+stbi_inline static void stbi__png_store4(stbi_uc *p, __m128i v)
+{
+   int t = _mm_cvtsi128_si32(v);
+   memcpy(p, &t, 4);
+}
+
+// select x where mask is set, else y
+stbi_inline static __m128i stbi__png_select(__m128i mask, __m128i x, __m128i y)
+{
+   return _mm_or_si128(_mm_and_si128(mask, x), _mm_andnot_si128(mask, y));
+}
+
+stbi_inline static __m128i stbi__png_abs16(__m128i x)
+{
+   return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+// reconstructs one scanline of 8-bit pixels with n = 3 or 4 bytes, same
+// results as the scalar filters. Sub runs a prefix sum over a register;
+// Avg and Paeth depend on the reconstructed pixel to the left and go one
+// pixel per step with 4-byte accesses. with 3-byte pixels the fourth byte
+// written is the next pixel's first byte, which is then overwritten, so the
+// vector loops stop short of the row end and the scalar tail finishes it.
+static void stbi__png_unfilter_sse2(int filter, stbi_uc *cur, const stbi_uc *raw, const stbi_uc *prior, int nk, int n)
+{
+   __m128i zero = _mm_setzero_si128();
+   int k = 0;
+
+   switch (filter) {
+   case STBI__F_sub: {
+      __m128i a = zero; // last reconstructed pixel, repeated
+      if (n == 4) {
+         for (; k + 16 <= nk; k += 16) {
+            __m128i x = _mm_loadu_si128((const __m128i *) (raw + k));
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+            x = _mm_add_epi8(x, a);
+            _mm_storeu_si128((__m128i *) (cur + k), x);
+            a = _mm_shuffle_epi32(x, 0xff);
+         }
+      } else {
+         __m128i mask = _mm_cvtsi32_si128(0xffffff);
+         for (; k + 16 <= nk; k += 15) {
+            __m128i x = _mm_loadu_si128((const __m128i *) (raw + k));
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 3));
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 12));
+            x = _mm_add_epi8(x, a);
+            _mm_storeu_si128((__m128i *) (cur + k), x);
+            a = _mm_and_si128(_mm_srli_si128(x, 12), mask);
+            a = _mm_or_si128(a, _mm_slli_si128(a, 3));
+            a = _mm_or_si128(a, _mm_slli_si128(a, 6));
+            a = _mm_or_si128(a, _mm_slli_si128(a, 12));
+         }
+      }
+      for (; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + (k < n ? 0 : cur[k-n]));
+      break;
+   }
+   case STBI__F_up:
+      for (; k + 16 <= nk; k += 16) {
+         __m128i x = _mm_loadu_si128((const __m128i *) (raw + k));
+         __m128i b = _mm_loadu_si128((const __m128i *) (prior + k));
+         _mm_storeu_si128((__m128i *) (cur + k), _mm_add_epi8(x, b));
+      }
+      for (; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+      break;
+   case STBI__F_avg:
+   case STBI__F_avg_first: {
+      // floor((a+b)/2) = avg_epu8(a,b) - ((a^b)&1)
+      __m128i one = _mm_set1_epi8(1);
+      __m128i a = zero;
+      int first = (filter == STBI__F_avg_first);
+      for (; k + 4 <= nk; k += n) {
+         __m128i b = first ? zero : stbi__png_load4(prior + k);
+         __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+         a = _mm_add_epi8(avg, stbi__png_load4(raw + k));
+         stbi__png_store4(cur + k, a);
+      }
+      for (; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + (((first ? 0 : prior[k]) + (k < n ? 0 : cur[k-n])) >> 1));
+      break;
+   }
+   case STBI__F_paeth: {
+      // left (a), above (b) and above-left (c) widened to 16 bits; same tie
+      // order as the spec: a, then b, then c
+      __m128i a = zero, c = zero;
+      for (; k + 4 <= nk; k += n) {
+         __m128i b = _mm_unpacklo_epi8(stbi__png_load4(prior + k), zero);
+         __m128i pa = _mm_sub_epi16(b, c); // p - a
+         __m128i pb = _mm_sub_epi16(a, c); // p - b
+         __m128i pc = _mm_add_epi16(pa, pb); // p - c
+         __m128i smallest, nearest;
+         pa = stbi__png_abs16(pa);
+         pb = stbi__png_abs16(pb);
+         pc = stbi__png_abs16(pc);
+         smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+         nearest = stbi__png_select(_mm_cmpeq_epi16(pa, smallest), a,
+                   stbi__png_select(_mm_cmpeq_epi16(pb, smallest), b, c));
+         nearest = _mm_add_epi8(_mm_packus_epi16(nearest, nearest), stbi__png_load4(raw + k));
+         stbi__png_store4(cur + k, nearest);
+         a = _mm_unpacklo_epi8(nearest, zero);
+         c = b;
+      }
+      for (; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + (k < n ? prior[k] : stbi__paeth(cur[k-n], prior[k], prior[k-n])));
+      break;
+   }
+   }
+}
+#endif
+
 // adds an extra all-255 alpha channel
 // dest == src is legal
 // img_n must be 1 or 3
@@ -4703,6 +5907,7 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
    int all_ok = 1;
    int k;
    int img_n = s->img_n; // copy it into a local for later
+   int expand_simd = depth == 8 && img_n == 3 && out_n == 4 && stbi__rgb_to_rgba_simd();
 
    int output_bytes = out_n*bytes;
    int filter_bytes = img_n*bytes;
@@ -4752,6 +5957,11 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       if (j == 0) filter = first_row_filter[filter];
 
       // perform actual filtering
+#ifdef STBI_SSE2
+      if (depth == 8 && (filter_bytes == 3 || filter_bytes == 4) && filter != STBI__F_none && stbi__sse2_available()) {
+         stbi__png_unfilter_sse2(filter, cur, raw, prior, nk, filter_bytes);
+      } else
+#endif
       switch (filter) {
       case STBI__F_none:
          memcpy(cur, raw, nk);
@@ -4822,6 +6032,8 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       } else if (depth == 8) {
          if (img_n == out_n)
             memcpy(dest, cur, x*img_n);
+         else if (img_n == 3)
+            stbi__rgb_to_rgba(dest, cur, x, expand_simd);
          else
             stbi__create_png_alpha_expand8(dest, cur, x, img_n);
       } else if (depth == 16) {
@@ -7709,6 +8921,21 @@ STBIDEF int stbi_info_from_file(FILE *f, int *x, int *y, int *comp)
    return r;
 }
 
+STBIDEF int stbi_info_scaled(char const *filename, int scale_shift, int *x, int *y, int *comp)
+{
+   FILE *f;
+   stbi__context s;
+   int result;
+   if (scale_shift < 0 || scale_shift > 3) return stbi__err("bad scale", "scale_shift must be 0 to 3");
+   f = stbi__fopen(filename, "rb");
+   if (!f) return stbi__err("can't fopen", "Unable to open file");
+   stbi__start_file(&s,f);
+   s.jpeg_scale_shift = scale_shift;
+   result = stbi__info_main(&s,x,y,comp);
+   fclose(f);
+   return result;
+}
+
 STBIDEF int stbi_is_16_bit(char const *filename)
 {
     FILE *f = stbi__fopen(filename, "rb");
@@ -7738,6 +8965,15 @@ STBIDEF int stbi_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y
    return stbi__info_main(&s,x,y,comp);
 }
 
+STBIDEF int stbi_info_from_memory_scaled(stbi_uc const *buffer, int len, int scale_shift, int *x, int *y, int *comp)
+{
+   stbi__context s;
+   if (scale_shift < 0 || scale_shift > 3) return stbi__err("bad scale", "scale_shift must be 0 to 3");
+   stbi__start_mem(&s,buffer,len);
+   s.jpeg_scale_shift = scale_shift;
+   return stbi__info_main(&s,x,y,comp);
+}
+
 STBIDEF int stbi_info_from_callbacks(stbi_io_callbacks const *c, void *user, int *x, int *y, int *comp)
 {
    stbi__context s;
@@ -0,0 +1,222 @@
+#include <GL/glew.h>
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "texture.h"
+#include "texture_cache.h"
+#include "texture_compress.h"
+#include "texture_mips.h"
+#include "parallel.h"
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Bump whenever the baked output changes so old caches get rebuilt
+const unsigned int bakeVersion = 2;
+const MipFilter bakeFilter = MIP_FILTER_KAISER;
+
+unsigned int cacheSettingsKey(TextureKind kind, bool compress, const TextureBakeOptions& options) {
+    return (bakeVersion << 16) | (static_cast<unsigned int>(bakeFilter) << 8) | (compress ? 0x80u : 0u)
+        | (options.keepAlpha ? 0x40u : 0u) | static_cast<unsigned int>(kind);
+}
+
+// Resized and size-limited bakes get their own cache file
+std::string cacheVariantName(const TextureBakeOptions& options) {
+    std::string name;
+    if (options.width > 0 && options.height > 0)
+        name = std::to_string(options.width) + "x" + std::to_string(options.height);
+    if (options.maxSize > 0)
+        name += (name.empty() ? "max" : ".max") + std::to_string(options.maxSize);
+    return name;
+}
+
+int scaledSize(int size, int shift) {
+    return (size + (1 << shift) - 1) >> shift;
+}
+
+// Picks how far a JPEG is shrunk while decoding (stbi_load_into_scaled, 1/2^n
+// for n up to 3) and reads the size the decode will come out at: as small as
+// possible without going under a resize target, and down to maxSize
+// otherwise. Other formats ignore the shift and come out at full size.
+bool decodeSize(const char* path, const TextureBakeOptions& options, int& shift, int& width, int& height,
+                int& channels) {
+    if (!stbi_info(path, &width, &height, &channels))
+        return false;
+    shift = 0;
+    if (options.width > 0 && options.height > 0) {
+        while (shift < 3 && scaledSize(width, shift + 1) >= options.width && scaledSize(height, shift + 1) >= options.height)
+            ++shift;
+    } else if (options.maxSize > 0) {
+        while (shift < 3 && std::max(scaledSize(width, shift), scaledSize(height, shift)) > options.maxSize)
+            ++shift;
+    }
+    return shift == 0 || stbi_info_scaled(path, shift, &width, &height, &channels);
+}
+
+// Halves a size the way mip levels do until it fits maxSize (when above 0),
+// returning how many levels that took
+size_t halveToMaxSize(int& width, int& height, int maxSize) {
+    size_t count = 0;
+    while (maxSize > 0 && std::max(width, height) > maxSize) {
+        width = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+        ++count;
+    }
+    return count;
+}
+
+// Large JPEGs decode on the shared pool too: restart intervals in parallel,
+// or the IDCT and colour conversion alongside the entropy decoding
+void stbiParallelFor(void*, int count, void (*task)(void* taskUser, int i), void* taskUser) {
+    ThreadPool::shared().parallelFor(count, [&](int i) { task(taskUser, i); });
+}
+
+struct StbiThreads {
+    StbiThreads() { stbi_set_parallel_for(stbiParallelFor, nullptr); }
+} stbiThreads;
+
+MipSpace mipSpace(TextureKind kind) {
+    return kind == TEXTURE_COLOR ? MIP_SPACE_SRGB : MIP_SPACE_NORMAL;
+}
+
+bool usesAlpha(const unsigned char* rgba, size_t pixels) {
+    for (size_t i = 0; i < pixels; ++i)
+        if (rgba[i * 4 + 3] != 255)
+            return true;
+    return false;
+}
+
+// alphaUsed only matters for images that have an alpha channel
+BlockFormat blockFormat(TextureKind kind, bool alphaChannel, bool alphaUsed) {
+    if (kind == TEXTURE_NORMAL_RG)
+        return BLOCK_BC5;
+    return alphaChannel && alphaUsed ? BLOCK_BC3 : BLOCK_BC1;
+}
+
+// Decodes the image, filters its mip chain and, when asked, block-compresses
+// every level
+bool bakeTexture(const char* path, TextureKind kind, bool compress, const TextureBakeOptions& options,
+                 TextureCacheEntry& entry) {
+    // Decode straight into the buffer that becomes mip level 0
+    int shift, width, height, nrChannels;
+    if (!decodeSize(path, options, shift, width, height, nrChannels))
+        return false;
+    std::vector<unsigned char> pixels(static_cast<size_t>(width) * height * 4);
+    if (!stbi_load_into_scaled(path, shift, pixels.data(), pixels.size(), &width, &height, &nrChannels, 4))
+        return false;
+
+    std::vector<MipLevel> mips;
+    if (options.width > 0 && options.height > 0 && (options.width != width || options.height != height)) {
+        std::vector<unsigned char> resized;
+        resizeImage(pixels.data(), width, height, options.width, options.height, bakeFilter, mipSpace(kind), resized);
+        std::vector<unsigned char>().swap(pixels);
+        width = options.width;
+        height = options.height;
+        buildMipChain(std::move(resized), width, height, bakeFilter, mipSpace(kind), mips);
+    } else {
+        buildMipChain(std::move(pixels), width, height, bakeFilter, mipSpace(kind), mips);
+        // what the decode scale couldn't take off (non-JPEGs, or past 1/8)
+        if (size_t over = halveToMaxSize(width, height, options.maxSize))
+            mips.erase(mips.begin(), mips.begin() + over);
+    }
+
+    entry.levels.clear();
+    entry.levels.resize(mips.size());
+    if (!compress) {
+        entry.glFormat = GL_RGBA8;
+        entry.compressed = false;
+        for (size_t i = 0; i < mips.size(); ++i) {
+            entry.levels[i].width = mips[i].width;
+            entry.levels[i].height = mips[i].height;
+            entry.levels[i].data.swap(mips[i].rgba);
+        }
+        return true;
+    }
+
+    bool alphaChannel = nrChannels == 4;
+    BlockFormat format = blockFormat(kind, alphaChannel,
+                                     options.keepAlpha || usesAlpha(mips[0].rgba.data(), static_cast<size_t>(width) * height));
+
+    entry.glFormat = blockGLFormat(format);
+    entry.compressed = true;
+    for (size_t i = 0; i < mips.size(); ++i) {
+        TextureCacheLevel& level = entry.levels[i];
+        level.width = mips[i].width;
+        level.height = mips[i].height;
+        level.data.resize(compressedSize(format, level.width, level.height));
+        compressImage(mips[i].rgba.data(), level.width, level.height, format, level.data.data());
+    }
+    return true;
+}
+
+void uploadBaked(const TextureCacheEntry& entry) {
+    for (size_t i = 0; i < entry.levels.size(); ++i) {
+        const TextureCacheLevel& level = entry.levels[i];
+        if (entry.compressed)
+            glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(i), entry.glFormat, level.width, level.height, 0,
+                                   static_cast<GLsizei>(level.data.size()), level.data.data());
+        else
+            glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(i), entry.glFormat, level.width, level.height, 0,
+                         GL_RGBA, GL_UNSIGNED_BYTE, level.data.data());
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(entry.levels.size()) - 1);
+}
+
+}
+
+bool loadTextureData(const char* path, TextureKind kind, bool compress, TextureCacheEntry& entry,
+                     const TextureBakeOptions& options) {
+    unsigned int key = cacheSettingsKey(kind, compress, options);
+    std::string variant = cacheVariantName(options);
+    const char* cacheVariant = variant.empty() ? nullptr : variant.c_str();
+
+    if (readTextureCache(path, key, entry, cacheVariant))
+        return true;
+    if (!bakeTexture(path, kind, compress, options, entry))
+        return false;
+    if (!writeTextureCache(path, key, entry, cacheVariant))
+        std::cerr << "Failed to write texture cache " << textureCachePath(path, cacheVariant) << std::endl;
+    return true;
+}
+
+bool openTextureData(const char* path, TextureKind kind, bool compress, TextureCacheReader& reader,
+                     TextureCacheEntry& entry, const TextureBakeOptions& options) {
+    std::string variant = cacheVariantName(options);
+    return reader.open(path, cacheSettingsKey(kind, compress, options), entry,
+                       variant.empty() ? nullptr : variant.c_str());
+}
+
+bool peekTexture(const char* path, TextureKind kind, bool compress, int& width, int& height, unsigned int& glFormat,
+                 int maxSize) {
+    TextureBakeOptions options;
+    options.maxSize = maxSize;
+    int shift, nrChannels;
+    if (!decodeSize(path, options, shift, width, height, nrChannels))
+        return false;
+    halveToMaxSize(width, height, maxSize);
+    glFormat = compress ? blockGLFormat(blockFormat(kind, nrChannels == 4, true)) : GL_RGBA8;
+    return true;
+}
+
+unsigned int loadTexture(const char *path, TextureKind kind, int maxSize) {
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+
+    TextureBakeOptions options;
+    options.maxSize = maxSize;
+    TextureCacheEntry entry;
+    if (loadTextureData(path, kind, GLEW_EXT_texture_compression_s3tc != 0, entry, options)) {
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        uploadBaked(entry);
+    } else {
+        std::cerr << "Failed to load texture" << std::endl;
+    }
+    return textureID;
+}
@@ -0,0 +1,47 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+// What the texel data means to the shaders; picks the compressed format
+enum TextureKind {
+    TEXTURE_COLOR,    // diffuse colour, BC1 (or BC3 when the alpha is used)
+    TEXTURE_NORMAL,   // tangent-space normal map sampled as RGB, BC1
+    TEXTURE_NORMAL_RG // normal map with only XY sampled (Z rebuilt in the shader), BC5
+};
+
+// Loads an image as a mipmapped GL_TEXTURE_2D. The mip chain is filtered on
+// the CPU (in linear light for colour, renormalized for normal maps),
+// block-compressed when S3TC is available and cached next to the source file,
+// so later launches upload it without decoding the image. A maxSize above 0
+// caps the larger side of level 0 (halving until it fits); JPEGs are then
+// decoded at reduced scale instead of at full size.
+unsigned int loadTexture(const char *path, TextureKind kind = TEXTURE_COLOR, int maxSize = 0);
+
+struct TextureCacheEntry;
+struct TextureCacheReader;
+
+// Changes to how loadTextureData bakes an image (texture arrays need every
+// layer at the same size and format)
+struct TextureBakeOptions {
+    int width = 0;          // resample the image to this size first; 0 keeps its own
+    int height = 0;
+    bool keepAlpha = false; // store alpha even when every texel is opaque (BC3, not BC1)
+    int maxSize = 0;        // halve the image until its larger side fits; 0 keeps its own
+};
+
+// The CPU half of loadTexture: reads the cached chain for path, or bakes and
+// caches it. Makes no GL calls, so it can run on a loader thread; compress
+// picks block compression (pass whether S3TC is available).
+bool loadTextureData(const char* path, TextureKind kind, bool compress, TextureCacheEntry& entry,
+                     const TextureBakeOptions& options = TextureBakeOptions());
+
+// Opens the cache loadTextureData would read, leaving the level data for the
+// caller to read where it wants it. Fails when the image needs baking first.
+bool openTextureData(const char* path, TextureKind kind, bool compress, TextureCacheReader& reader,
+                     TextureCacheEntry& entry, const TextureBakeOptions& options = TextureBakeOptions());
+
+// Reads only the image header: its size after the maxSize limit, and the
+// internal format a bake with keepAlpha set will produce
+bool peekTexture(const char* path, TextureKind kind, bool compress, int& width, int& height, unsigned int& glFormat,
+                 int maxSize = 0);
+
+#endif
@@ -0,0 +1,285 @@
+// Texture loading benchmark (the "Benchmark" build target). Puts every image
+// the scene ships with through stbi_load, stbi_load_from_memory and
+// loadTexture, and times the bake, mip generation and upload on their own,
+// so each part of the load cost can be tracked across builds. Prints JSON to
+// stdout, or writes it to the file given as the first argument; the second
+// argument sets the runs per measurement (the median is reported).
+//
+//     texture_bench [output.json] [runs]
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include "stb_image.h"
+#include "texture.h"
+#include "texture_cache.h"
+#include "texture_compress.h"
+#include "texture_mips.h"
+#include "parallel.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+struct BenchImage {
+    const char* path;
+    TextureKind kind;
+};
+
+const BenchImage benchImages[] = {
+    {"terrain_texture.png", TEXTURE_COLOR},
+    {"terrainpls.png", TEXTURE_COLOR},
+    {"Round_table_texture_.jpg", TEXTURE_COLOR},
+    {"Round_table_texture_.png", TEXTURE_COLOR},
+    {"Round table texture .jpg", TEXTURE_COLOR},
+    {"Round table texture _NRM.jpg", TEXTURE_NORMAL},
+    {"white.jpg", TEXTURE_COLOR},
+    {"nebo.jpg", TEXTURE_COLOR},
+    {"Beach_Umbrella_v1_L3.123c27e1c910-e8d1-402a-92ef-8deb29426cbe/Beach_Umbrella_v1_L3.123c27e1c910-e8d1-402a-92ef-8deb29426cbe/Beach_Umbrella_1.jpg", TEXTURE_COLOR},
+    {"Beach_Umbrella_v1_L3.123c27e1c910-e8d1-402a-92ef-8deb29426cbe/Beach_Umbrella_v1_L3.123c27e1c910-e8d1-402a-92ef-8deb29426cbe/Beach_Umbrella_2.jpg", TEXTURE_COLOR},
+};
+
+double milliseconds(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Median time of runs calls to fn, in milliseconds. setup, when given, runs
+// before each call and is not timed.
+double timeMedian(int runs, const std::function<void()>& fn, const std::function<void()>& setup = nullptr) {
+    std::vector<double> times;
+    for (int i = 0; i < runs; ++i) {
+        if (setup)
+            setup();
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        times.push_back(milliseconds(std::chrono::steady_clock::now() - start));
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+// Peak resident memory of the process so far
+size_t peakMemoryBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+bool readFile(const char* path, std::vector<unsigned char>& data) {
+    FILE* file = std::fopen(path, "rb");
+    if (!file)
+        return false;
+    std::fseek(file, 0, SEEK_END);
+    long size = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+    data.resize(size > 0 ? static_cast<size_t>(size) : 0);
+    bool ok = size >= 0 && std::fread(data.data(), 1, data.size(), file) == data.size();
+    std::fclose(file);
+    return ok;
+}
+
+bool writeFile(const std::string& path, const std::vector<unsigned char>& data) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    bool ok = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+    return std::fclose(file) == 0 && ok;
+}
+
+std::string jsonString(const char* text) {
+    std::string out = "\"";
+    for (const char* c = text; *c; ++c) {
+        if (*c == '"' || *c == '\\')
+            out += '\\';
+        out += *c;
+    }
+    return out + "\"";
+}
+
+// Megapixels per second for one decode of width x height taking ms
+double megapixelsPerSecond(int width, int height, double ms) {
+    return ms > 0.0 ? static_cast<double>(width) * height / 1e6 / (ms / 1e3) : 0.0;
+}
+
+// Uploads a baked chain the way loadTexture does and waits for GL to take it
+void uploadChain(const TextureCacheEntry& entry) {
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    for (size_t i = 0; i < entry.levels.size(); ++i) {
+        const TextureCacheLevel& level = entry.levels[i];
+        if (entry.compressed)
+            glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(i), entry.glFormat, level.width, level.height, 0,
+                                   static_cast<GLsizei>(level.data.size()), level.data.data());
+        else
+            glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(i), entry.glFormat, level.width, level.height, 0,
+                         GL_RGBA, GL_UNSIGNED_BYTE, level.data.data());
+    }
+    glFinish();
+    glDeleteTextures(1, &texture);
+}
+
+// Times every stage for one image and appends its JSON object to out
+bool benchImage(const BenchImage& image, int runs, bool compress, std::string& out) {
+    std::vector<unsigned char> file;
+    int width, height, channels;
+    if (!readFile(image.path, file) || !stbi_info(image.path, &width, &height, &channels)) {
+        std::fprintf(stderr, "Skipping %s: %s\n", image.path, stbi_failure_reason() ? stbi_failure_reason() : "not found");
+        return false;
+    }
+
+    double loadMs = timeMedian(runs, [&] { stbi_image_free(stbi_load(image.path, &width, &height, &channels, 4)); });
+    double memoryMs = timeMedian(runs, [&] {
+        stbi_image_free(stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &width, &height, &channels, 4));
+    });
+
+    // Mip generation and compression on the decoded image, as the bake runs them
+    unsigned char* decoded = stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &width, &height, &channels, 4);
+    if (!decoded)
+        return false;
+    std::vector<unsigned char> pixels(decoded, decoded + static_cast<size_t>(width) * height * 4);
+    stbi_image_free(decoded);
+    MipSpace space = image.kind == TEXTURE_COLOR ? MIP_SPACE_SRGB : MIP_SPACE_NORMAL;
+    std::vector<MipLevel> mips;
+    std::vector<unsigned char> input;
+    double mipMs = timeMedian(runs, [&] { buildMipChain(std::move(input), width, height, MIP_FILTER_KAISER, space, mips); },
+                              [&] { input = pixels; });
+    double compressMs = 0.0;
+    if (compress) {
+        std::vector<unsigned char> blocks;
+        compressMs = timeMedian(runs, [&] {
+            for (const MipLevel& level : mips) {
+                blocks.resize(compressedSize(BLOCK_BC1, level.width, level.height));
+                compressImage(level.rgba.data(), level.width, level.height, BLOCK_BC1, blocks.data());
+            }
+        });
+    }
+    std::vector<MipLevel>().swap(mips);
+    std::vector<unsigned char>().swap(pixels);
+
+    // The app's path, on a scratch copy of the image so the cold load always
+    // bakes and the app's own cache is left alone. That bake (decode, mips,
+    // compression and the cache write, no GL) is timed once on its own, and
+    // the upload below separately. The warm loads read the cache it left.
+    std::string scratch = std::string(image.path) + ".bench";
+    std::string scratchCache = textureCachePath(scratch.c_str());
+    std::remove(scratchCache.c_str());
+    if (!writeFile(scratch, file)) {
+        std::fprintf(stderr, "Skipping %s: cannot write %s\n", image.path, scratch.c_str());
+        return false;
+    }
+    TextureCacheEntry entry;
+    auto start = std::chrono::steady_clock::now();
+    bool baked = loadTextureData(scratch.c_str(), image.kind, compress, entry);
+    double bakeMs = milliseconds(std::chrono::steady_clock::now() - start);
+    double warmMs = 0.0;
+    size_t uploadBytes = 0;
+    double uploadMs = 0.0;
+    if (baked) {
+        warmMs = timeMedian(runs, [&] {
+            unsigned int warm = loadTexture(scratch.c_str(), image.kind);
+            glFinish();
+            glDeleteTextures(1, &warm);
+        });
+        if (loadTextureData(scratch.c_str(), image.kind, compress, entry)) {
+            for (const TextureCacheLevel& level : entry.levels)
+                uploadBytes += level.data.size();
+            uploadMs = timeMedian(runs, [&] { uploadChain(entry); });
+        }
+    }
+    std::remove(scratch.c_str());
+    std::remove(scratchCache.c_str());
+    if (!baked)
+        return false;
+
+    char buffer[1024];
+    std::snprintf(buffer, sizeof(buffer),
+                  "    {\n"
+                  "      \"path\": %s,\n"
+                  "      \"fileBytes\": %zu,\n"
+                  "      \"width\": %d,\n"
+                  "      \"height\": %d,\n"
+                  "      \"channels\": %d,\n"
+                  "      \"stbiLoad\": {\"ms\": %.3f, \"mpPerSec\": %.2f},\n"
+                  "      \"stbiLoadFromMemory\": {\"ms\": %.3f, \"mpPerSec\": %.2f},\n"
+                  "      \"mipChainMs\": %.3f,\n"
+                  "      \"compressMs\": %.3f,\n"
+                  "      \"loadTexture\": {\"bakeMs\": %.3f, \"warmMs\": %.3f},\n"
+                  "      \"upload\": {\"bytes\": %zu, \"ms\": %.3f},\n"
+                  "      \"peakMemoryBytes\": %zu\n"
+                  "    }",
+                  jsonString(image.path).c_str(), file.size(), width, height, channels,
+                  loadMs, megapixelsPerSecond(width, height, loadMs),
+                  memoryMs, megapixelsPerSecond(width, height, memoryMs),
+                  mipMs, compressMs, bakeMs, warmMs, uploadBytes, uploadMs,
+                  peakMemoryBytes());
+    out += buffer;
+    return true;
+}
+
+}
+
+int main(int argc, char** argv) {
+    const char* outputPath = argc > 1 ? argv[1] : nullptr;
+    int runs = argc > 2 ? std::max(std::atoi(argv[2]), 1) : 5;
+
+    // Uploads need a context; the window is never shown
+    glfwInit();
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* window = glfwCreateWindow(64, 64, "texture_bench", nullptr, nullptr);
+    if (!window) {
+        std::fprintf(stderr, "Failed to create a GL context\n");
+        return 1;
+    }
+    glfwMakeContextCurrent(window);
+    glewInit();
+    bool compress = GLEW_EXT_texture_compression_s3tc != 0;
+
+    std::string images;
+    for (const BenchImage& image : benchImages) {
+        std::string entry;
+        if (!benchImage(image, runs, compress, entry))
+            continue;
+        images += images.empty() ? "" : ",\n";
+        images += entry;
+    }
+
+    std::string json = "{\n";
+    json += "  \"compiler\": " + jsonString(__VERSION__) + ",\n";
+    json += "  \"renderer\": " + jsonString(reinterpret_cast<const char*>(glGetString(GL_RENDERER))) + ",\n";
+    json += "  \"threads\": " + std::to_string(ThreadPool::shared().size()) + ",\n";
+    json += "  \"compressed\": " + std::string(compress ? "true" : "false") + ",\n";
+    json += "  \"runs\": " + std::to_string(runs) + ",\n";
+    json += "  \"images\": [\n" + images + "\n  ],\n";
+    json += "  \"peakMemoryBytes\": " + std::to_string(peakMemoryBytes()) + "\n}\n";
+
+    FILE* output = outputPath ? std::fopen(outputPath, "w") : stdout;
+    if (!output) {
+        std::fprintf(stderr, "Failed to open %s\n", outputPath);
+        return 1;
+    }
+    std::fputs(json.c_str(), output);
+    if (outputPath)
+        std::fclose(output);
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return 0;
+}
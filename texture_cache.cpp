@@ -0,0 +1,206 @@
+#include "texture_cache.h"
+#include "texture_compress.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+namespace {
+
+const char cacheMagic[4] = {'T', 'X', 'C', '1'};
+const uint32_t cacheVersion = 1;
+
+struct CacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    uint32_t settingsKey;
+    uint32_t glFormat;
+    uint32_t compressed;
+    uint32_t levelCount;
+};
+
+struct CacheLevelRecord {
+    uint32_t width;
+    uint32_t height;
+    uint64_t offset;
+    uint64_t size;
+};
+
+// Bytes the bake writes for a width x height level: 4x4 blocks of the
+// compressed formats, RGBA8 otherwise. 0 for a format it never writes.
+uint64_t levelDataBytes(unsigned int glFormat, bool compressed, int width, int height) {
+    if (!compressed)
+        return static_cast<uint64_t>(width) * height * 4;
+    const BlockFormat formats[] = {BLOCK_BC1, BLOCK_BC3, BLOCK_BC5};
+    for (BlockFormat format : formats)
+        if (blockGLFormat(format) == glFormat)
+            return compressedSize(format, width, height);
+    return 0;
+}
+
+// The level table describes a mip chain of sizes that match the format
+bool validLevels(const CacheHeader& header, const std::vector<CacheLevelRecord>& records) {
+    for (size_t i = 0; i < records.size(); ++i) {
+        const CacheLevelRecord& record = records[i];
+        if (record.width == 0 || record.height == 0 || record.width > 65536 || record.height > 65536)
+            return false;
+        if (i > 0 && (record.width != std::max(records[i - 1].width / 2, 1u)
+                      || record.height != std::max(records[i - 1].height / 2, 1u)))
+            return false;
+        uint64_t bytes = levelDataBytes(header.glFormat, header.compressed != 0, static_cast<int>(record.width),
+                                        static_cast<int>(record.height));
+        if (bytes == 0 || record.size != bytes)
+            return false;
+    }
+    return true;
+}
+
+}
+
+bool textureSourceStamp(const char* sourcePath, uint64_t& size, int64_t& time) {
+    struct stat st;
+    if (stat(sourcePath, &st) != 0)
+        return false;
+    size = static_cast<uint64_t>(st.st_size);
+    time = static_cast<int64_t>(st.st_mtime);
+    return true;
+}
+
+bool seekFile(std::FILE* file, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+    return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+}
+
+std::string textureCachePath(const char* sourcePath, const char* variant) {
+    std::string path(sourcePath);
+    if (variant)
+        path += std::string(".") + variant;
+    return path + ".txc";
+}
+
+TextureCacheReader::~TextureCacheReader() {
+    if (file)
+        std::fclose(file);
+}
+
+bool TextureCacheReader::open(const char* sourcePath, unsigned int settingsKey, TextureCacheEntry& entry,
+                              const char* variant) {
+    if (file)
+        std::fclose(file);
+    file = nullptr;
+    levels.clear();
+    entry.levels.clear();
+
+    uint64_t size;
+    int64_t time;
+    if (!textureSourceStamp(sourcePath, size, time))
+        return false;
+
+    file = std::fopen(textureCachePath(sourcePath, variant).c_str(), "rb");
+    if (!file)
+        return false;
+
+    CacheHeader header;
+    bool ok = std::fread(&header, sizeof(header), 1, file) == 1
+        && std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) == 0
+        && header.version == cacheVersion
+        && header.sourceSize == size
+        && header.sourceTime == time
+        && header.settingsKey == settingsKey
+        && header.levelCount > 0 && header.levelCount <= 32;
+
+    std::vector<CacheLevelRecord> records;
+    if (ok) {
+        records.resize(header.levelCount);
+        ok = std::fread(records.data(), sizeof(CacheLevelRecord), records.size(), file) == records.size()
+            && validLevels(header, records);
+    }
+
+    if (!ok) {
+        std::fclose(file);
+        file = nullptr;
+        return false;
+    }
+
+    entry.glFormat = header.glFormat;
+    entry.compressed = header.compressed != 0;
+    entry.levels.resize(records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        entry.levels[i].width = static_cast<int>(records[i].width);
+        entry.levels[i].height = static_cast<int>(records[i].height);
+        levels.push_back({records[i].offset, records[i].size});
+    }
+    return true;
+}
+
+bool TextureCacheReader::readLevel(size_t level, unsigned char* dst) {
+    const Span& span = levels[level];
+    return seekFile(file, span.offset)
+        && std::fread(dst, 1, static_cast<size_t>(span.size), file) == span.size;
+}
+
+bool readTextureCache(const char* sourcePath, unsigned int settingsKey, TextureCacheEntry& entry,
+                      const char* variant) {
+    TextureCacheReader reader;
+    if (!reader.open(sourcePath, settingsKey, entry, variant))
+        return false;
+    for (size_t i = 0; i < entry.levels.size(); ++i) {
+        entry.levels[i].data.resize(reader.levelBytes(i));
+        if (!reader.readLevel(i, entry.levels[i].data.data())) {
+            entry.levels.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool writeTextureCache(const char* sourcePath, unsigned int settingsKey, const TextureCacheEntry& entry,
+                       const char* variant) {
+    CacheHeader header;
+    std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = cacheVersion;
+    if (!textureSourceStamp(sourcePath, header.sourceSize, header.sourceTime))
+        return false;
+    header.settingsKey = settingsKey;
+    header.glFormat = entry.glFormat;
+    header.compressed = entry.compressed ? 1 : 0;
+    header.levelCount = static_cast<uint32_t>(entry.levels.size());
+
+    std::vector<CacheLevelRecord> records(entry.levels.size());
+    uint64_t offset = sizeof(CacheHeader) + records.size() * sizeof(CacheLevelRecord);
+    for (size_t i = 0; i < records.size(); ++i) {
+        records[i].width = static_cast<uint32_t>(entry.levels[i].width);
+        records[i].height = static_cast<uint32_t>(entry.levels[i].height);
+        records[i].offset = offset;
+        records[i].size = entry.levels[i].data.size();
+        offset += records[i].size;
+    }
+
+    // Write under a temporary name so an interrupted bake never leaves a
+    // truncated cache behind
+    std::string path = textureCachePath(sourcePath, variant);
+    std::string tempPath = path + ".tmp";
+    FILE* file = std::fopen(tempPath.c_str(), "wb");
+    if (!file)
+        return false;
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1
+        && std::fwrite(records.data(), sizeof(CacheLevelRecord), records.size(), file) == records.size();
+    for (size_t i = 0; i < entry.levels.size() && ok; ++i)
+        ok = std::fwrite(entry.levels[i].data.data(), 1, entry.levels[i].data.size(), file) == entry.levels[i].data.size();
+    ok = std::fclose(file) == 0 && ok;
+
+    if (ok) {
+        std::remove(path.c_str());
+        ok = std::rename(tempPath.c_str(), path.c_str()) == 0;
+    }
+    if (!ok)
+        std::remove(tempPath.c_str());
+    return ok;
+}
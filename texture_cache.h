@@ -0,0 +1,78 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// One mip level of a baked texture, stored exactly as it is uploaded
+struct TextureCacheLevel {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> data;
+};
+
+// Fully baked texture: every mip level in a GPU-ready format
+struct TextureCacheEntry {
+    unsigned int glFormat = 0; // internal format of the level data
+    bool compressed = false;   // level data goes through glCompressedTexImage2D
+    std::vector<TextureCacheLevel> levels;
+};
+
+// Cache file that sits next to the source image ("image.png" -> "image.png.txc").
+// A variant names a different bake of the same image, such as a resized copy
+// ("image.png.512x512.txc"), so it does not evict the plain one.
+std::string textureCachePath(const char* sourcePath, const char* variant = nullptr);
+
+// Size and modification time of the source image, stored in cache headers to
+// notice when it changes
+bool textureSourceStamp(const char* sourcePath, uint64_t& size, int64_t& time);
+
+// fseek from the start of the file to a 64-bit offset; plain fseek takes a
+// long, which is 32 bits on Windows
+bool seekFile(std::FILE* file, uint64_t offset);
+
+// Loads the cached chain for sourcePath. Fails when the file is missing, was
+// written for other settings (settingsKey), or the source image has changed
+// since it was baked.
+bool readTextureCache(const char* sourcePath, unsigned int settingsKey, TextureCacheEntry& entry,
+                      const char* variant = nullptr);
+
+// Reads a cache file in two steps, so the level data can go straight to
+// memory picked once the sizes are known (such as a mapped pixel buffer)
+struct TextureCacheReader {
+    TextureCacheReader() = default;
+    ~TextureCacheReader();
+
+    TextureCacheReader(const TextureCacheReader&) = delete;
+    TextureCacheReader& operator=(const TextureCacheReader&) = delete;
+
+    // Checks the file like readTextureCache and reads its level table: entry
+    // gets the format and level sizes, with every level's data left empty.
+    // A table whose levels don't form a mip chain, or whose sizes don't match
+    // their dimensions in the format, fails as a stale cache would.
+    bool open(const char* sourcePath, unsigned int settingsKey, TextureCacheEntry& entry,
+              const char* variant = nullptr);
+
+    size_t levelBytes(size_t level) const { return static_cast<size_t>(levels[level].size); }
+
+    // Reads levelBytes(level) bytes to dst
+    bool readLevel(size_t level, unsigned char* dst);
+
+private:
+    struct Span {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    std::FILE* file = nullptr;
+    std::vector<Span> levels;
+};
+
+// Writes the chain next to sourcePath; a failed write only costs a re-bake
+// next launch.
+bool writeTextureCache(const char* sourcePath, unsigned int settingsKey, const TextureCacheEntry& entry,
+                       const char* variant = nullptr);
+
+#endif
@@ -0,0 +1,437 @@
+#include "texture_compress.h"
+#include "parallel.h"
+#include <GL/glew.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXTURE_SSE2
+#endif
+
+namespace {
+
+int mul8bit(int a, int b) {
+    int t = a * b + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+int expand5(int v) { return (v << 3) | (v >> 2); }
+int expand6(int v) { return (v << 2) | (v >> 4); }
+
+unsigned short pack565(int r, int g, int b) {
+    return static_cast<unsigned short>((mul8bit(r, 31) << 11) | (mul8bit(g, 63) << 5) | mul8bit(b, 31));
+}
+
+void unpack565(unsigned short c, int* rgb) {
+    rgb[0] = expand5((c >> 11) & 31);
+    rgb[1] = expand6((c >> 5) & 63);
+    rgb[2] = expand5(c & 31);
+}
+
+// Best 5/6-bit endpoint pair for a flat 8-bit value reached through the
+// 2/3 palette entry; used for single-colour blocks.
+struct SingleColorTables {
+    unsigned char match5[256][2];
+    unsigned char match6[256][2];
+
+    SingleColorTables() {
+        build(match5, 32, expand5);
+        build(match6, 64, expand6);
+    }
+
+    static void build(unsigned char (*table)[2], int size, int (*expand)(int)) {
+        for (int i = 0; i < 256; ++i) {
+            int bestErr = 1 << 30;
+            for (int mx = 0; mx < size; ++mx) {
+                for (int mn = 0; mn < size; ++mn) {
+                    int maxe = expand(mx), mine = expand(mn);
+                    // Small penalty for spread endpoints: decoders round the
+                    // interpolated entry differently
+                    int err = std::abs((2 * maxe + mine) / 3 - i) * 100 + std::abs(maxe - mine) * 3;
+                    if (err < bestErr) {
+                        table[i][0] = static_cast<unsigned char>(mx);
+                        table[i][1] = static_cast<unsigned char>(mn);
+                        bestErr = err;
+                    }
+                }
+            }
+        }
+    }
+};
+
+const SingleColorTables& singleColorTables() {
+    static SingleColorTables tables;
+    return tables;
+}
+
+void buildPalette(unsigned short c0, unsigned short c1, int pal[4][3]) {
+    unpack565(c0, pal[0]);
+    unpack565(c1, pal[1]);
+    for (int k = 0; k < 3; ++k) {
+        pal[2][k] = (2 * pal[0][k] + pal[1][k]) / 3;
+        pal[3][k] = (pal[0][k] + 2 * pal[1][k]) / 3;
+    }
+}
+
+// Projects the 16 pixels on (dr, dg, db)
+void blockDots(const unsigned char* block, int dr, int dg, int db, int* dots) {
+#ifdef TEXTURE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i dir = _mm_setr_epi16(static_cast<short>(dr), static_cast<short>(dg), static_cast<short>(db), 0,
+                                       static_cast<short>(dr), static_cast<short>(dg), static_cast<short>(db), 0);
+    for (int i = 0; i < 4; ++i) {
+        __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i * 16));
+        __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), dir);
+        __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), dir);
+        __m128 even = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 odd = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(3, 1, 3, 1));
+        __m128i sum = _mm_add_epi32(_mm_castps_si128(even), _mm_castps_si128(odd));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dots + i * 4), sum);
+    }
+#else
+    for (int i = 0; i < 16; ++i)
+        dots[i] = block[i * 4 + 0] * dr + block[i * 4 + 1] * dg + block[i * 4 + 2] * db;
+#endif
+}
+
+// Picks the nearest palette entry for every pixel by projecting on the
+// endpoint axis; returns the 2-bit indices packed as in a BC1 block.
+unsigned int matchIndices(const unsigned char* block, const int pal[4][3]) {
+    int dr = pal[0][0] - pal[1][0];
+    int dg = pal[0][1] - pal[1][1];
+    int db = pal[0][2] - pal[1][2];
+
+    int stops[4];
+    for (int i = 0; i < 4; ++i)
+        stops[i] = pal[i][0] * dr + pal[i][1] * dg + pal[i][2] * db;
+
+    // Palette order along the axis is 1, 3, 2, 0
+    int c0Point = stops[1] + stops[3];
+    int halfPoint = stops[3] + stops[2];
+    int c3Point = stops[2] + stops[0];
+
+    int dots[16];
+    blockDots(block, dr, dg, db, dots);
+
+    int bits[16];
+#ifdef TEXTURE_SSE2
+    const __m128i vc0 = _mm_set1_epi32(c0Point);
+    const __m128i vhalf = _mm_set1_epi32(halfPoint);
+    const __m128i vc3 = _mm_set1_epi32(c3Point);
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i two = _mm_set1_epi32(2);
+    const __m128i three = _mm_set1_epi32(3);
+    for (int i = 0; i < 16; i += 4) {
+        __m128i d = _mm_slli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(dots + i)), 1);
+        __m128i ltHalf = _mm_cmplt_epi32(d, vhalf);
+        __m128i ltC0 = _mm_cmplt_epi32(d, vc0);
+        __m128i ltC3 = _mm_cmplt_epi32(d, vc3);
+        __m128i low = _mm_or_si128(_mm_and_si128(ltC0, one), _mm_andnot_si128(ltC0, three));
+        __m128i high = _mm_and_si128(ltC3, two);
+        __m128i b = _mm_or_si128(_mm_and_si128(ltHalf, low), _mm_andnot_si128(ltHalf, high));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(bits + i), b);
+    }
+#else
+    for (int i = 0; i < 16; ++i) {
+        int d = dots[i] * 2;
+        if (d < halfPoint)
+            bits[i] = d < c0Point ? 1 : 3;
+        else
+            bits[i] = d < c3Point ? 2 : 0;
+    }
+#endif
+
+    unsigned int mask = 0;
+    for (int i = 15; i >= 0; --i)
+        mask = (mask << 2) | static_cast<unsigned int>(bits[i]);
+    return mask;
+}
+
+int blockError(const unsigned char* block, const int pal[4][3], unsigned int mask) {
+    int err = 0;
+    for (int i = 0; i < 16; ++i, mask >>= 2) {
+        const int* c = pal[mask & 3];
+        for (int k = 0; k < 3; ++k) {
+            int d = block[i * 4 + k] - c[k];
+            err += d * d;
+        }
+    }
+    return err;
+}
+
+// Least-squares endpoints for the given index assignment
+void refineEndpoints(const unsigned char* block, unsigned int mask, unsigned short* c0, unsigned short* c1) {
+    static const int weight0[4] = {3, 0, 2, 1}; // weight of c0 in thirds per index
+    float at0[3] = {0, 0, 0}, at1[3] = {0, 0, 0};
+    float xx = 0, yy = 0, xy = 0;
+    for (int i = 0; i < 16; ++i, mask >>= 2) {
+        int a = weight0[mask & 3];
+        int b = 3 - a;
+        for (int k = 0; k < 3; ++k) {
+            at0[k] += static_cast<float>(a * block[i * 4 + k]);
+            at1[k] += static_cast<float>(b * block[i * 4 + k]);
+        }
+        xx += static_cast<float>(a * a);
+        yy += static_cast<float>(b * b);
+        xy += static_cast<float>(a * b);
+    }
+
+    float det = xx * yy - xy * xy;
+    if (std::fabs(det) < 1e-6f) {
+        int avg[3];
+        for (int k = 0; k < 3; ++k) {
+            int sum = 0;
+            for (int i = 0; i < 16; ++i)
+                sum += block[i * 4 + k];
+            avg[k] = (sum + 8) / 16;
+        }
+        *c0 = *c1 = pack565(avg[0], avg[1], avg[2]);
+        return;
+    }
+
+    float scale = 3.0f / det;
+    int e0[3], e1[3];
+    for (int k = 0; k < 3; ++k) {
+        float v0 = (at0[k] * yy - at1[k] * xy) * scale;
+        float v1 = (at1[k] * xx - at0[k] * xy) * scale;
+        e0[k] = static_cast<int>(std::min(std::max(v0, 0.0f), 255.0f) + 0.5f);
+        e1[k] = static_cast<int>(std::min(std::max(v1, 0.0f), 255.0f) + 0.5f);
+    }
+    *c0 = pack565(e0[0], e0[1], e0[2]);
+    *c1 = pack565(e1[0], e1[1], e1[2]);
+}
+
+// Principal axis of the block colours, endpoints at its extremes
+void principalEndpoints(const unsigned char* block, unsigned short* c0, unsigned short* c1) {
+    float mean[3] = {0, 0, 0};
+    int mn[3] = {255, 255, 255}, mx[3] = {0, 0, 0};
+    for (int i = 0; i < 16; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            int v = block[i * 4 + k];
+            mean[k] += static_cast<float>(v);
+            mn[k] = std::min(mn[k], v);
+            mx[k] = std::max(mx[k], v);
+        }
+    }
+    for (int k = 0; k < 3; ++k)
+        mean[k] *= 1.0f / 16.0f;
+
+    float cov[6] = {0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < 16; ++i) {
+        float r = block[i * 4 + 0] - mean[0];
+        float g = block[i * 4 + 1] - mean[1];
+        float b = block[i * 4 + 2] - mean[2];
+        cov[0] += r * r;
+        cov[1] += r * g;
+        cov[2] += r * b;
+        cov[3] += g * g;
+        cov[4] += g * b;
+        cov[5] += b * b;
+    }
+
+    // Power iteration seeded with the bounding box diagonal
+    float vr = static_cast<float>(mx[0] - mn[0]);
+    float vg = static_cast<float>(mx[1] - mn[1]);
+    float vb = static_cast<float>(mx[2] - mn[2]);
+    for (int iter = 0; iter < 4; ++iter) {
+        float r = vr * cov[0] + vg * cov[1] + vb * cov[2];
+        float g = vr * cov[1] + vg * cov[3] + vb * cov[4];
+        float b = vr * cov[2] + vg * cov[4] + vb * cov[5];
+        float len = std::max(std::max(std::fabs(r), std::fabs(g)), std::fabs(b));
+        if (len < 1e-4f)
+            break;
+        vr = r / len;
+        vg = g / len;
+        vb = b / len;
+    }
+    if (std::fabs(vr) + std::fabs(vg) + std::fabs(vb) < 1e-4f) {
+        vr = 0.299f;
+        vg = 0.587f;
+        vb = 0.114f;
+    }
+
+    // Scale the axis into the integer range used by blockDots
+    float norm = 512.0f / std::max(std::max(std::fabs(vr), std::fabs(vg)), std::fabs(vb));
+    int dots[16];
+    blockDots(block, static_cast<int>(vr * norm), static_cast<int>(vg * norm), static_cast<int>(vb * norm), dots);
+
+    int minIndex = 0, maxIndex = 0;
+    for (int i = 1; i < 16; ++i) {
+        if (dots[i] < dots[minIndex])
+            minIndex = i;
+        if (dots[i] > dots[maxIndex])
+            maxIndex = i;
+    }
+    const unsigned char* hi = block + maxIndex * 4;
+    const unsigned char* lo = block + minIndex * 4;
+    *c0 = pack565(hi[0], hi[1], hi[2]);
+    *c1 = pack565(lo[0], lo[1], lo[2]);
+}
+
+void writeColorBlock(unsigned short c0, unsigned short c1, unsigned int mask, unsigned char* out) {
+    // Keep c0 > c1 so the block decodes in four-colour mode
+    if (c0 < c1) {
+        std::swap(c0, c1);
+        mask ^= 0x55555555u;
+    }
+    if (c0 == c1)
+        mask = 0;
+    out[0] = static_cast<unsigned char>(c0 & 0xFF);
+    out[1] = static_cast<unsigned char>(c0 >> 8);
+    out[2] = static_cast<unsigned char>(c1 & 0xFF);
+    out[3] = static_cast<unsigned char>(c1 >> 8);
+    for (int i = 0; i < 4; ++i)
+        out[4 + i] = static_cast<unsigned char>(mask >> (8 * i));
+}
+
+void encodeColorBlock(const unsigned char* block, unsigned char* out) {
+    bool solid = true;
+    for (int i = 1; i < 16 && solid; ++i)
+        solid = block[i * 4] == block[0] && block[i * 4 + 1] == block[1] && block[i * 4 + 2] == block[2];
+
+    if (solid) {
+        const SingleColorTables& t = singleColorTables();
+        unsigned short c0 = static_cast<unsigned short>((t.match5[block[0]][0] << 11) | (t.match6[block[1]][0] << 5) | t.match5[block[2]][0]);
+        unsigned short c1 = static_cast<unsigned short>((t.match5[block[0]][1] << 11) | (t.match6[block[1]][1] << 5) | t.match5[block[2]][1]);
+        writeColorBlock(c0, c1, 0xAAAAAAAAu, out);
+        return;
+    }
+
+    unsigned short c0, c1;
+    principalEndpoints(block, &c0, &c1);
+
+    int pal[4][3];
+    buildPalette(c0, c1, pal);
+    unsigned int mask = matchIndices(block, pal);
+    int err = blockError(block, pal, mask);
+
+    for (int iter = 0; iter < 2; ++iter) {
+        unsigned short r0, r1;
+        refineEndpoints(block, mask, &r0, &r1);
+        if (r0 == c0 && r1 == c1)
+            break;
+        buildPalette(r0, r1, pal);
+        unsigned int refinedMask = matchIndices(block, pal);
+        int refinedErr = blockError(block, pal, refinedMask);
+        if (refinedErr >= err)
+            break;
+        c0 = r0;
+        c1 = r1;
+        mask = refinedMask;
+        err = refinedErr;
+    }
+
+    writeColorBlock(c0, c1, mask, out);
+}
+
+// BC4 block for one channel of the RGBA block (alpha of BC3, R/G of BC5)
+void encodeChannelBlock(const unsigned char* block, int channel, unsigned char* out) {
+    int values[16];
+    int mn = 255, mx = 0;
+    for (int i = 0; i < 16; ++i) {
+        values[i] = block[i * 4 + channel];
+        mn = std::min(mn, values[i]);
+        mx = std::max(mx, values[i]);
+    }
+
+    out[0] = static_cast<unsigned char>(mx);
+    out[1] = static_cast<unsigned char>(mn);
+    if (mx == mn) {
+        std::memset(out + 2, 0, 6);
+        return;
+    }
+
+    // Position on the 8-step ramp from mn (0) to mx (7)
+    int steps[16];
+    float scale = 7.0f / static_cast<float>(mx - mn);
+#ifdef TEXTURE_SSE2
+    const __m128 vscale = _mm_set1_ps(scale);
+    const __m128 vmin = _mm_set1_ps(static_cast<float>(mn));
+    const __m128 half = _mm_set1_ps(0.5f);
+    for (int i = 0; i < 16; i += 4) {
+        __m128 v = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i)));
+        __m128 t = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(v, vmin), vscale), half);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(steps + i), _mm_cvttps_epi32(t));
+    }
+#else
+    for (int i = 0; i < 16; ++i)
+        steps[i] = static_cast<int>((values[i] - mn) * scale + 0.5f);
+#endif
+
+    unsigned long long bits = 0;
+    for (int i = 15; i >= 0; --i) {
+        int t = steps[i];
+        int index = t == 7 ? 0 : (t == 0 ? 1 : 8 - t);
+        bits = (bits << 3) | static_cast<unsigned long long>(index);
+    }
+    for (int i = 0; i < 6; ++i)
+        out[2 + i] = static_cast<unsigned char>(bits >> (8 * i));
+}
+
+void loadBlock(const unsigned char* rgba, int width, int height, int bx, int by, unsigned char* block) {
+    int x0 = bx * 4, y0 = by * 4;
+    if (x0 + 4 <= width && y0 + 4 <= height) {
+        for (int y = 0; y < 4; ++y)
+            std::memcpy(block + y * 16, rgba + (static_cast<size_t>(y0 + y) * width + x0) * 4, 16);
+        return;
+    }
+    for (int y = 0; y < 4; ++y) {
+        int sy = std::min(y0 + y, height - 1);
+        for (int x = 0; x < 4; ++x) {
+            int sx = std::min(x0 + x, width - 1);
+            std::memcpy(block + (y * 4 + x) * 4, rgba + (static_cast<size_t>(sy) * width + sx) * 4, 4);
+        }
+    }
+}
+
+}
+
+int blockBytes(BlockFormat format) {
+    return format == BLOCK_BC1 ? 8 : 16;
+}
+
+size_t compressedSize(BlockFormat format, int width, int height) {
+    size_t blocksX = static_cast<size_t>((width + 3) / 4);
+    size_t blocksY = static_cast<size_t>((height + 3) / 4);
+    return blocksX * blocksY * blockBytes(format);
+}
+
+unsigned int blockGLFormat(BlockFormat format) {
+    switch (format) {
+    case BLOCK_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case BLOCK_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case BLOCK_BC5: return GL_COMPRESSED_RG_RGTC2;
+    }
+    return 0;
+}
+
+void compressImage(const unsigned char* rgba, int width, int height, BlockFormat format, unsigned char* out) {
+    int blocksX = (width + 3) / 4;
+    int blocksY = (height + 3) / 4;
+    int bytes = blockBytes(format);
+    singleColorTables(); // build the lookup tables once, before the workers start
+
+    ThreadPool::shared().parallelFor(blocksY, [&](int by) {
+        unsigned char block[64];
+        unsigned char* dst = out + static_cast<size_t>(by) * blocksX * bytes;
+        for (int bx = 0; bx < blocksX; ++bx, dst += bytes) {
+            loadBlock(rgba, width, height, bx, by, block);
+            switch (format) {
+            case BLOCK_BC1:
+                encodeColorBlock(block, dst);
+                break;
+            case BLOCK_BC3:
+                encodeChannelBlock(block, 3, dst);
+                encodeColorBlock(block, dst + 8);
+                break;
+            case BLOCK_BC5:
+                encodeChannelBlock(block, 0, dst);
+                encodeChannelBlock(block, 1, dst + 8);
+                break;
+            }
+        }
+    });
+}
@@ -0,0 +1,27 @@
+#ifndef TEXTURE_COMPRESS_H
+#define TEXTURE_COMPRESS_H
+
+#include <cstddef>
+
+// GPU block-compressed formats produced by the CPU encoder
+enum BlockFormat {
+    BLOCK_BC1, // RGB, 8 bytes per 4x4 block (DXT1)
+    BLOCK_BC3, // RGBA, 16 bytes per 4x4 block (DXT5)
+    BLOCK_BC5  // RG, 16 bytes per 4x4 block (RGTC2), for two-channel normal maps
+};
+
+// Bytes taken by one 4x4 block
+int blockBytes(BlockFormat format);
+
+// Bytes taken by a whole width x height image, partial edge blocks included
+size_t compressedSize(BlockFormat format, int width, int height);
+
+// Internal format to pass to glCompressedTexImage2D
+unsigned int blockGLFormat(BlockFormat format);
+
+// Encodes a tightly packed width x height RGBA8 image into out, which must hold
+// compressedSize(format, width, height) bytes. Edge blocks replicate the last
+// row/column. Block rows are spread over ThreadPool::shared().
+void compressImage(const unsigned char* rgba, int width, int height, BlockFormat format, unsigned char* out);
+
+#endif
@@ -0,0 +1,287 @@
+#include "texture_mips.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXTURE_SSE2
+#endif
+
+namespace {
+
+const float pi = 3.14159265358979f;
+const int rowsPerTask = 16;
+
+// Kaiser window parameters: support in destination texels and shape
+const float kaiserRadius = 2.0f;
+const float kaiserAlpha = 4.0f;
+
+struct Tap {
+    int index;
+    float weight;
+};
+
+struct ColorTables {
+    float toLinear[256];
+    unsigned char toSrgb[16385];
+
+    ColorTables() {
+        for (int i = 0; i < 256; ++i) {
+            float c = i / 255.0f;
+            toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        for (int i = 0; i <= 16384; ++i) {
+            float l = i / 16384.0f;
+            float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+            toSrgb[i] = static_cast<unsigned char>(std::min(std::max(c, 0.0f), 1.0f) * 255.0f + 0.5f);
+        }
+    }
+};
+
+const ColorTables& colorTables() {
+    static ColorTables tables;
+    return tables;
+}
+
+float besselI0(float x) {
+    float sum = 1.0f, term = 1.0f;
+    for (int k = 1; k < 20; ++k) {
+        float t = x / (2.0f * k);
+        term *= t * t;
+        sum += term;
+    }
+    return sum;
+}
+
+float kaiserWeight(float x) {
+    if (std::fabs(x) >= kaiserRadius)
+        return 0.0f;
+    float sinc = x == 0.0f ? 1.0f : std::sin(pi * x) / (pi * x);
+    float t = x / kaiserRadius;
+    return sinc * besselI0(kaiserAlpha * std::sqrt(1.0f - t * t)) / besselI0(kaiserAlpha);
+}
+
+int wrapIndex(int i, int size) {
+    i %= size;
+    return i < 0 ? i + size : i;
+}
+
+// Source taps for every destination texel along one axis
+std::vector<std::vector<Tap>> buildTaps(int srcSize, int dstSize, MipFilter filter) {
+    std::vector<std::vector<Tap>> taps(dstSize);
+    float scale = static_cast<float>(srcSize) / dstSize;
+    for (int d = 0; d < dstSize; ++d) {
+        float center = (d + 0.5f) * scale;
+        std::vector<Tap>& list = taps[d];
+        if (filter == MIP_FILTER_BOX) {
+            float lo = center - scale * 0.5f, hi = center + scale * 0.5f;
+            for (int i = static_cast<int>(std::floor(lo)); i < hi; ++i) {
+                float overlap = std::min(hi, i + 1.0f) - std::max(lo, static_cast<float>(i));
+                if (overlap > 1e-6f)
+                    list.push_back({wrapIndex(i, srcSize), overlap});
+            }
+        } else {
+            // When enlarging, the kernel stays one source texel wide
+            float support = std::max(scale, 1.0f);
+            float radius = kaiserRadius * support;
+            for (int i = static_cast<int>(std::floor(center - radius)); i <= static_cast<int>(std::ceil(center + radius)); ++i) {
+                float w = kaiserWeight((i + 0.5f - center) / support);
+                if (std::fabs(w) > 1e-6f)
+                    list.push_back({wrapIndex(i, srcSize), w});
+            }
+        }
+
+        float sum = 0.0f;
+        for (const Tap& tap : list)
+            sum += tap.weight;
+        for (Tap& tap : list)
+            tap.weight /= sum;
+    }
+    return taps;
+}
+
+void toFloat(const unsigned char* src, size_t pixels, MipSpace space, float* dst) {
+    const ColorTables& tables = colorTables();
+    for (size_t i = 0; i < pixels; ++i) {
+        const unsigned char* p = src + i * 4;
+        float* f = dst + i * 4;
+        for (int k = 0; k < 3; ++k) {
+            if (space == MIP_SPACE_SRGB)
+                f[k] = tables.toLinear[p[k]];
+            else if (space == MIP_SPACE_NORMAL)
+                f[k] = p[k] * (2.0f / 255.0f) - 1.0f;
+            else
+                f[k] = p[k] * (1.0f / 255.0f);
+        }
+        f[3] = p[3] * (1.0f / 255.0f);
+    }
+}
+
+// Clamps colours back into range (the Kaiser lobes overshoot) or
+// renormalizes normals, in place
+void condition(float* pixels, size_t count, MipSpace space) {
+#ifdef TEXTURE_SSE2
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    for (size_t i = 0; i < count; ++i) {
+        __m128 p = _mm_loadu_ps(pixels + i * 4);
+        if (space == MIP_SPACE_NORMAL) {
+            __m128 sq = _mm_mul_ps(p, p);
+            __m128 len2 = _mm_add_ss(_mm_add_ss(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(1, 1, 1, 1))),
+                                     _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(2, 2, 2, 2)));
+            float l2 = _mm_cvtss_f32(len2);
+            float alpha = std::min(std::max(pixels[i * 4 + 3], 0.0f), 1.0f);
+            if (l2 > 1e-12f)
+                p = _mm_mul_ps(p, _mm_set1_ps(1.0f / std::sqrt(l2)));
+            else
+                p = _mm_setr_ps(0.0f, 0.0f, 1.0f, 0.0f);
+            _mm_storeu_ps(pixels + i * 4, p);
+            pixels[i * 4 + 3] = alpha;
+        } else {
+            _mm_storeu_ps(pixels + i * 4, _mm_min_ps(_mm_max_ps(p, zero), one));
+        }
+    }
+#else
+    for (size_t i = 0; i < count; ++i) {
+        float* p = pixels + i * 4;
+        if (space == MIP_SPACE_NORMAL) {
+            float l2 = p[0] * p[0] + p[1] * p[1] + p[2] * p[2];
+            if (l2 > 1e-12f) {
+                float inv = 1.0f / std::sqrt(l2);
+                p[0] *= inv;
+                p[1] *= inv;
+                p[2] *= inv;
+            } else {
+                p[0] = p[1] = 0.0f;
+                p[2] = 1.0f;
+            }
+            p[3] = std::min(std::max(p[3], 0.0f), 1.0f);
+        } else {
+            for (int k = 0; k < 4; ++k)
+                p[k] = std::min(std::max(p[k], 0.0f), 1.0f);
+        }
+    }
+#endif
+}
+
+void toBytes(const float* src, size_t pixels, MipSpace space, unsigned char* dst) {
+    const ColorTables& tables = colorTables();
+    for (size_t i = 0; i < pixels; ++i) {
+        const float* f = src + i * 4;
+        unsigned char* p = dst + i * 4;
+        for (int k = 0; k < 3; ++k) {
+            if (space == MIP_SPACE_SRGB)
+                p[k] = tables.toSrgb[static_cast<int>(f[k] * 16384.0f + 0.5f)];
+            else if (space == MIP_SPACE_NORMAL)
+                p[k] = static_cast<unsigned char>((f[k] * 0.5f + 0.5f) * 255.0f + 0.5f);
+            else
+                p[k] = static_cast<unsigned char>(f[k] * 255.0f + 0.5f);
+        }
+        p[3] = static_cast<unsigned char>(f[3] * 255.0f + 0.5f);
+    }
+}
+
+// Separable resample of an RGBA float image, one __m128 per texel
+void resample(const float* src, int width, int height, float* dst, int dstWidth, int dstHeight, MipFilter filter) {
+    std::vector<std::vector<Tap>> tapsX = buildTaps(width, dstWidth, filter);
+    std::vector<std::vector<Tap>> tapsY = buildTaps(height, dstHeight, filter);
+    std::vector<float> rows(static_cast<size_t>(dstWidth) * height * 4);
+    ThreadPool& pool = ThreadPool::shared();
+
+    // Horizontal pass: height rows of dstWidth texels
+    pool.parallelFor((height + rowsPerTask - 1) / rowsPerTask, [&](int task) {
+        int yEnd = std::min(height, (task + 1) * rowsPerTask);
+        for (int y = task * rowsPerTask; y < yEnd; ++y) {
+            const float* in = src + static_cast<size_t>(y) * width * 4;
+            float* out = &rows[static_cast<size_t>(y) * dstWidth * 4];
+            for (int x = 0; x < dstWidth; ++x) {
+#ifdef TEXTURE_SSE2
+                __m128 acc = _mm_setzero_ps();
+                for (const Tap& tap : tapsX[x])
+                    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(tap.weight), _mm_loadu_ps(in + tap.index * 4)));
+                _mm_storeu_ps(out + x * 4, acc);
+#else
+                float acc[4] = {0, 0, 0, 0};
+                for (const Tap& tap : tapsX[x])
+                    for (int k = 0; k < 4; ++k)
+                        acc[k] += tap.weight * in[tap.index * 4 + k];
+                std::memcpy(out + x * 4, acc, sizeof(acc));
+#endif
+            }
+        }
+    });
+
+    // Vertical pass: accumulate whole rows so the inner loop streams
+    pool.parallelFor((dstHeight + rowsPerTask - 1) / rowsPerTask, [&](int task) {
+        int yEnd = std::min(dstHeight, (task + 1) * rowsPerTask);
+        for (int y = task * rowsPerTask; y < yEnd; ++y) {
+            float* out = dst + static_cast<size_t>(y) * dstWidth * 4;
+            std::fill(out, out + static_cast<size_t>(dstWidth) * 4, 0.0f);
+            for (const Tap& tap : tapsY[y]) {
+                const float* in = &rows[static_cast<size_t>(tap.index) * dstWidth * 4];
+#ifdef TEXTURE_SSE2
+                __m128 w = _mm_set1_ps(tap.weight);
+                for (int x = 0; x < dstWidth; ++x)
+                    _mm_storeu_ps(out + x * 4, _mm_add_ps(_mm_loadu_ps(out + x * 4), _mm_mul_ps(w, _mm_loadu_ps(in + x * 4))));
+#else
+                for (int i = 0; i < dstWidth * 4; ++i)
+                    out[i] += tap.weight * in[i];
+#endif
+            }
+        }
+    });
+}
+
+}
+
+void buildMipChain(std::vector<unsigned char> rgba, int width, int height, MipFilter filter, MipSpace space,
+                   std::vector<MipLevel>& levels) {
+    levels.clear();
+    std::vector<float> current(static_cast<size_t>(width) * height * 4);
+    toFloat(rgba.data(), static_cast<size_t>(width) * height, space, current.data());
+
+    MipLevel base;
+    base.width = width;
+    base.height = height;
+    base.rgba.swap(rgba);
+    levels.push_back(std::move(base));
+    if (space == MIP_SPACE_NORMAL)
+        condition(current.data(), static_cast<size_t>(width) * height, space);
+
+    std::vector<float> next;
+    while (width > 1 || height > 1) {
+        int nextWidth = std::max(width / 2, 1);
+        int nextHeight = std::max(height / 2, 1);
+        size_t pixels = static_cast<size_t>(nextWidth) * nextHeight;
+        next.resize(pixels * 4);
+        resample(current.data(), width, height, next.data(), nextWidth, nextHeight, filter);
+        condition(next.data(), pixels, space);
+
+        MipLevel level;
+        level.width = nextWidth;
+        level.height = nextHeight;
+        level.rgba.resize(pixels * 4);
+        toBytes(next.data(), pixels, space, level.rgba.data());
+        levels.push_back(std::move(level));
+
+        current.swap(next);
+        width = nextWidth;
+        height = nextHeight;
+    }
+}
+
+void resizeImage(const unsigned char* rgba, int width, int height, int dstWidth, int dstHeight, MipFilter filter,
+                 MipSpace space, std::vector<unsigned char>& out) {
+    size_t pixels = static_cast<size_t>(width) * height;
+    size_t dstPixels = static_cast<size_t>(dstWidth) * dstHeight;
+    std::vector<float> src(pixels * 4), dst(dstPixels * 4);
+    toFloat(rgba, pixels, space, src.data());
+    if (space == MIP_SPACE_NORMAL)
+        condition(src.data(), pixels, space);
+    resample(src.data(), width, height, dst.data(), dstWidth, dstHeight, filter);
+    condition(dst.data(), dstPixels, space);
+    out.resize(dstPixels * 4);
+    toBytes(dst.data(), dstPixels, space, out.data());
+}
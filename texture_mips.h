@@ -0,0 +1,35 @@
+#ifndef TEXTURE_MIPS_H
+#define TEXTURE_MIPS_H
+
+#include <vector>
+
+enum MipFilter {
+    MIP_FILTER_BOX,   // area average, cheap and soft
+    MIP_FILTER_KAISER // Kaiser-windowed sinc, keeps detail without ringing
+};
+
+// How the texel values behave under filtering
+enum MipSpace {
+    MIP_SPACE_SRGB,   // sRGB colour: filtered in linear light, alpha linear
+    MIP_SPACE_LINEAR, // plain data filtered as stored
+    MIP_SPACE_NORMAL  // RGB holds a unit vector: filtered, then renormalized
+};
+
+struct MipLevel {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> rgba;
+};
+
+// Builds the full chain down to 1x1 from a tightly packed RGBA8 image; level 0
+// takes over the input buffer. Each level is filtered from the previous one
+// kept in float, and sampling wraps around the edges like GL_REPEAT.
+void buildMipChain(std::vector<unsigned char> rgba, int width, int height, MipFilter filter, MipSpace space,
+                   std::vector<MipLevel>& levels);
+
+// Resamples a tightly packed RGBA8 image to another size with the same
+// filtering rules, for either shrinking or enlarging.
+void resizeImage(const unsigned char* rgba, int width, int height, int dstWidth, int dstHeight, MipFilter filter,
+                 MipSpace space, std::vector<unsigned char>& out);
+
+#endif
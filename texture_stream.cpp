@@ -0,0 +1,615 @@
+#include <GL/glew.h>
+#include "texture_stream.h"
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+namespace {
+
+// How far GL_TEXTURE_MIN_LOD moves towards a newly arrived level per update
+const float fadeStep = 0.25f;
+
+// Levels this small (larger side in texels) are never evicted
+const int minEvictableSize = 64;
+
+// Size of the persistently mapped upload buffer, and the granularity of the
+// ranges handed out from it
+const size_t stagingSize = 32u << 20;
+const size_t stagingAlignment = 256;
+
+const unsigned char flatColor[4] = {128, 128, 128, 255};
+const unsigned char flatNormal[4] = {128, 128, 255, 255};
+
+}
+
+TextureStreamer::TextureStreamer(size_t uploadBudget, size_t residencyBudget)
+    : uploadBudget(uploadBudget), residencyBudget(residencyBudget), loader(&TextureStreamer::loaderLoop, this) {
+}
+
+TextureStreamer::~TextureStreamer() {
+    stopLoader();
+}
+
+void TextureStreamer::stopLoader() {
+    if (!loader.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    loader.join();
+}
+
+// The loader is stopped first, as it writes into the mapped memory
+void TextureStreamer::shutdown() {
+    stopLoader();
+    for (const Retiring& retired : retiring)
+        glDeleteSync(static_cast<GLsync>(retired.fence));
+    retiring.clear();
+    if (stagingBuffer) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stagingBuffer);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &stagingBuffer);
+        stagingBuffer = 0;
+    }
+    stagingMemory = nullptr;
+    stagingFree.clear();
+}
+
+// Makes the texture object with a 1x1 placeholder per layer and starts
+// tracking it
+unsigned int TextureStreamer::create(const Request& request) {
+    std::vector<unsigned char> placeholder;
+    for (const Layer& layer : request.layers) {
+        const unsigned char* texel = layer.kind == TEXTURE_COLOR ? flatColor : flatNormal;
+        placeholder.insert(placeholder.end(), texel, texel + 4);
+    }
+
+    GLenum target = request.target;
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(target, textureID);
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    if (target == GL_TEXTURE_2D_ARRAY)
+        glTexImage3D(target, 0, GL_RGBA8, 1, 1, static_cast<GLsizei>(request.layers.size()), 0, GL_RGBA,
+                     GL_UNSIGNED_BYTE, placeholder.data());
+    else
+        glTexImage2D(target, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder.data());
+    glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, 0);
+
+    Residency& entry = residency[textureID];
+    entry.request = request;
+    entry.request.texture = textureID;
+    entry.lastUsed = frame;
+    return textureID;
+}
+
+void TextureStreamer::enqueue(const Request& request) {
+    residency[request.texture].streaming = true;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        requests.push_back(request);
+        ++loading;
+    }
+    wake.notify_one();
+}
+
+unsigned int TextureStreamer::load(const char* path, TextureKind kind, int maxSize) {
+    if (!stagingChecked)
+        createStaging();
+    Request request;
+    request.target = GL_TEXTURE_2D;
+    request.layers.push_back({path, kind});
+    request.options.maxSize = maxSize;
+    request.compress = GLEW_EXT_texture_compression_s3tc != 0;
+    request.texture = create(request);
+    enqueue(request);
+    return request.texture;
+}
+
+std::vector<TextureLayer> TextureStreamer::loadPacked(const std::vector<TextureSource>& sources, int maxSize) {
+    if (!stagingChecked)
+        createStaging();
+    bool compress = GLEW_EXT_texture_compression_s3tc != 0;
+
+    // Group by the format each image bakes to, reading only the headers here
+    struct Group {
+        unsigned int glFormat;
+        Request request;
+        std::vector<size_t> members;
+    };
+    std::vector<Group> groups;
+    for (size_t i = 0; i < sources.size(); ++i) {
+        int width, height;
+        unsigned int glFormat;
+        if (!peekTexture(sources[i].path, sources[i].kind, compress, width, height, glFormat, maxSize)) {
+            std::cerr << "Failed to load texture " << sources[i].path << std::endl;
+            continue;
+        }
+        auto group = std::find_if(groups.begin(), groups.end(), [&](const Group& g) { return g.glFormat == glFormat; });
+        if (group == groups.end()) {
+            groups.push_back(Group());
+            group = groups.end() - 1;
+            group->glFormat = glFormat;
+            group->request.target = GL_TEXTURE_2D_ARRAY;
+            group->request.compress = compress;
+            group->request.options.keepAlpha = true;
+        }
+        TextureBakeOptions& options = group->request.options;
+        options.width = std::max(options.width, width);
+        options.height = std::max(options.height, height);
+        group->request.layers.push_back({sources[i].path, sources[i].kind});
+        group->members.push_back(i);
+    }
+
+    std::vector<TextureLayer> placed(sources.size());
+    for (Group& group : groups) {
+        group.request.texture = create(group.request);
+        for (size_t layer = 0; layer < group.members.size(); ++layer) {
+            placed[group.members[layer]].texture = group.request.texture;
+            placed[group.members[layer]].layer = static_cast<int>(layer);
+        }
+        enqueue(group.request);
+    }
+    return placed;
+}
+
+// Maps the staging buffer, once there is a GL context. Storage made with
+// GL_MAP_PERSISTENT_BIT stays mapped while the GPU reads from it, so the
+// loader thread can keep writing into it between uploads.
+void TextureStreamer::createStaging() {
+    stagingChecked = true;
+    if (!GLEW_ARB_buffer_storage)
+        return;
+
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &stagingBuffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stagingBuffer);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, stagingSize, nullptr, flags);
+    void* memory = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, stagingSize, flags);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (!memory) {
+        glDeleteBuffers(1, &stagingBuffer);
+        stagingBuffer = 0;
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    stagingMemory = static_cast<unsigned char*>(memory);
+    stagingFree.push_back({0, stagingSize});
+}
+
+// First fit; bytes must be a multiple of stagingAlignment
+bool TextureStreamer::allocateStaging(size_t bytes, size_t& offset) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto range = stagingFree.begin(); range != stagingFree.end(); ++range) {
+        if (range->size < bytes)
+            continue;
+        offset = range->offset;
+        range->offset += bytes;
+        range->size -= bytes;
+        if (range->size == 0)
+            stagingFree.erase(range);
+        return true;
+    }
+    return false;
+}
+
+void TextureStreamer::releaseStaging(const StagingRange& range) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto next = std::lower_bound(stagingFree.begin(), stagingFree.end(), range,
+                                 [](const StagingRange& a, const StagingRange& b) { return a.offset < b.offset; });
+    auto freed = stagingFree.insert(next, range);
+    if (freed + 1 != stagingFree.end() && freed->offset + freed->size == (freed + 1)->offset) {
+        freed->size += (freed + 1)->size;
+        stagingFree.erase(freed + 1);
+    }
+    if (freed != stagingFree.begin() && (freed - 1)->offset + (freed - 1)->size == freed->offset) {
+        (freed - 1)->size += freed->size;
+        stagingFree.erase(freed);
+    }
+}
+
+// Hands back the staging ranges the GPU has finished reading
+void TextureStreamer::retireStaging() {
+    retiring.erase(std::remove_if(retiring.begin(), retiring.end(), [&](const Retiring& retired) {
+        GLsync fence = static_cast<GLsync>(retired.fence);
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            return false;
+        glDeleteSync(fence);
+        releaseStaging(retired.range);
+        return true;
+    }), retiring.end());
+}
+
+// Reads the cached chain of every layer straight into the staging buffer.
+// Fails without keeping any staging memory when there is no buffer, a layer
+// has no cache yet or the chain does not fit right now; loadLayers then
+// takes over.
+bool TextureStreamer::stageLayers(const Request& request, Streaming& texture) {
+    unsigned char* memory;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        memory = stagingMemory;
+    }
+    if (!memory)
+        return false;
+
+    TextureCacheReader reader;
+    TextureCacheEntry layout;
+    const Layer& first = request.layers[0];
+    if (!openTextureData(first.path.c_str(), first.kind, request.compress, reader, layout, request.options))
+        return false;
+
+    size_t layers = request.layers.size();
+    std::vector<size_t> layerBytes, offsets;
+    size_t total = 0;
+    for (size_t level = 0; level < layout.levels.size(); ++level) {
+        layerBytes.push_back(reader.levelBytes(level));
+        offsets.push_back(total);
+        total += layerBytes[level] * layers;
+    }
+    StagingRange range;
+    range.size = (total + stagingAlignment - 1) / stagingAlignment * stagingAlignment;
+    if (!allocateStaging(range.size, range.offset))
+        return false;
+
+    bool ok = true;
+    for (size_t layer = 0; layer < layers && ok; ++layer) {
+        if (layer > 0) {
+            const Layer& source = request.layers[layer];
+            TextureCacheEntry other;
+            ok = openTextureData(source.path.c_str(), source.kind, request.compress, reader, other, request.options)
+                && other.glFormat == layout.glFormat && other.levels.size() == layout.levels.size();
+            for (size_t level = 0; level < layerBytes.size() && ok; ++level)
+                ok = reader.levelBytes(level) == layerBytes[level];
+        }
+        for (size_t level = 0; level < layerBytes.size() && ok; ++level)
+            ok = reader.readLevel(level, memory + range.offset + offsets[level] + layer * layerBytes[level]);
+    }
+    if (!ok) {
+        releaseStaging(range);
+        return false;
+    }
+
+    texture.entry = std::move(layout);
+    for (size_t level = 0; level < layerBytes.size(); ++level) {
+        texture.levelBytes.push_back(layerBytes[level] * layers);
+        texture.levelOffsets.push_back(range.offset + offsets[level]);
+    }
+    texture.stagingOffset = range.offset;
+    texture.stagingBytes = range.size;
+    return true;
+}
+
+// Loads every layer of the request into one chain in memory
+bool TextureStreamer::loadLayers(const Request& request, Streaming& texture) {
+    for (size_t i = 0; i < request.layers.size(); ++i) {
+        const Layer& layer = request.layers[i];
+        TextureCacheEntry entry;
+        if (!loadTextureData(layer.path.c_str(), layer.kind, request.compress, entry, request.options)) {
+            std::cerr << "Failed to load texture " << layer.path << std::endl;
+            return false;
+        }
+        if (i == 0) {
+            texture.entry = std::move(entry);
+            continue;
+        }
+        if (entry.glFormat != texture.entry.glFormat || entry.levels.size() != texture.entry.levels.size()) {
+            std::cerr << "Texture array layer " << layer.path << " does not match the others" << std::endl;
+            return false;
+        }
+        for (size_t level = 0; level < entry.levels.size(); ++level) {
+            std::vector<unsigned char>& data = texture.entry.levels[level].data;
+            data.insert(data.end(), entry.levels[level].data.begin(), entry.levels[level].data.end());
+        }
+    }
+    for (const TextureCacheLevel& level : texture.entry.levels)
+        texture.levelBytes.push_back(level.data.size());
+    return true;
+}
+
+void TextureStreamer::loaderLoop() {
+    for (;;) {
+        Request request;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || !requests.empty(); });
+            if (stopping)
+                return;
+            request = std::move(requests.front());
+            requests.pop_front();
+        }
+
+        Streaming texture;
+        texture.texture = request.texture;
+        texture.target = request.target;
+        texture.layers = static_cast<int>(request.layers.size());
+        if (!stageLayers(request, texture) && !loadLayers(request, texture))
+            texture.entry.levels.clear(); // tells update() the load failed
+
+        std::lock_guard<std::mutex> lock(mutex);
+        loaded.push_back(std::move(texture));
+        --loading;
+    }
+}
+
+bool TextureStreamer::idle() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return loading == 0 && loaded.empty() && active.empty();
+}
+
+void TextureStreamer::touch(unsigned int texture) {
+    auto found = residency.find(texture);
+    if (found == residency.end())
+        return;
+    Residency& entry = found->second;
+    entry.lastUsed = frame;
+    if (entry.baseLevel > 0 && !entry.streaming)
+        enqueue(entry.request);
+}
+
+void TextureStreamer::update() {
+    ++frame;
+    retireStaging();
+
+    std::vector<Streaming> arrived;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        arrived.swap(loaded);
+    }
+    size_t spent = 0;
+    for (Streaming& texture : arrived) {
+        if (texture.entry.levels.empty()) {
+            residency[texture.texture].streaming = false;
+            continue;
+        }
+        spent += allocate(texture);
+        active.push_back(std::move(texture));
+    }
+
+    for (Streaming& texture : active) {
+        if (texture.minLod > 0.0f) {
+            texture.minLod = std::max(texture.minLod - fadeStep, 0.0f);
+            glBindTexture(texture.target, texture.texture);
+            glTexParameterf(texture.target, GL_TEXTURE_MIN_LOD, texture.minLod);
+        }
+    }
+
+    // Always serve the coarsest outstanding level across all textures, so
+    // every texture gets its small levels before any gets its large ones
+    while (spent < uploadBudget) {
+        Streaming* next = nullptr;
+        for (Streaming& texture : active) {
+            if (texture.nextLevel < 0)
+                continue;
+            if (!next || texture.levelBytes[texture.nextLevel] < next->levelBytes[next->nextLevel])
+                next = &texture;
+        }
+        if (!next)
+            break;
+        spent += uploadRows(*next, uploadBudget - spent);
+    }
+    if (stagingBuffer)
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    active.erase(std::remove_if(active.begin(), active.end(), [&](const Streaming& texture) {
+        if (texture.nextLevel >= 0 || texture.minLod > 0.0f)
+            return false;
+        residency[texture.texture].streaming = false;
+        return true;
+    }), active.end());
+
+    evict();
+}
+
+// Binds the unpack buffer the texture's data comes from and returns where
+// byte offset of level is: a pointer, or an offset into the staging buffer
+const void* TextureStreamer::levelPixels(const Streaming& texture, int level, size_t offset) {
+    if (stagingBuffer)
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, texture.stagingBytes > 0 ? stagingBuffer : 0);
+    if (texture.stagingBytes > 0)
+        return reinterpret_cast<const void*>(texture.levelOffsets[level] + offset);
+    return texture.entry.levels[level].data.data() + offset;
+}
+
+// Once the whole chain is uploaded: frees its level data, or fences its
+// staging range so it is reused only after the GPU has read it
+void TextureStreamer::releaseLevels(Streaming& texture) {
+    if (texture.stagingBytes > 0) {
+        GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        retiring.push_back({fence, {texture.stagingOffset, texture.stagingBytes}});
+        texture.stagingBytes = 0;
+    }
+    std::vector<TextureCacheLevel>().swap(texture.entry.levels);
+}
+
+// Uploads one whole level, every layer
+size_t TextureStreamer::uploadLevel(Streaming& texture, int level) {
+    const TextureCacheLevel& data = texture.entry.levels[level];
+    GLsizei size = static_cast<GLsizei>(texture.levelBytes[level]);
+    const void* pixels = levelPixels(texture, level, 0);
+    if (texture.target == GL_TEXTURE_2D_ARRAY) {
+        if (texture.entry.compressed)
+            glCompressedTexSubImage3D(texture.target, level, 0, 0, 0, data.width, data.height, texture.layers,
+                                      texture.entry.glFormat, size, pixels);
+        else
+            glTexSubImage3D(texture.target, level, 0, 0, 0, data.width, data.height, texture.layers, GL_RGBA,
+                            GL_UNSIGNED_BYTE, pixels);
+    } else {
+        if (texture.entry.compressed)
+            glCompressedTexSubImage2D(texture.target, level, 0, 0, data.width, data.height, texture.entry.glFormat,
+                                      size, pixels);
+        else
+            glTexSubImage2D(texture.target, level, 0, 0, data.width, data.height, GL_RGBA, GL_UNSIGNED_BYTE,
+                            pixels);
+    }
+    return texture.levelBytes[level];
+}
+
+// Uploads as many rows of the texture's current level as the allowance
+// covers (at least one row, or one row of blocks, and never past the end of
+// a layer) and returns the bytes sent. Levels only take part in sampling once
+// complete, so a large level can be spread over several frames.
+size_t TextureStreamer::uploadRows(Streaming& texture, size_t allowance) {
+    const TextureCacheLevel& level = texture.entry.levels[texture.nextLevel];
+    int rowsPerUnit = texture.entry.compressed ? 4 : 1;
+    int unitsPerLayer = (level.height + rowsPerUnit - 1) / rowsPerUnit;
+    size_t unitBytes = texture.levelBytes[texture.nextLevel] / (static_cast<size_t>(unitsPerLayer) * texture.layers);
+    int layer = texture.nextUnit / unitsPerLayer;
+    int firstUnit = texture.nextUnit % unitsPerLayer;
+    int count = static_cast<int>(std::min<size_t>(unitsPerLayer - firstUnit, std::max<size_t>(allowance / unitBytes, 1)));
+
+    int y = firstUnit * rowsPerUnit;
+    int rows = std::min(count * rowsPerUnit, level.height - y);
+    const void* data = levelPixels(texture, texture.nextLevel, texture.nextUnit * unitBytes);
+    GLsizei size = static_cast<GLsizei>(count * unitBytes);
+    glBindTexture(texture.target, texture.texture);
+    if (texture.target == GL_TEXTURE_2D_ARRAY) {
+        if (texture.entry.compressed)
+            glCompressedTexSubImage3D(texture.target, texture.nextLevel, 0, y, layer, level.width, rows, 1,
+                                      texture.entry.glFormat, size, data);
+        else
+            glTexSubImage3D(texture.target, texture.nextLevel, 0, y, layer, level.width, rows, 1, GL_RGBA,
+                            GL_UNSIGNED_BYTE, data);
+    } else {
+        if (texture.entry.compressed)
+            glCompressedTexSubImage2D(texture.target, texture.nextLevel, 0, y, level.width, rows,
+                                      texture.entry.glFormat, size, data);
+        else
+            glTexSubImage2D(texture.target, texture.nextLevel, 0, y, level.width, rows, GL_RGBA, GL_UNSIGNED_BYTE,
+                            data);
+    }
+
+    texture.nextUnit += count;
+    if (texture.nextUnit >= unitsPerLayer * texture.layers)
+        completeLevel(texture);
+    return count * unitBytes;
+}
+
+// Defines every level up front, finest first, without data, so the driver
+// lays out the whole chain once instead of reallocating it as levels arrive
+// coarse-first. Levels that were already resident (the chain is coming back
+// after an eviction) are filled again straight away, and a fresh chain gets
+// its coarsest level, so the texture never samples undefined texels.
+size_t TextureStreamer::allocate(Streaming& texture) {
+    Residency& entry = residency[texture.texture];
+    int levelCount = static_cast<int>(texture.entry.levels.size());
+    if (entry.levelBytes.size() != texture.entry.levels.size()) {
+        // First arrival, or the cache was rebaked with another chain
+        for (int level = entry.allocatedLevel; level < static_cast<int>(entry.levelBytes.size()); ++level)
+            resident -= entry.levelBytes[level];
+        entry.baseLevel = -1;
+        entry.levelBytes = texture.levelBytes;
+        entry.allocatedLevel = levelCount;
+        entry.levelSize.clear();
+        for (const TextureCacheLevel& level : texture.entry.levels)
+            entry.levelSize.push_back(std::max(level.width, level.height));
+    }
+
+    // The null data below must not be read as an offset into the staging buffer
+    if (stagingBuffer)
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glBindTexture(texture.target, texture.texture);
+    for (int i = 0; i < levelCount; ++i) {
+        const TextureCacheLevel& level = texture.entry.levels[i];
+        GLsizei size = static_cast<GLsizei>(texture.levelBytes[i]);
+        if (texture.target == GL_TEXTURE_2D_ARRAY) {
+            if (texture.entry.compressed)
+                glCompressedTexImage3D(texture.target, i, texture.entry.glFormat, level.width, level.height,
+                                       texture.layers, 0, size, nullptr);
+            else
+                glTexImage3D(texture.target, i, texture.entry.glFormat, level.width, level.height, texture.layers, 0,
+                             GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        } else {
+            if (texture.entry.compressed)
+                glCompressedTexImage2D(texture.target, i, texture.entry.glFormat, level.width, level.height, 0,
+                                       size, nullptr);
+            else
+                glTexImage2D(texture.target, i, texture.entry.glFormat, level.width, level.height, 0, GL_RGBA,
+                             GL_UNSIGNED_BYTE, nullptr);
+        }
+    }
+    for (int level = 0; level < entry.allocatedLevel; ++level)
+        resident += entry.levelBytes[level];
+    entry.allocatedLevel = 0;
+
+    int keep = entry.baseLevel >= 0 ? entry.baseLevel : levelCount - 1;
+    size_t spent = 0;
+    for (int level = levelCount - 1; level >= keep; --level)
+        spent += uploadLevel(texture, level);
+    if (entry.baseLevel < 0)
+        entry.baseLevel = keep;
+    glTexParameteri(texture.target, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+    glTexParameteri(texture.target, GL_TEXTURE_BASE_LEVEL, keep);
+
+    texture.nextLevel = keep - 1;
+    texture.nextUnit = 0;
+    if (texture.nextLevel < 0)
+        releaseLevels(texture);
+    return spent;
+}
+
+void TextureStreamer::completeLevel(Streaming& texture) {
+    int mip = texture.nextLevel;
+    Residency& entry = residency[texture.texture];
+    entry.baseLevel = mip;
+
+    // Keep sampling the previous level and fade the new one in
+    texture.minLod += 1.0f;
+    glTexParameterf(texture.target, GL_TEXTURE_MIN_LOD, texture.minLod);
+    glTexParameteri(texture.target, GL_TEXTURE_BASE_LEVEL, mip);
+    texture.nextLevel = mip - 1;
+    texture.nextUnit = 0;
+
+    // The upload copied the texels; free them as soon as the chain is done
+    if (texture.nextLevel < 0)
+        releaseLevels(texture);
+}
+
+// While over the residency budget, releases the finest levels of the least
+// recently used textures. Textures drawn in the last frame and ones still
+// streaming are left alone, so the budget can be exceeded when the visible
+// set alone does not fit.
+void TextureStreamer::evict() {
+    if (resident <= residencyBudget)
+        return;
+
+    auto evictable = [](const Residency& entry) {
+        return entry.baseLevel >= 0 && entry.baseLevel + 1 < static_cast<int>(entry.levelBytes.size())
+            && entry.levelSize[entry.baseLevel] > minEvictableSize;
+    };
+    std::vector<std::pair<unsigned long long, unsigned int>> candidates;
+    for (const auto& item : residency) {
+        const Residency& entry = item.second;
+        if (!entry.streaming && entry.lastUsed + 1 < frame && evictable(entry))
+            candidates.push_back(std::make_pair(entry.lastUsed, item.first));
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    for (const auto& candidate : candidates) {
+        Residency& entry = residency[candidate.second];
+        GLenum target = entry.request.target;
+        glBindTexture(target, candidate.second);
+        while (resident > residencyBudget && evictable(entry)) {
+            // Redefine the level as empty so the driver can release it
+            int level = entry.baseLevel;
+            glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, level + 1);
+            if (target == GL_TEXTURE_2D_ARRAY)
+                glTexImage3D(target, level, GL_RGBA8, 0, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            else
+                glTexImage2D(target, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            resident -= entry.levelBytes[level];
+            entry.baseLevel = level + 1;
+            entry.allocatedLevel = level + 1;
+        }
+        if (resident <= residencyBudget)
+            break;
+    }
+}
@@ -0,0 +1,180 @@
+#ifndef TEXTURE_STREAM_H
+#define TEXTURE_STREAM_H
+
+#include "texture.h"
+#include "texture_cache.h"
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct TextureSource {
+    const char* path;
+    TextureKind kind;
+};
+
+// Where loadPacked put an image: a GL_TEXTURE_2D_ARRAY and the layer in it
+struct TextureLayer {
+    unsigned int texture = 0;
+    int layer = 0;
+};
+
+// Loads textures on a background thread and uploads their mip chains over the
+// following frames, coarsest level first. A streamed texture can be bound
+// straight away: it shows a flat placeholder until its smallest levels
+// arrive, then GL_TEXTURE_BASE_LEVEL steps down as finer levels complete,
+// with GL_TEXTURE_MIN_LOD easing each new level in instead of popping.
+//
+// It also keeps the texture storage it allocates under residencyBudget. A
+// chain's storage is all allocated when it arrives, so its finer levels
+// count before they are uploaded. When over the budget, the finest levels of
+// the least recently used textures are released, and a texture gets them back
+// (re-read from its cache) the next time it is used.
+//
+// With ARB_buffer_storage, cached chains are read by the loader thread
+// straight into a persistently mapped pixel unpack buffer and uploaded from
+// there, so the texels are never copied on the CPU. Chains that have to be
+// baked first, or don't fit in the buffer, go through ordinary memory.
+struct TextureStreamer {
+    // uploadBudget is the number of texel bytes handed to GL per update(),
+    // residencyBudget the bytes the allocated levels may take up
+    explicit TextureStreamer(size_t uploadBudget = 2u << 20, size_t residencyBudget = 256u << 20);
+    ~TextureStreamer();
+
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    // Same as loadTexture, but returns before the image is read: decoding
+    // (or reading the cache) happens on the loader thread. GL thread only.
+    unsigned int load(const char* path, TextureKind kind = TEXTURE_COLOR, int maxSize = 0);
+
+    // Packs the images into texture arrays, one per internal format, so draws
+    // that only differ in texture can share a bind and pick a layer in the
+    // shader. Each array takes the largest width and height of its images and
+    // the others are resampled to it (not padded: texcoords wrap), after
+    // maxSize limits each image like loadTexture does. Streams like load();
+    // the result is in the order of sources. GL thread only.
+    std::vector<TextureLayer> loadPacked(const std::vector<TextureSource>& sources, int maxSize = 0);
+
+    // Starts a frame: uploads pending levels up to the budget, advances the
+    // fades and evicts levels while over the residency budget. Call once per
+    // frame on the GL thread; leaves GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY
+    // bound to whichever texture it touched last.
+    void update();
+
+    // Marks a texture from load() or loadPacked() as drawn this frame, and
+    // brings back its levels if they were evicted. Cheap enough to call per draw.
+    void touch(unsigned int texture);
+
+    // Stops the loader and gives back the staging buffer and the fences of
+    // ranges the GPU may still be reading. Call on the GL thread while the
+    // context is current, before glfwTerminate; the destructor only stops
+    // the loader, since it may run once the context is gone. Nothing can be
+    // loaded or updated after it.
+    void shutdown();
+
+    // True once every requested texture is fully resident
+    bool idle() const;
+
+    // Bytes of every allocated level, uploaded yet or not (placeholders not
+    // counted)
+    size_t residentBytes() const { return resident; }
+
+    size_t uploadBudget;
+    size_t residencyBudget;
+
+private:
+    struct Layer {
+        std::string path;
+        TextureKind kind;
+    };
+
+    struct Request {
+        unsigned int texture;
+        unsigned int target; // GL_TEXTURE_2D, or GL_TEXTURE_2D_ARRAY with one layer per source
+        std::vector<Layer> layers;
+        TextureBakeOptions options;
+        bool compress;
+    };
+
+    // A loaded chain on its way to the GPU. For arrays every level holds all
+    // layers back to back.
+    struct Streaming {
+        unsigned int texture = 0;
+        unsigned int target = 0;
+        int layers = 1;
+        TextureCacheEntry entry;          // level sizes, and the level data unless it is staged
+        std::vector<size_t> levelBytes;   // per level, all layers
+        std::vector<size_t> levelOffsets; // where each level starts in the staging buffer
+        size_t stagingOffset = 0;
+        size_t stagingBytes = 0;          // 0 when the data is in entry instead
+        int nextLevel = -1; // level being uploaded, counts down to 0
+        int nextUnit = 0;   // rows (block rows when compressed) of nextLevel already uploaded, over all layers
+        float minLod = 0.0f;
+    };
+
+    // What is on the GPU for one texture
+    struct Residency {
+        Request request;                // to load the chain again after eviction
+        std::vector<size_t> levelBytes; // per level, all layers; empty until the chain first arrives
+        std::vector<int> levelSize;     // larger side of each level
+        int baseLevel = -1;             // finest resident level, -1 while the placeholder shows
+        int allocatedLevel = 0;         // finest level with storage; it and the coarser ones count in resident
+        unsigned long long lastUsed = 0;
+        bool streaming = false;         // queued, loading or uploading
+    };
+
+    struct StagingRange {
+        size_t offset;
+        size_t size;
+    };
+
+    // A staging range the GPU may still be reading
+    struct Retiring {
+        void* fence; // GLsync
+        StagingRange range;
+    };
+
+    unsigned int create(const Request& request);
+    void enqueue(const Request& request);
+    void loaderLoop();
+    void stopLoader();
+    bool stageLayers(const Request& request, Streaming& texture);
+    bool loadLayers(const Request& request, Streaming& texture);
+    void createStaging();
+    bool allocateStaging(size_t bytes, size_t& offset);
+    void releaseStaging(const StagingRange& range);
+    void retireStaging();
+    const void* levelPixels(const Streaming& texture, int level, size_t offset);
+    void releaseLevels(Streaming& texture);
+    size_t allocate(Streaming& texture);
+    size_t uploadLevel(Streaming& texture, int level);
+    size_t uploadRows(Streaming& texture, size_t allowance);
+    void completeLevel(Streaming& texture);
+    void evict();
+
+    // GL thread only
+    std::vector<Streaming> active;
+    std::unordered_map<unsigned int, Residency> residency;
+    size_t resident = 0;
+    unsigned long long frame = 0;
+    bool stagingChecked = false;
+    unsigned int stagingBuffer = 0;
+    std::vector<Retiring> retiring;
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Request> requests;
+    std::vector<Streaming> loaded;
+    int loading = 0;
+    bool stopping = false;
+    unsigned char* stagingMemory = nullptr; // mapped staging buffer, null without one
+    std::vector<StagingRange> stagingFree;  // sorted by offset
+    std::thread loader;
+};
+
+#endif
@@ -0,0 +1,82 @@
+#include <GL/glew.h>
+#include "uniform_buffers.h"
+#include "ring_buffer.h"
+#include <algorithm>
+#include <cstring>
+
+void FrameUniformBuffer::update(const FrameUniforms& frame) {
+    if (ring) {
+        RingAllocation block = ring->allocate(sizeof(FrameUniforms), ring->uniformAlignment());
+        if (block.data) {
+            std::memcpy(block.data, &frame, sizeof(FrameUniforms));
+            glBindBufferRange(GL_UNIFORM_BUFFER, UNIFORM_BINDING_FRAME, block.buffer, block.offset, sizeof(FrameUniforms));
+            return;
+        }
+    }
+    if (!buffer)
+        glGenBuffers(1, &buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), &frame, GL_STREAM_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_FRAME, buffer);
+}
+
+void ObjectUniformBuffer::clear() {
+    blocks.clear();
+    batchSize = 0;
+}
+
+// Blocks are always allocated whole, since the range bound for a draw has to
+// cover the block as the shader declares it
+int ObjectUniformBuffer::beginBatch() {
+    if (stride == 0) {
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        size_t align = alignment > 0 ? static_cast<size_t>(alignment) : 256;
+        stride = (sizeof(ObjectUniforms) * batchObjects + align - 1) / align * align;
+    }
+    int slot = static_cast<int>(blocks.size() / stride);
+    blocks.resize(blocks.size() + stride, 0);
+    batchSize = 0;
+    return slot;
+}
+
+int ObjectUniformBuffer::add(const ObjectUniforms& object) {
+    if (blocks.empty() || batchSize == batchObjects)
+        beginBatch();
+    std::memcpy(&blocks[blocks.size() - stride + batchSize * sizeof(ObjectUniforms)], &object, sizeof(object));
+    return batchSize++;
+}
+
+// Orphans the buffer each frame instead of overwriting data the GPU may
+// still be reading; it grows to the largest frame seen. Blocks are placed
+// at multiples of the offset alignment, so they can go anywhere in the ring
+// that starts on one.
+void ObjectUniformBuffer::upload() {
+    bound = -1;
+    if (ring && !blocks.empty()) {
+        RingAllocation slice = ring->allocate(blocks.size(), ring->uniformAlignment());
+        if (slice.data) {
+            std::memcpy(slice.data, blocks.data(), blocks.size());
+            uploaded = slice.buffer;
+            uploadOffset = slice.offset;
+            return;
+        }
+    }
+    if (!buffer)
+        glGenBuffers(1, &buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    capacity = std::max(capacity, blocks.size());
+    glBufferData(GL_UNIFORM_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+    if (!blocks.empty())
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, blocks.size(), blocks.data());
+    uploaded = buffer;
+    uploadOffset = 0;
+}
+
+void ObjectUniformBuffer::bind(int slot) {
+    if (slot == bound)
+        return;
+    glBindBufferRange(GL_UNIFORM_BUFFER, UNIFORM_BINDING_OBJECT, uploaded, uploadOffset + slot * stride,
+                      sizeof(ObjectUniforms) * batchObjects);
+    bound = slot;
+}
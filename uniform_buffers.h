@@ -0,0 +1,105 @@
+#ifndef UNIFORM_BUFFERS_H
+#define UNIFORM_BUFFERS_H
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <vector>
+
+struct FrameRingBuffer;
+
+// Binding points of the scene's uniform blocks; ShaderProgram::bindBlock
+// connects a program's blocks to them
+enum UniformBinding {
+    UNIFORM_BINDING_FRAME = 0,
+    UNIFORM_BINDING_OBJECT = 1
+};
+
+// std140 layout of the FrameData block: set once per frame and shared by
+// every program. vec3s are padded to vec4 as std140 does anyway.
+struct FrameUniforms {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec4 viewPos;
+    glm::vec4 lightColor;
+    glm::vec4 lightPos[6];
+};
+
+// std140 layout of one element of the ObjectData block's array: one per
+// draw. params.x is the draw's layer in the packed textures (-1 for none),
+// params.y is 1 when the model matrix comes from the instance attribute.
+struct ObjectUniforms {
+    glm::mat4 model;
+    glm::vec4 objectColor;
+    glm::ivec4 params;
+};
+
+static_assert(sizeof(FrameUniforms) == 2 * 64 + 8 * 16, "FrameUniforms must match the std140 FrameData block");
+static_assert(sizeof(ObjectUniforms) == 64 + 2 * 16, "ObjectUniforms must match the std140 ObjectData block");
+
+// The FrameData block's buffer, bound at UNIFORM_BINDING_FRAME. GL thread only.
+struct FrameUniformBuffer {
+    FrameUniformBuffer() = default;
+
+    FrameUniformBuffer(const FrameUniformBuffer&) = delete;
+    FrameUniformBuffer& operator=(const FrameUniformBuffer&) = delete;
+
+    // Replaces the block's contents (the buffer is orphaned, so draws of the
+    // previous frame still in flight keep theirs)
+    void update(const FrameUniforms& frame);
+
+    // Writes the block into ring's current frame instead of orphaning; null
+    // goes back to orphaning
+    void useRing(FrameRingBuffer* frameRing) { ring = frameRing; }
+
+private:
+    unsigned int buffer = 0;
+    FrameRingBuffer* ring = nullptr;
+};
+
+// ObjectData blocks for every batch of draws in a frame, suballocated from
+// one large buffer at GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT. A block holds the
+// ObjectUniforms of up to batchObjects draws, which the shaders index by
+// draw; blocks are filled while the frame is built, uploaded with a single
+// call and then selected per batch with glBindBufferRange. GL thread only.
+struct ObjectUniformBuffer {
+    // Array size of the ObjectData block in the shaders
+    static const int batchObjects = 128;
+
+    ObjectUniformBuffer() = default;
+
+    ObjectUniformBuffer(const ObjectUniformBuffer&) = delete;
+    ObjectUniformBuffer& operator=(const ObjectUniformBuffer&) = delete;
+
+    // Starts a new frame's blocks
+    void clear();
+
+    // Starts a new block and returns its slot for bind()
+    int beginBatch();
+
+    // Adds a draw to the current block and returns its index there; a block
+    // takes batchObjects draws
+    int add(const ObjectUniforms& object);
+
+    // Hands every block added since clear() to GL
+    void upload();
+
+    // Binds slot's block at UNIFORM_BINDING_OBJECT for the next draws
+    void bind(int slot);
+
+    // Copies the blocks into ring's current frame instead of orphaning,
+    // falling back to it when the frame's region is full; null goes back
+    void useRing(FrameRingBuffer* frameRing) { ring = frameRing; }
+
+private:
+    unsigned int buffer = 0;
+    FrameRingBuffer* ring = nullptr;
+    unsigned int uploaded = 0; // the buffer holding this frame's blocks
+    size_t uploadOffset = 0;   // and where they start in it
+    size_t stride = 0;         // a block's bytes rounded up to the offset alignment
+    int batchSize = 0;         // draws in the current block
+    size_t capacity = 0;       // bytes allocated for buffer
+    std::vector<unsigned char> blocks;
+    int bound = -1;
+};
+
+#endif
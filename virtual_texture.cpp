@@ -0,0 +1,619 @@
+#include <GL/glew.h>
+#include "virtual_texture.h"
+#include "stb_image.h"
+#include "texture_cache.h"
+#include "texture_compress.h"
+#include "texture_mips.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <utility>
+
+namespace {
+
+const char pageFileMagic[4] = {'V', 'T', 'P', '1'};
+const uint32_t pageFileVersion = 1;
+
+// Texels per page side, plus the border copied in from the neighbouring
+// pages so bilinear filtering never reads the wrong page in the cache
+const int pageTileSize = 128;
+const int pageBorder = 4;
+
+// The feedback pass renders at 1/feedbackDivisor of the viewport per side
+const int feedbackDivisor = 8;
+
+// Pages asked for but not yet uploaded; more wait for the next feedback
+const size_t maxPendingPages = 64;
+
+struct PageFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    uint32_t glFormat;
+    uint32_t compressed;
+    uint32_t tileSize;
+    uint32_t border;
+    uint32_t pagesX;
+    uint32_t pagesY;
+    uint32_t levels;
+    uint32_t reserved;
+};
+
+int nextPowerOfTwo(int value) {
+    int result = 1;
+    while (result < value)
+        result *= 2;
+    return result;
+}
+
+int wrap(int value, int size) {
+    value %= size;
+    return value < 0 ? value + size : value;
+}
+
+// Cuts one page with its border out of a level image, wrapping like GL_REPEAT
+void copyPage(const MipLevel& level, int x, int y, int tileSize, int border, std::vector<unsigned char>& out) {
+    int size = tileSize + 2 * border;
+    out.resize(static_cast<size_t>(size) * size * 4);
+    for (int ty = 0; ty < size; ++ty) {
+        int sy = wrap(y * tileSize - border + ty, level.height);
+        for (int tx = 0; tx < size; ++tx) {
+            int sx = wrap(x * tileSize - border + tx, level.width);
+            std::memcpy(&out[(static_cast<size_t>(ty) * size + tx) * 4],
+                        &level.rgba[(static_cast<size_t>(sy) * level.width + sx) * 4], 4);
+        }
+    }
+}
+
+// Decodes the image and writes its pages, every level, to the page file.
+// The image is resampled to a power-of-two number of pages per side first so
+// each level has exactly half the pages of the one above (down to one).
+bool bakePageFile(const char* path, bool compress) {
+    PageFileHeader header;
+    std::memcpy(header.magic, pageFileMagic, sizeof(pageFileMagic));
+    header.version = pageFileVersion;
+    if (!textureSourceStamp(path, header.sourceSize, header.sourceTime))
+        return false;
+
+    int width, height, nrChannels;
+    unsigned char* data = stbi_load(path, &width, &height, &nrChannels, 4);
+    if (!data)
+        return false;
+    std::vector<unsigned char> pixels(data, data + static_cast<size_t>(width) * height * 4);
+    stbi_image_free(data);
+
+    int pagesX = nextPowerOfTwo((width + pageTileSize - 1) / pageTileSize);
+    int pagesY = nextPowerOfTwo((height + pageTileSize - 1) / pageTileSize);
+    int levels = 1;
+    while ((std::max(pagesX, pagesY) >> (levels - 1)) > 1)
+        ++levels;
+
+    if (width != pagesX * pageTileSize || height != pagesY * pageTileSize) {
+        std::vector<unsigned char> resized;
+        resizeImage(pixels.data(), width, height, pagesX * pageTileSize, pagesY * pageTileSize, MIP_FILTER_KAISER,
+                    MIP_SPACE_SRGB, resized);
+        pixels.swap(resized);
+    }
+
+    // Once the shorter side is down to one page it stays there while the
+    // longer one keeps halving, which the plain mip chain doesn't do
+    std::vector<MipLevel> mips;
+    buildMipChain(std::move(pixels), pagesX * pageTileSize, pagesY * pageTileSize, MIP_FILTER_KAISER, MIP_SPACE_SRGB,
+                  mips);
+    mips.resize(levels);
+    for (int level = 1; level < levels; ++level) {
+        int levelWidth = std::max(pagesX >> level, 1) * pageTileSize;
+        int levelHeight = std::max(pagesY >> level, 1) * pageTileSize;
+        MipLevel& mip = mips[level];
+        if (mip.width == levelWidth && mip.height == levelHeight)
+            continue;
+        const MipLevel& above = mips[level - 1];
+        resizeImage(above.rgba.data(), above.width, above.height, levelWidth, levelHeight, MIP_FILTER_KAISER,
+                    MIP_SPACE_SRGB, mip.rgba);
+        mip.width = levelWidth;
+        mip.height = levelHeight;
+    }
+
+    int pageSize = pageTileSize + 2 * pageBorder;
+    size_t pageBytes = compress ? compressedSize(BLOCK_BC1, pageSize, pageSize)
+                                : static_cast<size_t>(pageSize) * pageSize * 4;
+    header.glFormat = compress ? blockGLFormat(BLOCK_BC1) : GL_RGBA8;
+    header.compressed = compress ? 1 : 0;
+    header.tileSize = pageTileSize;
+    header.border = pageBorder;
+    header.pagesX = static_cast<uint32_t>(pagesX);
+    header.pagesY = static_cast<uint32_t>(pagesY);
+    header.levels = static_cast<uint32_t>(levels);
+    header.reserved = 0;
+
+    size_t pageCount = 0;
+    for (int level = 0; level < levels; ++level)
+        pageCount += static_cast<size_t>(std::max(pagesX >> level, 1)) * std::max(pagesY >> level, 1);
+    std::vector<uint64_t> records;
+    uint64_t offset = sizeof(PageFileHeader) + pageCount * 2 * sizeof(uint64_t);
+    for (size_t i = 0; i < pageCount; ++i) {
+        records.push_back(offset);
+        records.push_back(pageBytes);
+        offset += pageBytes;
+    }
+
+    std::string filePath = textureCachePath(path, "vt");
+    std::string tempPath = filePath + ".tmp";
+    FILE* file = std::fopen(tempPath.c_str(), "wb");
+    if (!file)
+        return false;
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1
+        && std::fwrite(records.data(), sizeof(uint64_t), records.size(), file) == records.size();
+
+    // Pages are cut and compressed a level at a time, in parallel
+    for (int level = 0; level < levels && ok; ++level) {
+        int levelX = std::max(pagesX >> level, 1);
+        int levelY = std::max(pagesY >> level, 1);
+        std::vector<unsigned char> levelData(static_cast<size_t>(levelX) * levelY * pageBytes);
+        ThreadPool::shared().parallelFor(levelX * levelY, [&](int i) {
+            std::vector<unsigned char> rgba;
+            copyPage(mips[level], i % levelX, i / levelX, pageTileSize, pageBorder, rgba);
+            unsigned char* out = &levelData[static_cast<size_t>(i) * pageBytes];
+            if (compress)
+                compressImage(rgba.data(), pageSize, pageSize, BLOCK_BC1, out);
+            else
+                std::memcpy(out, rgba.data(), pageBytes);
+        });
+        std::vector<unsigned char>().swap(mips[level].rgba);
+        ok = std::fwrite(levelData.data(), 1, levelData.size(), file) == levelData.size();
+    }
+    ok = std::fclose(file) == 0 && ok;
+
+    if (ok) {
+        std::remove(filePath.c_str());
+        ok = std::rename(tempPath.c_str(), filePath.c_str()) == 0;
+    }
+    if (!ok)
+        std::remove(tempPath.c_str());
+    return ok;
+}
+
+}
+
+VirtualTexture::VirtualTexture(int physicalPages, int uploadsPerFrame)
+    : uploadsPerFrame(uploadsPerFrame), physicalPages(physicalPages) {
+}
+
+VirtualTexture::~VirtualTexture() {
+    stopLoader();
+    if (pageFile)
+        std::fclose(pageFile);
+}
+
+void VirtualTexture::stopLoader() {
+    if (!loader.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    loader.join();
+}
+
+void VirtualTexture::shutdown() {
+    stopLoader();
+    for (void*& fence : feedbackFences) {
+        if (fence)
+            glDeleteSync(static_cast<GLsync>(fence));
+        fence = nullptr;
+    }
+    glDeleteBuffers(2, feedbackBuffers);
+    feedbackBuffers[0] = feedbackBuffers[1] = 0;
+    glDeleteFramebuffers(1, &feedbackFramebuffer);
+    glDeleteRenderbuffers(1, &feedbackColor);
+    glDeleteRenderbuffers(1, &feedbackDepth);
+    glDeleteTextures(1, &indirectionTexture);
+    glDeleteTextures(1, &physicalTexture);
+    feedbackFramebuffer = feedbackColor = feedbackDepth = 0;
+    indirectionTexture = physicalTexture = 0;
+    slots.clear();
+    pageSlots.clear();
+}
+
+// Opens the page file and reads its page table, checking it was baked from
+// the current source with the same compression
+bool VirtualTexture::readPageTable(const char* path, bool compress) {
+    uint64_t size;
+    int64_t time;
+    if (!textureSourceStamp(path, size, time))
+        return false;
+
+    std::FILE* file = std::fopen(textureCachePath(path, "vt").c_str(), "rb");
+    if (!file)
+        return false;
+
+    PageFileHeader header;
+    bool ok = std::fread(&header, sizeof(header), 1, file) == 1
+        && std::memcmp(header.magic, pageFileMagic, sizeof(pageFileMagic)) == 0
+        && header.version == pageFileVersion
+        && header.sourceSize == size
+        && header.sourceTime == time
+        && (header.compressed != 0) == compress
+        && header.levels > 0 && header.levels <= 15
+        && header.pagesX > 0 && header.pagesX <= (1u << 14)
+        && header.pagesY > 0 && header.pagesY <= (1u << 14);
+
+    if (ok) {
+        pagesX = static_cast<int>(header.pagesX);
+        pagesY = static_cast<int>(header.pagesY);
+        levels = static_cast<int>(header.levels);
+        tileSize = static_cast<int>(header.tileSize);
+        border = static_cast<int>(header.border);
+        glFormat = header.glFormat;
+        compressed = header.compressed != 0;
+
+        levelStart.clear();
+        size_t pageCount = 0;
+        for (int level = 0; level < levels; ++level) {
+            levelStart.push_back(pageCount);
+            pageCount += static_cast<size_t>(levelPagesX(level)) * levelPagesY(level);
+        }
+        records.resize(pageCount);
+        ok = std::fread(records.data(), sizeof(PageRecord), records.size(), file) == records.size();
+    }
+
+    if (!ok) {
+        std::fclose(file);
+        return false;
+    }
+    pageFile = file;
+    return true;
+}
+
+bool VirtualTexture::open(const char* path, int viewportWidth, int viewportHeight) {
+    bool compress = GLEW_EXT_texture_compression_s3tc != 0;
+    if (!readPageTable(path, compress)) {
+        if (!bakePageFile(path, compress) || !readPageTable(path, compress)) {
+            std::cerr << "Failed to open virtual texture " << path << std::endl;
+            return false;
+        }
+    }
+
+    // Pages are 4x4-block aligned, so compressed pages upload in place
+    int pageSize = tileSize + 2 * border;
+    int physicalSize = physicalPages * pageSize;
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    if (physicalSize > maxTextureSize) {
+        std::cerr << "Virtual texture cache of " << physicalSize << " texels is over the GL limit" << std::endl;
+        return false;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glGenTextures(1, &physicalTexture);
+    glBindTexture(GL_TEXTURE_2D, physicalTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, glFormat, physicalSize, physicalSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+    indirection.resize(levels);
+    glGenTextures(1, &indirectionTexture);
+    glBindTexture(GL_TEXTURE_2D, indirectionTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    for (int level = 0; level < levels; ++level) {
+        indirection[level].assign(static_cast<size_t>(levelPagesX(level)) * levelPagesY(level) * 4, 0);
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8UI, levelPagesX(level), levelPagesY(level), 0, GL_RGBA_INTEGER,
+                     GL_UNSIGNED_BYTE, nullptr);
+    }
+
+    feedbackWidth = std::max(viewportWidth / feedbackDivisor, 1);
+    feedbackHeight = std::max(viewportHeight / feedbackDivisor, 1);
+    feedbackBias = -std::log2(static_cast<float>(feedbackDivisor));
+    glGenRenderbuffers(1, &feedbackColor);
+    glBindRenderbuffer(GL_RENDERBUFFER, feedbackColor);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA16UI, feedbackWidth, feedbackHeight);
+    glGenRenderbuffers(1, &feedbackDepth);
+    glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, feedbackWidth, feedbackHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    GLint previousFramebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glGenFramebuffers(1, &feedbackFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, feedbackColor);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    if (!complete) {
+        std::cerr << "Virtual texture feedback framebuffer is incomplete" << std::endl;
+        return false;
+    }
+
+    glGenBuffers(2, feedbackBuffers);
+    for (unsigned int buffer : feedbackBuffers) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<GLsizeiptr>(feedbackWidth) * feedbackHeight * 8, nullptr,
+                     GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    // The coarsest level is a single page, read now and never evicted
+    slots.resize(static_cast<size_t>(physicalPages) * physicalPages);
+    LoadedPage coarsest;
+    coarsest.page = pageId(levels - 1, 0, 0);
+    if (!readPage(pageFile, coarsest.page, coarsest.data)) {
+        std::cerr << "Failed to read virtual texture " << path << std::endl;
+        std::fclose(pageFile);
+        pageFile = nullptr;
+        return false;
+    }
+    upload(coarsest, 0);
+    slots[0].pinned = true;
+    rebuildIndirection();
+
+    loader = std::thread(&VirtualTexture::loaderLoop, this);
+    return true;
+}
+
+// Level in the top 4 bits, then 14 bits each for the page row and column
+uint32_t VirtualTexture::pageId(int level, int x, int y) {
+    return (static_cast<uint32_t>(level) << 28) | (static_cast<uint32_t>(y) << 14) | static_cast<uint32_t>(x);
+}
+
+int VirtualTexture::levelPagesX(int level) const {
+    return std::max(pagesX >> level, 1);
+}
+
+int VirtualTexture::levelPagesY(int level) const {
+    return std::max(pagesY >> level, 1);
+}
+
+size_t VirtualTexture::recordIndex(int level, int x, int y) const {
+    return levelStart[level] + static_cast<size_t>(y) * levelPagesX(level) + x;
+}
+
+bool VirtualTexture::readPage(std::FILE* file, uint32_t page, std::vector<unsigned char>& data) const {
+    const PageRecord& record = records[recordIndex(page >> 28, page & 0x3fff, (page >> 14) & 0x3fff)];
+    data.resize(static_cast<size_t>(record.size));
+    return seekFile(file, record.offset)
+        && std::fread(data.data(), 1, data.size(), file) == data.size();
+}
+
+void VirtualTexture::loaderLoop() {
+    for (;;) {
+        LoadedPage page;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || !requests.empty(); });
+            if (stopping)
+                return;
+            page.page = requests.front();
+            requests.pop_front();
+        }
+
+        if (!readPage(pageFile, page.page, page.data))
+            page.data.clear(); // tells update() the read failed
+
+        std::lock_guard<std::mutex> lock(mutex);
+        loaded.push_back(std::move(page));
+    }
+}
+
+void VirtualTexture::beginFeedback() {
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &savedFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, savedViewport);
+    glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+    glViewport(0, 0, feedbackWidth, feedbackHeight);
+    const GLuint nothing[4] = {0, 0, 0, 0};
+    glClearBufferuiv(GL_COLOR, 0, nothing);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+// Copies the pass into a pixel pack buffer; update() reads it once its fence
+// has passed, so the readback never stalls the frame
+void VirtualTexture::endFeedback() {
+    int buffer = feedbackNext;
+    feedbackNext ^= 1;
+    if (feedbackFences[buffer])
+        glDeleteSync(static_cast<GLsync>(feedbackFences[buffer])); // never read; newer feedback replaces it
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffers[buffer]);
+    glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    feedbackFences[buffer] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+    glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+}
+
+// Marks the page and the coarser pages covering it as seen this frame,
+// asking for the ones that aren't resident or on their way
+void VirtualTexture::markUsed(uint32_t page) {
+    int level = static_cast<int>(page >> 28);
+    int x = static_cast<int>(page & 0x3fff);
+    int y = static_cast<int>((page >> 14) & 0x3fff);
+    if (level >= levels || x >= levelPagesX(level) || y >= levelPagesY(level))
+        return;
+    for (; level < levels; ++level, x >>= 1, y >>= 1) {
+        uint32_t id = pageId(level, x, y);
+        auto resident = pageSlots.find(id);
+        if (resident != pageSlots.end()) {
+            if (slots[resident->second].lastUsed == frame)
+                return; // so are its ancestors
+            slots[resident->second].lastUsed = frame;
+        } else if (requested.find(id) == requested.end()) {
+            requested[id] = 0; // frame 0: wanted, not yet queued
+        }
+    }
+}
+
+void VirtualTexture::readFeedback() {
+    int buffer = feedbackNext; // the older of the two
+    GLsync fence = static_cast<GLsync>(feedbackFences[buffer]);
+    if (!fence)
+        return;
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return;
+    glDeleteSync(fence);
+    feedbackFences[buffer] = nullptr;
+
+    size_t texels = static_cast<size_t>(feedbackWidth) * feedbackHeight;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffers[buffer]);
+    const unsigned short* pixels = static_cast<const unsigned short*>(
+        glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, static_cast<GLsizeiptr>(texels * 8), GL_MAP_READ_BIT));
+    std::vector<uint32_t> seen;
+    if (pixels) {
+        for (size_t i = 0; i < texels; ++i, pixels += 4)
+            if (pixels[3] != 0)
+                seen.push_back(pageId(pixels[2], pixels[0], pixels[1]));
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    std::sort(seen.begin(), seen.end());
+    seen.erase(std::unique(seen.begin(), seen.end()), seen.end());
+    for (uint32_t page : seen)
+        markUsed(page);
+}
+
+// A free slot, or the least recently seen one that wasn't seen this frame;
+// -1 when every page in the cache is in view
+int VirtualTexture::takeSlot() {
+    int best = -1;
+    for (size_t i = 0; i < slots.size(); ++i) {
+        const Slot& slot = slots[i];
+        if (!slot.used)
+            return static_cast<int>(i);
+        if (!slot.pinned && slot.lastUsed < frame && (best < 0 || slot.lastUsed < slots[best].lastUsed))
+            best = static_cast<int>(i);
+    }
+    if (best >= 0) {
+        pageSlots.erase(slots[best].page);
+        slots[best].used = false;
+    }
+    return best;
+}
+
+void VirtualTexture::upload(const LoadedPage& page, int slot) {
+    int pageSize = tileSize + 2 * border;
+    int x = (slot % physicalPages) * pageSize;
+    int y = (slot / physicalPages) * pageSize;
+    glBindTexture(GL_TEXTURE_2D, physicalTexture);
+    if (compressed)
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x, y, pageSize, pageSize, glFormat,
+                                  static_cast<GLsizei>(page.data.size()), page.data.data());
+    else
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, pageSize, pageSize, GL_RGBA, GL_UNSIGNED_BYTE, page.data.data());
+
+    slots[slot].page = page.page;
+    slots[slot].lastUsed = frame;
+    slots[slot].used = true;
+    pageSlots[page.page] = slot;
+    indirectionDirty = true;
+}
+
+// Every page points at itself when resident and at its parent's entry
+// otherwise, so lookups always land on the finest resident ancestor
+void VirtualTexture::rebuildIndirection() {
+    glBindTexture(GL_TEXTURE_2D, indirectionTexture);
+    for (int level = levels - 1; level >= 0; --level) {
+        std::vector<unsigned char>& texels = indirection[level];
+        int levelX = levelPagesX(level);
+        int levelY = levelPagesY(level);
+        for (int y = 0; y < levelY; ++y) {
+            for (int x = 0; x < levelX; ++x) {
+                unsigned char* texel = &texels[(static_cast<size_t>(y) * levelX + x) * 4];
+                auto resident = pageSlots.find(pageId(level, x, y));
+                if (resident != pageSlots.end()) {
+                    texel[0] = static_cast<unsigned char>(resident->second % physicalPages);
+                    texel[1] = static_cast<unsigned char>(resident->second / physicalPages);
+                    texel[2] = static_cast<unsigned char>(level);
+                    texel[3] = 255;
+                } else if (level + 1 < levels) {
+                    const std::vector<unsigned char>& parent = indirection[level + 1];
+                    size_t parentIndex = static_cast<size_t>(y >> 1) * levelPagesX(level + 1) + (x >> 1);
+                    std::memcpy(texel, &parent[parentIndex * 4], 4);
+                }
+            }
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, levelX, levelY, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, texels.data());
+    }
+    indirectionDirty = false;
+}
+
+void VirtualTexture::update() {
+    if (!pageFile)
+        return;
+    ++frame;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    readFeedback();
+
+    // Queue what the feedback asked for, coarsest first so there is always a
+    // better fallback on its way
+    std::vector<uint32_t> wanted;
+    size_t queued = 0;
+    for (const auto& request : requested) {
+        if (request.second == 0)
+            wanted.push_back(request.first);
+        else
+            ++queued;
+    }
+    std::sort(wanted.begin(), wanted.end(), [](uint32_t a, uint32_t b) { return a > b; });
+    if (queued + wanted.size() > maxPendingPages) {
+        size_t keep = queued < maxPendingPages ? maxPendingPages - queued : 0;
+        for (size_t i = keep; i < wanted.size(); ++i)
+            requested.erase(wanted[i]); // asked for again by a later feedback
+        wanted.resize(keep);
+    }
+
+    std::vector<LoadedPage> arrived;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (uint32_t page : wanted) {
+            requests.push_back(page);
+            requested[page] = frame;
+        }
+        size_t count = std::min(loaded.size(), static_cast<size_t>(std::max(uploadsPerFrame, 0)));
+        arrived.assign(std::make_move_iterator(loaded.begin()), std::make_move_iterator(loaded.begin() + count));
+        loaded.erase(loaded.begin(), loaded.begin() + count);
+    }
+    if (!wanted.empty())
+        wake.notify_one();
+
+    bool full = false;
+    for (const LoadedPage& page : arrived) {
+        requested.erase(page.page);
+        if (full || page.data.empty() || pageSlots.count(page.page))
+            continue;
+        int slot = takeSlot();
+        full = slot < 0; // the cache is all in view; the rest get asked for again
+        if (!full)
+            upload(page, slot);
+    }
+
+    if (indirectionDirty)
+        rebuildIndirection();
+}
+
+void VirtualTexture::setUniforms(ShaderProgram& program, int physicalUnit, int indirectionUnit, bool feedbackPass) const {
+    glActiveTexture(GL_TEXTURE0 + physicalUnit);
+    glBindTexture(GL_TEXTURE_2D, physicalTexture);
+    glActiveTexture(GL_TEXTURE0 + indirectionUnit);
+    glBindTexture(GL_TEXTURE_2D, indirectionTexture);
+    glActiveTexture(GL_TEXTURE0);
+
+    float physicalSize = static_cast<float>(physicalPages * (tileSize + 2 * border));
+    program.set(UNIFORM_VT_PHYSICAL, physicalUnit);
+    program.set(UNIFORM_VT_INDIRECTION, indirectionUnit);
+    program.set(UNIFORM_VT_PAGES, glm::ivec2(pagesX, pagesY));
+    program.set(UNIFORM_VT_LEVELS, levels);
+    program.set(UNIFORM_VT_TILE_SIZE, static_cast<float>(tileSize));
+    program.set(UNIFORM_VT_BORDER, static_cast<float>(border));
+    program.set(UNIFORM_VT_PHYSICAL_SIZE, glm::vec2(physicalSize));
+    program.set(UNIFORM_VT_LOD_BIAS, feedbackPass ? feedbackBias : 0.0f);
+}
@@ -0,0 +1,142 @@
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include "shader_program.h"
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// A texture too large to keep on the GPU, split into square pages. Only the
+// pages the camera sees stay resident, in a fixed-size cache texture, and an
+// indirection texture (one texel per page and mip level) tells the shader
+// where each one is; pages that aren't loaded fall back to the nearest
+// coarser level that is. Which pages are needed comes from a feedback pass:
+// the geometry drawn at low resolution writing page and level per pixel,
+// read back a frame later.
+//
+// The pages are baked once into a page file next to the source image
+// ("image.png.vt.txc") and read from it on a loader thread. VRAM stays at
+// the cache and indirection textures whatever the size of the image.
+struct VirtualTexture {
+    // physicalPages is the cache texture's size in pages per side;
+    // uploadsPerFrame the pages update() hands to GL at most
+    explicit VirtualTexture(int physicalPages = 16, int uploadsPerFrame = 8);
+    ~VirtualTexture();
+
+    VirtualTexture(const VirtualTexture&) = delete;
+    VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+    // Opens the page file for an opaque colour image, baking it first when
+    // it is missing or stale, and loads the coarsest level so there is
+    // always something to show. The feedback pass renders at a fraction of
+    // viewportWidth x viewportHeight. False when the page file can't be
+    // baked or read, or the GL objects can't be made; the texture must not be
+    // drawn with then. GL thread only.
+    bool open(const char* path, int viewportWidth, int viewportHeight);
+
+    // Bind a framebuffer for the feedback pass and restore the previous one.
+    // Between them, draw the geometry using the texture with a shader that
+    // writes uvec4(page, level, 1) (see setUniforms).
+    void beginFeedback();
+    void endFeedback();
+
+    // Reads back the last finished feedback pass, asks the loader for the
+    // pages it saw and uploads loaded ones into the cache, evicting the
+    // least recently seen. Call once per frame on the GL thread.
+    void update();
+
+    // Binds the cache and indirection textures to the given units and sets
+    // the UNIFORM_VT_* uniforms of program (which must be current); the LOD
+    // bias corrects the feedback pass's mip level for its lower resolution.
+    void setUniforms(ShaderProgram& program, int physicalUnit, int indirectionUnit, bool feedbackPass) const;
+
+    // Stops the loader and deletes the cache, indirection and feedback
+    // objects. Call on the GL thread while the context is current, before
+    // glfwTerminate; the destructor only stops the loader and closes the
+    // page file, since it may run once the context is gone.
+    void shutdown();
+
+    // Pages currently in the cache texture
+    int residentPages() const { return static_cast<int>(pageSlots.size()); }
+
+    int uploadsPerFrame;
+
+private:
+    struct PageRecord {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    // A page read by the loader thread, waiting for its upload
+    struct LoadedPage {
+        uint32_t page;
+        std::vector<unsigned char> data;
+    };
+
+    // One page-sized square of the cache texture
+    struct Slot {
+        uint32_t page = 0;
+        unsigned long long lastUsed = 0;
+        bool used = false;
+        bool pinned = false; // the coarsest level, always resident
+    };
+
+    bool readPageTable(const char* path, bool compress);
+    static uint32_t pageId(int level, int x, int y);
+    int levelPagesX(int level) const;
+    int levelPagesY(int level) const;
+    size_t recordIndex(int level, int x, int y) const;
+    bool readPage(std::FILE* file, uint32_t page, std::vector<unsigned char>& data) const;
+    void loaderLoop();
+    void stopLoader();
+    void readFeedback();
+    void markUsed(uint32_t page);
+    int takeSlot();
+    void upload(const LoadedPage& page, int slot);
+    void rebuildIndirection();
+
+    // page file layout, fixed after open()
+    std::FILE* pageFile = nullptr;
+    std::vector<PageRecord> records;
+    std::vector<size_t> levelStart; // first record of each level
+    int pagesX = 0, pagesY = 0;     // at level 0, powers of two
+    int levels = 0;
+    int tileSize = 0, border = 0;
+    unsigned int glFormat = 0;
+    bool compressed = false;
+
+    // GL thread only
+    int physicalPages;
+    unsigned int physicalTexture = 0;
+    unsigned int indirectionTexture = 0;
+    std::vector<std::vector<unsigned char>> indirection; // RGBA8UI texels per level: slot x, slot y, level
+    bool indirectionDirty = false;
+    std::vector<Slot> slots;
+    std::unordered_map<uint32_t, int> pageSlots;
+    std::unordered_map<uint32_t, unsigned long long> requested; // page -> frame it was asked for
+    unsigned long long frame = 0;
+    int feedbackWidth = 0, feedbackHeight = 0;
+    float feedbackBias = 0.0f;
+    unsigned int feedbackFramebuffer = 0;
+    unsigned int feedbackColor = 0;
+    unsigned int feedbackDepth = 0;
+    unsigned int feedbackBuffers[2] = {0, 0}; // pixel pack buffers, written alternately
+    void* feedbackFences[2] = {nullptr, nullptr};
+    int feedbackNext = 0;
+    int savedFramebuffer = 0;
+    int savedViewport[4] = {0, 0, 0, 0};
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<uint32_t> requests;
+    std::vector<LoadedPage> loaded;
+    bool stopping = false;
+    std::thread loader;
+};
+
+#endif